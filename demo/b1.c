@@ -0,0 +1,125 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright (c) 2021 Amol Surati
+
+#include <lib/stdio.h>
+#include <lib/stdlib.h>
+
+#include <sys/err.h>
+
+#include <dev/con.h>
+#include <dev/tmr.h>
+
+// Compare the subtraction-loop divmod and decimal conversion, which lib/ used
+// to have, against the current ones. The old versions are only run on the
+// ranges where they finish in reasonable time.
+
+#define B1_NUM_VALS			64
+
+struct b1_range {
+	const char			*name;
+	uint64_t			max;
+	char				run_old;
+};
+
+static
+uint64_t b1_old_divmod(uint64_t num, uint64_t den, uint64_t *mod)
+{
+	uint64_t q;
+
+	q = 0;
+	while (num >= den) {
+		++q;
+		num -= den;
+	}
+	if (mod)
+		*mod = num;
+	return q;
+}
+
+static
+int b1_old_u64toan_10(uint64_t val, char *str, size_t size)
+{
+	int i;
+	uint64_t t, r;
+	size_t req_size;
+
+	t = val;
+	req_size = 0;
+	do {
+		++req_size;
+		t = b1_old_divmod(t, 10, NULL);
+	} while (t);
+
+	if (size < req_size)
+		return 0;
+
+	t = val;
+	for (i = req_size - 1; i >= 0; --i) {
+		t = b1_old_divmod(t, 10, &r);
+		str[i] = '0' + r;
+	}
+	return req_size;
+}
+
+static
+uint64_t b1_rand64(uint64_t max)
+{
+	uint64_t v;
+
+	v = (uint64_t)(uint32_t)rand() << 32;
+	v |= (uint32_t)rand();
+	if (max == (uint64_t)-1)
+		return v;
+	divmod(v, max + 1, &v);
+	return v;
+}
+
+int b1_run()
+{
+	int i, j;
+	uint32_t start, old_div, new_div, old_fmt, new_fmt;
+	uint64_t vals[B1_NUM_VALS], r, sum;
+	char buf[24];
+	static const struct b1_range ranges[] = {
+		{"1e2", 99, 1},
+		{"1e4", 9999, 1},
+		{"1e6", 999999, 1},
+		{"2^32", 0xffffffff, 0},
+		{"2^64", (uint64_t)-1, 0},
+	};
+
+	srand(1);
+	sum = 0;
+	for (i = 0; i < (int)(sizeof(ranges) / sizeof(ranges[0])); ++i) {
+		for (j = 0; j < B1_NUM_VALS; ++j)
+			vals[j] = b1_rand64(ranges[i].max);
+
+		old_div = old_fmt = 0;
+		if (ranges[i].run_old) {
+			start = tmr_get_ctr();
+			for (j = 0; j < B1_NUM_VALS; ++j)
+				sum += b1_old_divmod(vals[j], 10, &r) + r;
+			old_div = tmr_get_ctr() - start;
+
+			start = tmr_get_ctr();
+			for (j = 0; j < B1_NUM_VALS; ++j)
+				sum += b1_old_u64toan_10(vals[j], buf, sizeof(buf));
+			old_fmt = tmr_get_ctr() - start;
+		}
+
+		start = tmr_get_ctr();
+		for (j = 0; j < B1_NUM_VALS; ++j)
+			sum += divmod(vals[j], 10, &r) + r;
+		new_div = tmr_get_ctr() - start;
+
+		start = tmr_get_ctr();
+		for (j = 0; j < B1_NUM_VALS; ++j)
+			sum += u64toan(vals[j], buf, sizeof(buf), 10);
+		new_fmt = tmr_get_ctr() - start;
+
+		// Times are in microseconds, for B1_NUM_VALS values.
+		con_out("b1: %s div old %d new %d, fmt old %d new %d",
+			ranges[i].name, old_div, new_div, old_fmt, new_fmt);
+	}
+	return sum ? ERR_SUCCESS : ERR_UNEXP;
+}
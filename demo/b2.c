@@ -0,0 +1,71 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright (c) 2021 Amol Surati
+
+#include <lib/stdlib.h>
+#include <lib/string.h>
+
+#include <sys/err.h>
+#include <sys/mmu.h>
+#include <sys/perf.h>
+#include <sys/pmm.h>
+#include <sys/vmm.h>
+
+#include <dev/con.h>
+
+// Profile memcpy, the slab allocator and the mmu in cycles, with the PMU.
+
+#define B2_NUM_ITERS			64
+
+int b2_run()
+{
+	int i, err;
+	vpn_t page;
+	pfn_t frame;
+	void *p;
+	struct perf_sample s;
+	static char src[4096], dst[4096];
+	static struct perf_region r_memcpy = PERF_REGION_INIT("memcpy_4k");
+	static struct perf_region r_malloc = PERF_REGION_INIT("malloc_64");
+	static struct perf_region r_free = PERF_REGION_INIT("free_64");
+	static struct perf_region r_map = PERF_REGION_INIT("mmu_map_page");
+
+	err = pmm_alloc(ALIGN_PAGE, 1, &frame);
+	if (err)
+		return err;
+	err = vmm_alloc(ALIGN_PAGE, 1, &page);
+	if (err)
+		goto err0;
+
+	// mmu_unmap_page is not implemented yet; the page stays mapped, and
+	// is not freed.
+	perf_begin(&s);
+	err = mmu_map_page(0, page, frame, ALIGN_PAGE, PROT_RW);
+	perf_end(&r_map, &s);
+	if (err)
+		goto err1;
+
+	for (i = 0; i < B2_NUM_ITERS; ++i) {
+		perf_begin(&s);
+		memcpy(dst, src, sizeof(dst));
+		perf_end(&r_memcpy, &s);
+
+		perf_begin(&s);
+		p = malloc(64);
+		perf_end(&r_malloc, &s);
+		if (p == NULL) {
+			err = ERR_NO_MEM;
+			break;
+		}
+
+		perf_begin(&s);
+		free(p);
+		perf_end(&r_free, &s);
+	}
+	perf_dump();
+	return err;
+err1:
+	vmm_free(page, 1);
+err0:
+	pmm_free(frame, 1);
+	return err;
+}
@@ -0,0 +1,464 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright (c) 2021 Amol Surati
+
+#include <lib/stdlib.h>
+#include <lib/string.h>
+
+#include <sys/cpu.h>
+#include <sys/err.h>
+#include <sys/irqstat.h>
+#include <sys/mutex.h>
+#include <sys/perf.h>
+#include <sys/semaphore.h>
+#include <sys/task.h>
+#include <sys/thread.h>
+#include <sys/trace.h>
+
+#include <dev/con.h>
+#include <dev/disp.h>
+#include <dev/tmr.h>
+
+// Run each demo, and a few microbenchmarks, a number of times, and print
+// one line per benchmark, with the fields always in this order:
+//	bench: name=<s> n=<d> unit=<us|cyc> min=<d> med=<d> p99=<d>
+//	       ops_s=<d> kb_s=<d> kpix_s=<d> tris_s=<d>
+// The rates are per second, computed from the median; a rate which does
+// not apply is 0. The run ends with the counts of the stolen tasks, and of
+// the display's frame timing.
+
+#define BENCH_NUM_WARMUP		2
+#define BENCH_MAX_ITERS			64
+#define BENCH_NUM_OPS			256
+#define BENCH_NUM_TASKS			64
+#define BENCH_TASK_NUM_WORDS		1024
+
+// The V3D jobs, and the waits on the mutexes, are traced over the run. The
+// irqs and the thread switches would flood the rings.
+#define BENCH_TRACE_MASK					\
+	((1ul << TRACE_MUTEX_WAIT) | (1ul << TRACE_V3D_IRQ) |		\
+	 (1ul << TRACE_V3D_RUN_PROG) | (1ul << TRACE_V3D_RUN_BINNER) |	\
+	 (1ul << TRACE_V3D_RUN_RENDERER))
+
+enum bench_unit {
+	BENCH_UNIT_US,
+	BENCH_UNIT_CYCLES,
+};
+
+typedef int fn_demo_run();
+
+// Measure one iteration; return the sample in the unit of the benchmark.
+typedef int fn_bench(uint32_t *out);
+
+// Either demo or fn is set. A demo is timed by the runner.
+struct bench {
+	const char			*name;
+	fn_demo_run			*demo;
+	fn_bench			*fn;
+	enum bench_unit			unit;
+	uint32_t			num_ops;
+	uint32_t			num_bytes;
+	uint32_t			num_pix;
+};
+
+static struct mutex g_bench_mutex;
+static struct semaphore g_bench_ping;
+static struct semaphore g_bench_pong;
+static struct thread *g_bench_partner;
+
+// The tasks are all spawned on one cpu; those which ran elsewhere were
+// stolen by the workers of the other cpus.
+struct bench_task {
+	struct task			task;
+	int				index;
+	int				cpu;
+};
+
+static struct bench_task g_bench_tasks[BENCH_NUM_TASKS];
+static uint32_t g_bench_task_data[BENCH_NUM_TASKS][BENCH_TASK_NUM_WORDS];
+static int g_bench_num_spawned;
+static int g_bench_num_stolen;
+
+// The triangles submitted by the demo being run.
+static uint32_t g_bench_num_tris;
+
+// Set by the alarm of the IRQ latency probe; p tells the alarms apart.
+static void *volatile g_bench_irq_p;
+static uint32_t g_bench_irq_cycles;
+
+static
+int bench_malloc_free(uint32_t *out)
+{
+	int i;
+	void *p;
+	uint32_t start;
+
+	start = tmr_get_ctr();
+	for (i = 0; i < BENCH_NUM_OPS; ++i) {
+		p = malloc(64);
+		if (p == NULL)
+			return ERR_NO_MEM;
+		free(p);
+	}
+	*out = tmr_get_ctr() - start;
+	return ERR_SUCCESS;
+}
+
+static
+int bench_mutex(uint32_t *out)
+{
+	int i;
+	uint32_t start;
+
+	start = tmr_get_ctr();
+	for (i = 0; i < BENCH_NUM_OPS; ++i) {
+		mutex_lock(&g_bench_mutex);
+		mutex_unlock(&g_bench_mutex);
+	}
+	*out = tmr_get_ctr() - start;
+	return ERR_SUCCESS;
+}
+
+static
+int bench_memcpy(uint32_t *out)
+{
+	int i;
+	uint32_t start;
+	static char src[4096], dst[4096];
+
+	start = tmr_get_ctr();
+	for (i = 0; i < 16; ++i)
+		memcpy(dst, src, sizeof(dst));
+	*out = tmr_get_ctr() - start;
+	return ERR_SUCCESS;
+}
+
+// IPL_THREAD
+static
+int bench_partner(void *p)
+{
+	for (;;) {
+		semaphore_down(&g_bench_ping);
+		semaphore_up(&g_bench_pong);
+	}
+	return ERR_SUCCESS;
+	(void)p;
+}
+
+// Each round trip is two switches. On SMP, the partner may run on another
+// cpu; the sample then is that of a cross-cpu wakeup.
+static
+int bench_ctx_switch(uint32_t *out)
+{
+	int i, err;
+	uint32_t start;
+
+	if (g_bench_partner == NULL) {
+		err = thread_create(bench_partner, NULL, &g_bench_partner);
+		if (err)
+			return err;
+	}
+
+	start = tmr_get_ctr();
+	for (i = 0; i < BENCH_NUM_OPS / 2; ++i) {
+		semaphore_up(&g_bench_ping);
+		semaphore_down(&g_bench_pong);
+	}
+	*out = tmr_get_ctr() - start;
+	return ERR_SUCCESS;
+}
+
+// IPL_THREAD
+static
+void bench_task(void *p)
+{
+	int i, j;
+	uint32_t v, *data;
+	struct bench_task *bt;
+
+	bt = p;
+	bt->cpu = cpu_get_index();
+	data = g_bench_task_data[bt->index];
+	for (j = 0; j < 16; ++j) {
+		v = j;
+		for (i = 0; i < BENCH_TASK_NUM_WORDS; ++i) {
+			v = v * 33 + data[i];
+			data[i] = v;
+		}
+	}
+}
+
+// One group of tasks, spawned on this cpu, and synced.
+static
+int bench_task_fanout(uint32_t *out)
+{
+	int i, ix;
+	uint32_t start;
+	struct task_group g;
+
+	task_group_init(&g);
+	ix = cpu_get_index();
+	start = tmr_get_ctr();
+	for (i = 0; i < BENCH_NUM_TASKS; ++i) {
+		g_bench_tasks[i].index = i;
+		task_spawn(&g, &g_bench_tasks[i].task, bench_task,
+			   &g_bench_tasks[i]);
+	}
+	task_sync(&g);
+	*out = tmr_get_ctr() - start;
+
+	g_bench_num_spawned += BENCH_NUM_TASKS;
+	for (i = 0; i < BENCH_NUM_TASKS; ++i)
+		if (g_bench_tasks[i].cpu != ix)
+			++g_bench_num_stolen;
+	return ERR_SUCCESS;
+}
+
+// IPL_HARD
+static
+void bench_irq_alarm(void *p)
+{
+	g_bench_irq_cycles = perf_read_cycles();
+	dmb();
+	g_bench_irq_p = p;
+}
+
+// The cycles from the moment the timer reaches the alarm, to the moment the
+// alarm handler runs. The alarm is an IRQ. The thread stamps the cycle
+// counter as it polls the timer; the match lies after the last stamp which
+// saw the timer short of the alarm, so that a sample overstates the latency
+// by at most one poll. The cycle counters are per-cpu, and the GPU IRQs
+// reach only cpu0; IPL_SCHED keeps the thread there, with the IRQs enabled.
+static
+int bench_irq_latency(uint32_t *out)
+{
+	int i, err;
+	enum ipl ipl;
+	reg_t irq_mask;
+	uint32_t ctr, cycles, before;
+	void *p;
+
+	ipl = cpu_raise_ipl(IPL_SCHED, &irq_mask);
+	err = ERR_UNSUP;
+	if (cpu_get_index() != 0)
+		goto exit;
+
+	for (i = 0; i < 16; ++i) {
+		ctr = tmr_get_ctr() + 100;
+		p = (void *)ctr;
+		before = perf_read_cycles();
+		tmr_set_irq_alarm(ctr, bench_irq_alarm, p);
+		for (;;) {
+			cycles = perf_read_cycles();
+			if ((int32_t)(tmr_get_ctr() - ctr) >= 0)
+				break;
+			before = cycles;
+		}
+
+		// Allow the IRQ a millisecond past the alarm.
+		while (g_bench_irq_p != p &&
+		       (int32_t)(tmr_get_ctr() - ctr) < 1000)
+			;
+		if (g_bench_irq_p != p)
+			continue;
+		dmb();
+		*out = g_bench_irq_cycles - before;
+		err = ERR_SUCCESS;
+		break;
+	}
+exit:
+	cpu_lower_ipl(ipl, irq_mask);
+	return err;
+}
+
+static
+void bench_sort(uint32_t *vals, int num)
+{
+	int i, j;
+	uint32_t v;
+
+	for (i = 1; i < num; ++i) {
+		v = vals[i];
+		for (j = i; j > 0 && vals[j - 1] > v; --j)
+			vals[j] = vals[j - 1];
+		vals[j] = v;
+	}
+}
+
+// d55, paced by the display: each frame starts at a vblank. The sample is
+// the time from that vblank to the flip; one over the frame period shows up
+// as a missed frame in the display's timing.
+static
+int bench_d55_vsync(uint32_t *out)
+{
+	int err;
+	struct disp_timing t;
+	int	d55_run();
+
+	err = disp_wait_vblank(&t);
+	if (err == ERR_INVALID)
+		return ERR_UNSUP;
+	if (err)
+		return err;
+	err = d55_run();
+	*out = tmr_get_ctr() - t.ts;
+	return err;
+}
+
+// The count of units per second, at the median.
+static
+uint32_t bench_rate(uint32_t count, uint32_t scale, uint32_t med)
+{
+	if (med == 0)
+		med = 1;
+	return divmod((uint64_t)count * scale, med, NULL);
+}
+
+// Called by the demos, as they submit their draws.
+void bench_add_tris(uint32_t num)
+{
+	g_bench_num_tris += num;
+}
+
+static
+int bench_one(const struct bench *b, int num_iters)
+{
+	int i, err, ix;
+	uint32_t start, med, ops, bytes, pix, tris;
+	uint32_t samples[BENCH_MAX_ITERS];
+	static const char *units[] = {"us", "cyc"};
+
+	for (i = -BENCH_NUM_WARMUP; i < num_iters; ++i) {
+		ix = i < 0 ? 0 : i;
+		g_bench_num_tris = 0;
+		if (b->demo) {
+			start = tmr_get_ctr();
+			err = b->demo();
+			samples[ix] = tmr_get_ctr() - start;
+		} else {
+			err = b->fn(&samples[ix]);
+		}
+		if (err)
+			return err;
+	}
+
+	bench_sort(samples, num_iters);
+	med = samples[num_iters / 2];
+	ix = (num_iters * 99 + 99) / 100 - 1;
+
+	// The rates need a time.
+	ops = bytes = pix = tris = 0;
+	if (b->unit == BENCH_UNIT_US) {
+		ops = bench_rate(b->num_ops, 1000000, med);
+		bytes = bench_rate(b->num_bytes >> 10, 1000000, med);
+		pix = bench_rate(b->num_pix, 1000, med);
+		tris = bench_rate(g_bench_num_tris, 1000000, med);
+	}
+	con_out("bench: name=%s n=%d unit=%s min=%d med=%d p99=%d ops_s=%d "
+		"kb_s=%d kpix_s=%d tris_s=%d", b->name, num_iters,
+		units[b->unit], samples[0], med, samples[ix], ops, bytes, pix,
+		tris);
+	return ERR_SUCCESS;
+}
+
+// IPL_THREAD
+int bench_run(int num_iters)
+{
+	int i, err;
+	struct disp_timing t;
+	int	d1_run();
+	int	d2_run();
+	int	d3_run();
+	int	d4_run();
+	int	d50_run();
+	int	d51_run();
+	int	d52_run();
+	int	d53_run();
+	int	d54_run();
+	int	d55_run();
+	int	d56_run();
+	int	b1_run();
+	int	b2_run();
+
+	// These print their own results; each runs once.
+	static const struct {
+		const char		*name;
+		fn_demo_run		*fn;
+	} reports[] = {
+		{"b1", b1_run},
+		{"b2", b2_run},
+	};
+
+#define FB_PIX				(640 * 480)
+	static const struct bench benches[] = {
+		{"d1", d1_run, NULL, BENCH_UNIT_US, 0, 0, 0},
+		{"d2", d2_run, NULL, BENCH_UNIT_US, 0, 0, 0},
+		{"d3", d3_run, NULL, BENCH_UNIT_US, 0, 0, 0},
+		{"d4", d4_run, NULL, BENCH_UNIT_US, 0, 0, 0},
+		{"d50", d50_run, NULL, BENCH_UNIT_US, 0, 0, FB_PIX},
+		{"d51", d51_run, NULL, BENCH_UNIT_US, 0, 0, FB_PIX},
+		{"d52", d52_run, NULL, BENCH_UNIT_US, 0, 0, FB_PIX},
+		{"d53", d53_run, NULL, BENCH_UNIT_US, 0, 0, FB_PIX},
+		{"d54", d54_run, NULL, BENCH_UNIT_US, 0, 0, FB_PIX},
+		{"d55", d55_run, NULL, BENCH_UNIT_US, 0, 0, FB_PIX},
+		{"d55_vsync", NULL, bench_d55_vsync, BENCH_UNIT_US, 0, 0,
+			FB_PIX},
+		{"d56", d56_run, NULL, BENCH_UNIT_US, 0, 0, 0},
+		{"malloc_free_64", NULL, bench_malloc_free, BENCH_UNIT_US,
+			BENCH_NUM_OPS, 0, 0},
+		{"mutex_lock_unlock", NULL, bench_mutex, BENCH_UNIT_US,
+			BENCH_NUM_OPS, 0, 0},
+		{"ctx_switch", NULL, bench_ctx_switch, BENCH_UNIT_US,
+			BENCH_NUM_OPS, 0, 0},
+		{"memcpy_4k", NULL, bench_memcpy, BENCH_UNIT_US,
+			16, 16 * 4096, 0},
+		{"irq_entry", NULL, bench_irq_latency, BENCH_UNIT_CYCLES,
+			0, 0, 0},
+		{"task_fanout", NULL, bench_task_fanout, BENCH_UNIT_US,
+			BENCH_NUM_TASKS, 0, 0},
+	};
+#undef FB_PIX
+
+	if (num_iters < 1 || num_iters > BENCH_MAX_ITERS)
+		return ERR_PARAM;
+
+	mutex_init(&g_bench_mutex);
+	semaphore_init(&g_bench_ping, 0);
+	semaphore_init(&g_bench_pong, 0);
+	g_bench_num_spawned = g_bench_num_stolen = 0;
+	irqstat_reset();
+	trace_set_mask(0);
+	trace_reset();
+	trace_set_mask(BENCH_TRACE_MASK);
+
+	for (i = 0; i < (int)(sizeof(benches) / sizeof(benches[0])); ++i) {
+		err = bench_one(&benches[i], num_iters);
+		if (err == ERR_UNSUP) {
+			con_out("bench: name=%s skipped", benches[i].name);
+			continue;
+		}
+		if (err) {
+			con_out("bench: name=%s err=%x", benches[i].name, err);
+			goto err;
+		}
+	}
+
+	for (i = 0; i < (int)(sizeof(reports) / sizeof(reports[0])); ++i) {
+		err = reports[i].fn();
+		if (err) {
+			con_out("bench: name=%s err=%x", reports[i].name, err);
+			goto err;
+		}
+	}
+	trace_set_mask(0);
+	con_out("task: spawned=%d stolen=%d", g_bench_num_spawned,
+		g_bench_num_stolen);
+	disp_get_timing(&t);
+	con_out("disp: frame=%d period=%d flips=%d missed=%d lost=%d",
+		t.frame, t.period, t.num_flips, t.num_missed, t.num_lost);
+	irqstat_dump();
+	trace_dump();
+	return ERR_SUCCESS;
+err:
+	trace_set_mask(0);
+	return err;
+}
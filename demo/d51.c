@@ -60,6 +60,7 @@ int d51_run()
 	int off, x, y;
 	va_t tva;
 	pa_t	fb_get_pa();
+	void	bench_add_tris(uint32_t num);
 
 	struct v3dcr_tile_binning_mode		*tbmc;
 	struct v3dcr_tile_binning_start		*tbs;
@@ -242,6 +243,7 @@ int d51_run()
 	va->id = 33;
 	va->mode = V3DCR_VERT_ARR_MODE_TRI;
 	va->num_verts = 3;
+	bench_add_tris(va->num_verts / 3);
 
 	f->id = 4;
 
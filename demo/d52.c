@@ -56,6 +56,7 @@ int d52_run()
 	int off, x, y;
 	va_t tva;
 	pa_t	fb_get_pa();
+	void	bench_add_tris(uint32_t num);
 
 	struct v3dcr_tile_binning_mode		*tbmc;
 	struct v3dcr_tile_binning_start		*tbs;
@@ -167,6 +168,7 @@ int d52_run()
 	va->id = 33;
 	va->mode = V3DCR_VERT_ARR_MODE_TRI;
 	va->num_verts = 3;
+	bench_add_tris(va->num_verts / 3);
 
 	f->id = 4;
 
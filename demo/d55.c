@@ -9,7 +9,6 @@
 
 #include <dev/v3d.h>
 #include <dev/con.h>
-#include <dev/hvs.h>
 #include <dev/txp.h>
 
 // Reuse from d52.
@@ -61,6 +60,7 @@ int d55_run()
 {
 	int off, x, y;
 	va_t tva;
+	void	bench_add_tris(uint32_t num);
 
 	struct v3dcr_tile_binning_mode		*tbmc;
 	struct v3dcr_tile_binning_start		*tbs;
@@ -79,6 +79,7 @@ int d55_run()
 	struct v3dcr_branch			*br;
 	struct v3dcr_store_mstcb		*str;
 	struct v3dcr_store_tb_gen		*stg;
+	struct v3d_job_stats			js;
 
 	static char v3dcr[PAGE_SIZE];
 
@@ -100,7 +101,7 @@ int d55_run()
 
 	// Local Frame Buffer into which the V3D pipeline writes the image.
 	static uint32_t l_fb[FB_WIDTH * FB_HEIGHT];
-	void	d55_run_txp(const uint32_t *);
+	int	d55_run_txp(const uint32_t *);
 
 	memcpy(unif, proj_mat, sizeof(proj_mat));
 
@@ -176,6 +177,7 @@ int d55_run()
 	va->id = 33;
 	va->mode = V3DCR_VERT_ARR_MODE_TRI;
 	va->num_verts = 3;
+	bench_add_tris(va->num_verts / 3);
 
 	f->id = 4;
 
@@ -286,121 +288,75 @@ int d55_run()
 	dsb();
 
 	v3d_run_renderer(va_to_ba((va_t)v3dcr), off);
-	d55_run_txp(l_fb);
-	return ERR_SUCCESS;
-}
-// The framebuffer format is BGRA8888, or 0xaarrggbb, or ARGB32.
 
-// From the firmware. Mitchell-Netravali.
-const uint32_t ppf_krnl[] = {
-	0x7ebfc00, 0x7e3edf8, 0x4805fd, 0x1dca432,
-	0x355769b, 0x1c6e3, 0x355769b, 0x1dca432,
-	0x4805fd, 0x7e3edf8, 0x7ebfc00
-};
+	v3d_get_job_stats(V3D_JOB_BINNER, &js);
+	v3d_print_job_stats("bin", &js);
+	v3d_get_job_stats(V3D_JOB_RENDERER, &js);
+	v3d_print_job_stats("rdr", &js);
 
-#define HVS_DL_MEM_INDEX		0x800
+	return d55_run_txp(l_fb);
+}
+// Show the scaled frame, centred, on the display. The TXP wrote the frame
+// behind the cpu's caches.
+static
+int d55_show(const struct txp_buf *out)
+{
+	int err;
+	uint32_t y, w, h, x0, y0;
+	char *dst;
+	const char *src;
+	struct disp_buf b;
+
+	err = disp_acquire_buf(&b);
+	if (err)
+		return err;
+
+	w = out->width < b.width ? out->width : b.width;
+	h = out->height < b.height ? out->height : b.height;
+	x0 = (b.width - w) >> 1;
+	y0 = (b.height - h) >> 1;
+
+	dc_ivac(out->va, out->pitch * out->height);
+	memset(b.va, 0, b.pitch * b.height);
+	src = out->va;
+	dst = (char *)b.va + y0 * b.pitch + x0 * 4;
+	for (y = 0; y < h; ++y, src += out->pitch, dst += b.pitch)
+		memcpy(dst, src, w * 4);
+	dc_cvac(b.va, b.pitch * b.height);
+	dsb();
+	return disp_flip(&b);
+}
 
-// These indices are randomly selected, and may trample upon the firmware's
-// display lists and parameters.
-#define HVS_DL_INDEX			0x400
-#define HVS_DL_PPFK_INDEX		0x410
-void d55_run_txp(const uint32_t *fb)
+// The framebuffer format is BGRA8888, or 0xaarrggbb, or ARGB32.
+int d55_run_txp(const uint32_t *fb)
 {
-	int i;
-	uint32_t val;
-	extern volatile uint32_t *g_hvs_regs;
-	extern volatile uint32_t *g_txp_regs;
-	volatile uint32_t *dl, *ppfk;
-	static uint32_t out_fb[1440 * 1080];
-	void	rle_dump(volatile uint32_t *, int, int);
-
-	dl = &g_hvs_regs[HVS_DL_MEM_INDEX + HVS_DL_INDEX];
-	ppfk = &g_hvs_regs[HVS_DL_MEM_INDEX + HVS_DL_PPFK_INDEX];
-
-	for (i = 0; i < 11; ++i)
-		ppfk[i] = ppf_krnl[i];
-
-	// The input FB (fb) has the format BGRA8888, or  ARGB32.
-	// The output FB (out_fb) is expected to be in the same format.
-	val = 0;
-	val |= bits_set(HVS_DLW_CTL0_PIXEL_FMT, 7);	// RGBA8888
-	val |= bits_set(HVS_DLW_CTL0_PIXEL_ORDER, 3);
-	val |= bits_set(HVS_DLW_CTL0_RGBA_EXPAND, 3);	// Round??
-	val |= bits_on(HVS_DLW_CTL0_VALID);
-	val |= bits_set(HVS_DLW_CTL0_NUM_WORDS, 14);	// 14 + End.
-	dl[0] = val;
-
-	dl[1] = bits_on(HVS_DLW_POS0_FIXED_ALPHA);	// 0xff
-
-	val = 0;
-	val |= bits_set(HVS_DLW_POS1_SCL_WIDTH, SCL_FB_WIDTH);
-	val |= bits_set(HVS_DLW_POS1_SCL_HEIGHT, SCL_FB_HEIGHT);
-	dl[2] = val;
-
-	val = 0;
-	val |= bits_set(HVS_DLW_POS2_SRC_WIDTH, FB_WIDTH);
-	val |= bits_set(HVS_DLW_POS2_SRC_HEIGHT, FB_HEIGHT);
-	val |= bits_set(HVS_DLW_POS2_ALPHA_MODE, 1);	// Fixed Alpha.
-	dl[3] = val;
-	dl[4] = 0;
-
-	dl[5] = va_to_ba((va_t)fb);
-	dl[6] = 0;
-	dl[7] = FB_WIDTH * 4;	// Source Pitch, for Linear Tiling.
-	dl[8] = 0x2000;		// LBM base address. Random atm.
-
-	val = 0;
-	val |= bits_set(HVS_DLW_PPF_IPHASE, 0x60);	// From firmware.
-	val |= bits_set(HVS_DLW_PPF_SCALE,
-			(1ul << 16) * FB_WIDTH / SCL_FB_WIDTH);
-	val |= bits_on(HVS_DLW_PPF_AGC);
-	dl[9] = val;
-
-	val = 0;
-	val |= bits_set(HVS_DLW_PPF_IPHASE, 0x60);	// From firmware.
-	val |= bits_set(HVS_DLW_PPF_SCALE,
-			(1ul << 16) * FB_HEIGHT / SCL_FB_HEIGHT);
-	val |= bits_on(HVS_DLW_PPF_AGC);
-	dl[10] = val;
-	dl[11] = 0;
-
-	dl[12] = HVS_DL_PPFK_INDEX;// H Scaling kernel for Plane0 (RGB, or Y)
-	dl[13] = HVS_DL_PPFK_INDEX;// V Scaling kernel for Plane0 (RGB, or Y)
-	dl[14] = bits_on(HVS_DLW_CTL0_END);
-
-	g_hvs_regs[HVS_DL2] = HVS_DL_INDEX;
-
-	val = 0;
-	val |= bits_on(HVS_DL_CTRL_EN);
-	val |= bits_on(HVS_DL_CTRL_ONESHOT);
-	val |= bits_set(HVS_DL_CTRL_HEIGHT, SCL_FB_HEIGHT);
-	val |= bits_set(HVS_DL_CTRL_WIDTH, SCL_FB_WIDTH);
-	val |= bits_set(HVS_DL_CTRL_WIDTH, SCL_FB_WIDTH);
-	g_hvs_regs[HVS_DL2_CTRL] = val;
-
-	g_txp_regs[TXP_DST_POINTER] = va_to_ba((va_t)out_fb);
-	g_txp_regs[TXP_DST_PITCH] = SCL_FB_WIDTH * 4;
-
-	val = 0;
-	val |= bits_set(TXP_DIM_WIDTH, SCL_FB_WIDTH);
-	val |= bits_set(TXP_DIM_HEIGHT, SCL_FB_HEIGHT);
-	g_txp_regs[TXP_DIM] = val;
-
-	val = 0;
-	val |= bits_on(TXP_DST_CTRL_GO);
-	val |= bits_set(TXP_DST_CTRL_FMT, 13);
-	val |= bits_on(TXP_DST_CTRL_BYTE_EN);
-	val |= bits_on(TXP_DST_CTRL_ALPHA_EN);
-	val |= bits_set(TXP_DST_CTRL_VERSION, 1);
-	val |= bits_set(TXP_DST_CTRL_PILOT, 0x54);
-	g_txp_regs[TXP_DST_CTRL] = val;
-
-	while (1) {
-		if (!bits_get(g_txp_regs[TXP_DST_CTRL], TXP_DST_CTRL_BUSY))
-			break;
-	}
-	// Remove this return to print the out_fb.
-	return;
-	dc_ivac(out_fb, sizeof(out_fb));
-	rle_dump(out_fb, 1440, 1080);
+	int err;
+	struct disp_plane src;
+	struct txp_job j;
+
+	memset(&src, 0, sizeof(src));
+	src.pa = va_to_pa((va_t)fb);
+	src.pitch = FB_WIDTH * 4;
+	src.fmt = DISP_FMT_XRGB8888;
+	src.src_width = FB_WIDTH;
+	src.src_height = FB_HEIGHT;
+	src.width = SCL_FB_WIDTH;
+	src.height = SCL_FB_HEIGHT;
+	src.alpha = 0xff;
+
+	err = txp_job_init(&j, &src, DISP_FMT_ARGB8888, NULL);
+	if (err)
+		return err;
+	err = txp_submit(&j);
+	if (err)
+		goto err;
+
+	// The output buffer is ours once the job completes, even if it failed.
+	err = txp_wait(&j);
+	if (!err)
+		err = d55_show(j.out);
+	txp_put_buf(j.out);
+err:
+	txp_job_fini(&j);
+	return err;
 }
@@ -0,0 +1,136 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright (c) 2021 Amol Surati
+
+#include <lib/string.h>
+
+#include <sys/cpu.h>
+#include <sys/err.h>
+
+#include <dev/dev.h>
+#include <dev/disp.h>
+
+// Overlays above the scanout buffer: a status bar, scaled across the top of
+// the screen at a fixed alpha, and a cursor with per-pixel alpha, above the
+// bar. The cursor is moved once a frame with disp_commit; it bounces off
+// the edges of the screen half-way out, where it is clipped.
+
+#define CURSOR_SIZE			64
+#define BAR_WIDTH			256
+#define BAR_HEIGHT			8
+#define BAR_SCALE			4
+#define NUM_FRAMES			60
+
+static va_t g_d56_va;
+static pa_t g_d56_pa;
+
+// A white disc, opaque at the centre and fading out to its edge. The alpha
+// is premultiplied.
+static
+void d56_draw_cursor(uint32_t *p)
+{
+	int x, y, dx, dy, d2;
+	uint32_t a;
+
+	for (y = 0; y < CURSOR_SIZE; ++y) {
+		for (x = 0; x < CURSOR_SIZE; ++x) {
+			dx = x - CURSOR_SIZE / 2;
+			dy = y - CURSOR_SIZE / 2;
+			d2 = dx * dx + dy * dy;
+
+			// The radius is 32; d2 / 4 runs from 0 to 256.
+			a = d2 >= 32 * 32 ? 0 : 0xff - (d2 >> 2);
+			p[y * CURSOR_SIZE + x] = a << 24 | a << 16 | a << 8 | a;
+		}
+	}
+}
+
+// A blue ramp.
+static
+void d56_draw_bar(uint32_t *p)
+{
+	int x, y;
+
+	for (y = 0; y < BAR_HEIGHT; ++y)
+		for (x = 0; x < BAR_WIDTH; ++x)
+			p[y * BAR_WIDTH + x] = 0xff000000 | x;
+}
+
+int d56_run()
+{
+	int i, err;
+	int32_t x, y, dx, dy, half;
+	uint32_t *cursor, *bar;
+	struct disp_mode m;
+	struct disp_plane pc, pb;
+
+	err = disp_get_mode(&m);
+	if (err)
+		return err;
+
+	if (g_d56_va == 0) {
+		err = dev_alloc_mem(1, &g_d56_va, &g_d56_pa);
+		if (err)
+			return err;
+	}
+	cursor = (uint32_t *)g_d56_va;
+	bar = cursor + CURSOR_SIZE * CURSOR_SIZE;
+	d56_draw_cursor(cursor);
+	d56_draw_bar(bar);
+	dc_cvac(cursor, (CURSOR_SIZE * CURSOR_SIZE + BAR_WIDTH * BAR_HEIGHT) *
+		4);
+	dsb();
+
+	memset(&pb, 0, sizeof(pb));
+	pb.pa = g_d56_pa + CURSOR_SIZE * CURSOR_SIZE * 4;
+	pb.pitch = BAR_WIDTH * 4;
+	pb.fmt = DISP_FMT_XRGB8888;
+	pb.src_width = BAR_WIDTH;
+	pb.src_height = BAR_HEIGHT;
+	pb.width = m.hap;
+	pb.height = BAR_HEIGHT * BAR_SCALE;
+	pb.alpha = 0xc0;
+	pb.z = 0;
+	err = disp_set_plane(0, &pb);
+	if (err)
+		return err;
+
+	memset(&pc, 0, sizeof(pc));
+	pc.pa = g_d56_pa;
+	pc.pitch = CURSOR_SIZE * 4;
+	pc.fmt = DISP_FMT_ARGB8888;
+	pc.src_width = pc.width = CURSOR_SIZE;
+	pc.src_height = pc.height = CURSOR_SIZE;
+	pc.alpha = 0xff;
+	pc.z = 1;
+
+	// The cursor's top-left ranges from -half to the screen size - half.
+	half = CURSOR_SIZE / 2;
+	x = -half;
+	y = m.val >> 1;
+	dx = 8;
+	dy = 4;
+	for (i = 0; i < NUM_FRAMES; ++i) {
+		pc.x = x;
+		pc.y = y;
+		err = disp_set_plane(1, &pc);
+		if (!err)
+			err = disp_commit();
+		if (!err)
+			err = disp_wait_vblank(NULL);
+		if (err)
+			break;
+
+		x += dx;
+		y += dy;
+		if (x <= -half || x >= (int32_t)m.hap - half)
+			dx = -dx;
+		if (y <= -half || y >= (int32_t)m.val - half)
+			dy = -dy;
+	}
+
+	disp_set_plane(1, NULL);
+	disp_set_plane(0, NULL);
+	if (!err)
+		err = disp_commit();
+	return err;
+}
@@ -19,15 +19,16 @@ int demo0_run()
 	int	d53_run();
 	int	d54_run();
 	int	d55_run();
+	int	d56_run();
 
 	static const fn_demo_run fns[] = {
 		d1_run, d2_run, d3_run, d4_run, d50_run, d51_run, d52_run,
-		d53_run, d54_run, d55_run,
+		d53_run, d54_run, d55_run, d56_run,
 	};
 
 	static const char *fn_names[] = {
 		"d1", "d2", "d3", "d4", "d50", "d51", "d52", "d53", "d54",
-		"d55"
+		"d55", "d56",
 	};
 
 	for (i = 0; i < (int)(sizeof(fns)/sizeof(fns[0])); ++i) {
@@ -41,8 +42,16 @@ int demo0_run()
 
 int demo_run(int phase)
 {
-	// Phase 0: The display pipeline is setup by the firmware
-	// Phase 1 and beyond: The display pipeline is setup by us.
+#ifdef DEMO_BENCH
+	int	bench_run(int num_iters);
+
+	if (phase == 0)
+		return bench_run(DEMO_BENCH);
+#endif
+
+	// Phase 0: The display pipeline is set up by disp_config. d50 to d54
+	// render into the firmware's framebuffer; d55 flips onto the display,
+	// and d56 moves overlays over it.
 	switch (phase) {
 	case 0: return demo0_run();
 	default: return ERR_PARAM;
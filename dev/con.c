@@ -7,64 +7,239 @@
 #include <lib/stdio.h>
 #include <lib/string.h>
 
+#include <sys/atomic.h>
 #include <sys/err.h>
+#include <sys/event.h>
 #include <sys/mmu.h>
 #include <sys/vmm.h>
 #include <sys/spinlock.h>
 
+#include <dev/con.h>
 #include <dev/dev.h>
 
 #define CON_BUF_LEN			256
 
+#define CON_RING_SIZE_BITS		12
+#define CON_RING_SIZE			(1ul << CON_RING_SIZE_BITS)
+#define CON_RING_MASK			(CON_RING_SIZE - 1)
+
 #define CON_DR				(0 >> 2)
 #define CON_FR				(0x18 >> 2)
+#define CON_IFLS			(0x34 >> 2)
+#define CON_IMSC			(0x38 >> 2)
+#define CON_ICR				(0x44 >> 2)
+
+#define CON_FR_TXFF_POS			5
+#define CON_IFLS_TX_POS			0
+#define CON_INT_TX_POS			5
+
+#define CON_FR_TXFF_BITS		1
+#define CON_IFLS_TX_BITS		3
+#define CON_INT_TX_BITS			1
+
+#define CON_EVENT_SPACE			1
+
+// The producers append at the head under g_con_lock. The tx drainer, the
+// owner of g_con_tx_busy, consumes at the tail. Neither waits for the other.
+static char g_con_ring[CON_RING_SIZE];
+static unsigned int g_con_head;
+static unsigned int g_con_tail;
+static int g_con_tx_busy;
 
 static struct spin_lock g_con_lock;
 static int g_con_init;
+static int g_con_use_irq;
+static enum con_policy g_con_policy;
+static int g_con_num_dropped;
+static int g_con_num_blocked;
+static struct event g_con_events;
 static volatile uint32_t *g_con_regs;
 
-void _con_out(const char *str, int len)
+static
+unsigned int con_ring_space()
 {
-	int i;
+	unsigned int head, tail;
+
+	head = atomic_read((int *)&g_con_head);
+	tail = atomic_read((int *)&g_con_tail);
+	return CON_RING_SIZE - (head - tail);
+}
+
+// Called at IPL_HARD.
+// Move as much of the ring to the tx FIFO as it can take. If another cpu is
+// already at it, leave it to that cpu.
+static
+void con_tx_drain()
+{
+	unsigned int head, tail;
+
+	for (;;) {
+		if (atomic_xchg(&g_con_tx_busy, 1))
+			return;
+
+		tail = g_con_tail;
+		head = atomic_read((int *)&g_con_head);
+		dmb();
+		while (tail != head &&
+		       !bits_get(g_con_regs[CON_FR], CON_FR_TXFF)) {
+			g_con_regs[CON_DR] = g_con_ring[tail & CON_RING_MASK];
+			++tail;
+		}
+		dmb();
+		atomic_write((int *)&g_con_tail, tail);
+		atomic_write(&g_con_tx_busy, 0);
+		dmb();
 
-	for (i = 0; i < len; ++i) {
-		// Loop until there's space in Tx FIFO.
-		while (g_con_regs[CON_FR] & 0x20)
-			;
-		g_con_regs[CON_DR] = str[i];
+		// A producer which appended after the head was read may have
+		// found the drainer busy. If the FIFO is full, the tx
+		// interrupt resumes the drain.
+		if (tail == (unsigned int)atomic_read((int *)&g_con_head))
+			return;
+		if (bits_get(g_con_regs[CON_FR], CON_FR_TXFF))
+			return;
 	}
 }
 
-// IPL_THREAD
+// IPL_HARD
+static
+void con_hw_irqh()
+{
+	g_con_regs[CON_ICR] = bits_on(CON_INT_TX);
+	con_tx_drain();
+
+	// Pairs with the dmb in con_out.
+	dmb();
+	if (atomic_read(&g_con_num_blocked))
+		cpu_raise_sw_irq(IRQ_UART);
+}
+
+// IPL_SCHED
+static
+void con_sw_irqh()
+{
+	event_set(&g_con_events, CON_EVENT_SPACE);
+}
+
+// Called with the ring drained synchronously, before the tx interrupt is
+// set up, and from do_assert.
+void con_flush()
+{
+	enum ipl ipl;
+	reg_t irq_mask;
+
+	if (!g_con_init)
+		return;
+
+	ipl = cpu_raise_ipl(IPL_HARD, &irq_mask);
+	while (con_ring_space() != CON_RING_SIZE)
+		con_tx_drain();
+	cpu_lower_ipl(ipl, irq_mask);
+}
+
+void con_set_policy(enum con_policy policy)
+{
+	g_con_policy = policy;
+}
+
+int con_get_num_dropped()
+{
+	return atomic_read(&g_con_num_dropped);
+}
+
+// Any IPL.
+// Format into the ring, and return without waiting for the UART. If the ring
+// is full, the line is dropped, unless the policy is CON_POLICY_BLOCK and the
+// caller is at IPL_THREAD.
 int con_out(const char *fmt, ...)
 {
 	int len;
 	va_list ap;
-	static char g_con_buf[CON_BUF_LEN];
+	enum ipl ipl;
+	reg_t irq_mask;
+	unsigned int i, head;
+	char buf[CON_BUF_LEN];
 
 	if (!g_con_init)
 		return ERR_UNSUP;
 
-	spin_lock(&g_con_lock);
 	va_start(ap, fmt);
-	len = vsnprintf(g_con_buf, CON_BUF_LEN, fmt, ap);
+	len = vsnprintf(buf, CON_BUF_LEN, fmt, ap);
 	va_end(ap);
 
-	if (len < 0 || len >= CON_BUF_LEN || g_con_buf[len])
+	if (len < 0 || len >= CON_BUF_LEN || buf[len])
 		return ERR_INSUFF_BUFFER;
 
 	// Append a \n. For Minicom, enable addcarreturn option.
 	if (len == CON_BUF_LEN - 1)
 		len -= 1;
-	g_con_buf[len] = '\n';
-	g_con_buf[len + 1] = 0;
+	buf[len] = '\n';
 	len += 1;
 
-	_con_out(g_con_buf, len);
+	for (;;) {
+		ipl = cpu_raise_ipl(IPL_HARD, &irq_mask);
+		spin_lock(&g_con_lock);
+		if (con_ring_space() >= (unsigned int)len)
+			break;
+		spin_unlock(&g_con_lock);
+
+		if (!g_con_use_irq) {
+			// Not yet interrupt-driven; drain by polling.
+			con_tx_drain();
+			cpu_lower_ipl(ipl, irq_mask);
+			continue;
+		}
+
+		if (g_con_policy == CON_POLICY_BLOCK && ipl == IPL_THREAD) {
+			atomic_add(&g_con_num_blocked, 1);
+			cpu_lower_ipl(ipl, irq_mask);
+
+			// Pairs with the dmb in con_hw_irqh. Either the handler
+			// sees this thread blocked, or the thread sees the
+			// space it freed.
+			event_clear(&g_con_events, CON_EVENT_SPACE);
+			dmb();
+			if (con_ring_space() < (unsigned int)len)
+				event_wait(&g_con_events, CON_EVENT_SPACE, 0);
+			atomic_add(&g_con_num_blocked, -1);
+			continue;
+		}
+
+		atomic_add(&g_con_num_dropped, 1);
+		con_tx_drain();
+		cpu_lower_ipl(ipl, irq_mask);
+		return ERR_NO_MEM;
+	}
+
+	head = g_con_head;
+	for (i = 0; i < (unsigned int)len; ++i)
+		g_con_ring[(head + i) & CON_RING_MASK] = buf[i];
+	dmb();
+	atomic_write((int *)&g_con_head, head + len);
 	spin_unlock(&g_con_lock);
+
+	con_tx_drain();
+	cpu_lower_ipl(ipl, irq_mask);
+
+	if (!g_con_use_irq)
+		con_flush();
 	return len;
 }
 
+// IPL_THREAD
+// Switch from polling to the tx interrupt. Called once intc is up.
+int con_init_irq()
+{
+	cpu_register_irqh(IRQ_UART, con_hw_irqh, con_sw_irqh);
+
+	// Interrupt when the tx FIFO drops to 1/8 full.
+	g_con_regs[CON_IFLS] = bits_set(CON_IFLS_TX, 0);
+	g_con_regs[CON_ICR] = bits_on(CON_INT_TX);
+	g_con_regs[CON_IMSC] |= bits_on(CON_INT_TX);
+	dmb();
+	g_con_use_irq = 1;
+	return cpu_enable_irq(IRQ_UART);
+}
+
 // IPL_THREAD
 int con_init()
 {
@@ -72,6 +247,8 @@ int con_init()
 	va_t va;
 
 	spin_lock_init(&g_con_lock, IPL_HARD);
+	event_init(&g_con_events);
+	g_con_policy = CON_POLICY_DROP;
 	err = dev_map_io(UART_BASE, 0x200, &va);
 	if (err)
 		return err;
@@ -0,0 +1,155 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright (c) 2021 Amol Surati
+
+#include <lib/assert.h>
+
+#include <sys/completion.h>
+#include <sys/cpu.h>
+#include <sys/err.h>
+#include <sys/mutex.h>
+
+#include <dev/ddc.h>
+
+// The DDC is the I2C master (BSC2) of the HDMI port. A transfer runs off
+// its interrupts: the FIFO is filled, or drained, as the controller asks,
+// and the transfer ends at DONE. A missing or silent display ends it with
+// ERR, or CLKT, instead.
+
+// A transfer in progress. Touched by the hw irq handler, at IPL_HARD, only
+// while is_busy.
+struct ddc_xfer {
+	uint8_t				*buf;
+	int				len;
+	int				pos;
+	char				is_read;
+	volatile char			is_busy;
+	int				err;
+};
+
+extern volatile uint32_t *g_ddc_regs;
+
+static struct mutex g_ddc_lock;
+static struct completion g_ddc_done;
+static struct ddc_xfer g_ddc_xfer;
+
+// IPL_HARD
+// The I2C IRQ is shared by the BSC controllers; BSC2 is the only one used.
+static
+void ddc_hw_irqh()
+{
+	uint32_t sts, err_bits;
+	struct ddc_xfer *x;
+
+	x = &g_ddc_xfer;
+	if (!x->is_busy)
+		return;
+
+	sts = g_ddc_regs[DDC_STS];
+	if (x->is_read) {
+		while (x->pos < x->len &&
+		       bits_get(g_ddc_regs[DDC_STS], DDC_STS_RXD))
+			x->buf[x->pos++] = g_ddc_regs[DDC_FIFO];
+	} else {
+		while (x->pos < x->len &&
+		       bits_get(g_ddc_regs[DDC_STS], DDC_STS_TXD))
+			g_ddc_regs[DDC_FIFO] = x->buf[x->pos++];
+	}
+
+	err_bits = bits_on(DDC_STS_ERR) | bits_on(DDC_STS_CLKT);
+	if (!bits_get(sts, DDC_STS_DONE) && !(sts & err_bits))
+		return;
+
+	x->err = ERR_SUCCESS;
+	if ((sts & err_bits) || x->pos != x->len)
+		x->err = ERR_FAILED;
+
+	// Stop the interrupts, and clear the status.
+	g_ddc_regs[DDC_CTRL] = bits_on(DDC_CTRL_I2C_EN);
+	g_ddc_regs[DDC_STS] = bits_on(DDC_STS_DONE) | err_bits;
+	x->is_busy = 0;
+	cpu_raise_sw_irq(IRQ_I2C);
+}
+
+// IPL_SCHED
+static
+void ddc_sw_irqh()
+{
+	completion_signal(&g_ddc_done);
+}
+
+// IPL_THREAD
+// Called with g_ddc_lock held.
+static
+int ddc_xfer(uint8_t addr, uint8_t *buf, int len, char is_read)
+{
+	uint32_t val;
+	struct ddc_xfer *x;
+
+	x = &g_ddc_xfer;
+	x->buf = buf;
+	x->len = len;
+	x->pos = 0;
+	x->is_read = is_read;
+	x->err = ERR_PENDING;
+	completion_reset(&g_ddc_done);
+
+	val = 0;
+	val |= bits_on(DDC_STS_DONE);
+	val |= bits_on(DDC_STS_ERR);
+	val |= bits_on(DDC_STS_CLKT);
+	g_ddc_regs[DDC_STS] = val;
+	g_ddc_regs[DDC_CTRL] = bits_on(DDC_CTRL_I2C_EN) |
+		bits_set(DDC_CTRL_CLEAR, 1);
+	g_ddc_regs[DDC_ADDR] = addr;
+	g_ddc_regs[DDC_DLEN] = len;
+
+	// The transfer is visible to the irq handler, which may run on
+	// another cpu, before the controller starts.
+	x->is_busy = 1;
+	dmb();
+
+	val = 0;
+	val |= bits_on(DDC_CTRL_I2C_EN);
+	val |= bits_on(DDC_CTRL_START);
+	val |= bits_on(DDC_CTRL_INTD);
+	if (is_read) {
+		val |= bits_on(DDC_CTRL_READ);
+		val |= bits_on(DDC_CTRL_INTR);
+	} else {
+		val |= bits_on(DDC_CTRL_INTT);
+	}
+	g_ddc_regs[DDC_CTRL] = val;
+
+	completion_wait(&g_ddc_done);
+	return x->err;
+}
+
+// IPL_THREAD
+// Write offset to the device at addr, and then read len bytes from it.
+int ddc_read(uint8_t addr, uint8_t offset, uint8_t *buf, int len)
+{
+	int err;
+
+	if (buf == NULL || len <= 0 || len > 0xffff)
+		return ERR_PARAM;
+
+	mutex_lock(&g_ddc_lock);
+	err = ddc_xfer(addr, &offset, 1, 0);
+	if (!err)
+		err = ddc_xfer(addr, buf, len, 1);
+	mutex_unlock(&g_ddc_lock);
+	return err;
+}
+
+// IPL_THREAD
+// Called by disp_init, once the registers are mapped.
+int ddc_init()
+{
+	mutex_init(&g_ddc_lock);
+	completion_init(&g_ddc_done);
+	g_ddc_regs[DDC_CTRL] = bits_on(DDC_CTRL_I2C_EN) |
+		bits_set(DDC_CTRL_CLEAR, 1);
+	cpu_register_irqh(IRQ_I2C, ddc_hw_irqh, ddc_sw_irqh);
+	cpu_enable_irq(IRQ_I2C);
+	return ERR_SUCCESS;
+}
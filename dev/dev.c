@@ -7,6 +7,7 @@
 
 #include <sys/bits.h>
 #include <sys/err.h>
+#include <sys/pmm.h>
 #include <sys/vmm.h>
 
 // IPL_THREAD
@@ -44,3 +45,51 @@ err1:
 err0:
 	return err;
 }
+
+// IPL_THREAD
+// Allocate system RAM, in units of 1MB, for a buffer which a device reads
+// or writes. The cpu maps it cacheable.
+int dev_alloc_mem(int num_mbs, va_t *va, pa_t *pa)
+{
+	int err, i, num_pages;
+	vpn_t pages, page;
+	pfn_t frames, frame;
+
+	if (num_mbs <= 0 || va == NULL || pa == NULL)
+		return ERR_PARAM;
+
+	num_pages = (num_mbs * _1MB) >> PAGE_SIZE_BITS;
+	err = pmm_alloc(ALIGN_1MB, num_pages, &frames);
+	if (err)
+		goto err0;
+
+	err = vmm_alloc(ALIGN_1MB, num_pages, &pages);
+	if (err)
+		goto err1;
+
+	page = pages;
+	frame = frames;
+	for (i = 0; i < num_mbs; ++i) {
+		err = mmu_map_page(0, page, frame, ALIGN_1MB, PROT_RW);
+		if (err)
+			goto err2;
+
+		// Map in units of 1MB.
+		page += _1MB >> PAGE_SIZE_BITS;
+		frame += _1MB >> PAGE_SIZE_BITS;
+	}
+	*va = vpn_to_va(pages);
+	*pa = pfn_to_pa(frames);
+	return ERR_SUCCESS;
+err2:
+	page -= _1MB >> PAGE_SIZE_BITS;
+	for (--i; i >= 0; --i) {
+		mmu_unmap_page(0, page);
+		page -= _1MB >> PAGE_SIZE_BITS;
+	}
+	vmm_free(pages, num_pages);
+err1:
+	pmm_free(frames, num_pages);
+err0:
+	return err;
+}
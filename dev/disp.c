@@ -2,12 +2,14 @@
 // Copyright (c) 2021 Amol Surati
 
 #include <lib/assert.h>
+#include <lib/stdlib.h>
 #include <lib/string.h>
 
 #include <sys/err.h>
 #include <sys/cpu.h>
-#include <sys/vmm.h>
-#include <sys/pmm.h>
+#include <sys/semaphore.h>
+#include <sys/spinlock.h>
+#include <sys/thread.h>
 
 #include <dev/dev.h>
 #include <dev/con.h>
@@ -16,11 +18,8 @@
 #include <dev/hdmi.h>
 #include <dev/hvs.h>
 #include <dev/ddc.h>
-
-// 642x480 71hz
-// The PLLH is set to 600MHz, and PLLH_PIX divctl is set to 2. Thus, the
-// pixel clock rate is (600/10)/2 = 30 MHz. The refresh rate then is
-// (30 * 10^6)/(800 * 525) = 71.42 Hz
+#include <dev/disp.h>
+#include <dev/tmr.h>
 
 volatile uint32_t *g_cm_regs;
 volatile uint32_t *g_pv1_regs;
@@ -31,172 +30,246 @@ volatile uint32_t *g_hdmi_regs;
 volatile uint32_t *g_hd_regs;
 volatile uint32_t *g_ddc_regs;
 
-static pa_t g_fb_pa;
-
-// Display Mode
-struct mode {
-	uint32_t			hap;	// Active Pixels
-	uint32_t			hfp;	// Front Porch
-	uint32_t			hsw;	// HSync Width
-	uint32_t			hbp;	// Back Porch
-	uint32_t			val;	// Active Lines
-	uint32_t			vfp;	// Front Porch
-	uint32_t			vsw;	// VSync Width
-	uint32_t			vbp;	// Back Porch
-
-	int				hsp;	// HSync Polarity
-	int				vsp;	// VSync Polarity
-	int				vic;	// CEA Video ID Code.
-
-	int				pllh_ndiv;	// Integer divisor.
-	int				pllh_fdiv;	// Fractional divisor.
-	int				pllh_pix_div;	// Integer divisor.
-};
+#define DISP_NUM_BUFS			2	// The default.
 
-static int g_mode = 2;
-struct mode g_disp_modes[] = {
-	{640, 16, 96, 48, 480, 10, 2, 33, -1, -1, 1, 0x1a, 0x40000, 0x2},
-	{800, 40, 128, 88, 600, 1, 4, 23, 1, 1, 0, 0x14, 0xd5556, 0x1},
-	{1920, 88, 44, 148, 1080, 4, 5, 36, 1, 1, 16, 0x4d, 0x58000, 0x1},
+// A buffer is FREE, then DRAWING while the producer owns it, QUEUED once
+// flipped, and SCANOUT once the HVS has latched a display list which shows
+// it. The buffer it replaces on the screen is FREE again.
+enum disp_fb_state {
+	DISP_FB_FREE,
+	DISP_FB_DRAWING,
+	DISP_FB_QUEUED,
+	DISP_FB_SCANOUT,
 };
 
-#define HAP				(g_disp_modes[g_mode].hap)
-#define HFP				(g_disp_modes[g_mode].hfp)
-#define HSW				(g_disp_modes[g_mode].hsw)
-#define HBP				(g_disp_modes[g_mode].hbp)
-#define HSP				(g_disp_modes[g_mode].hsp)
-#define VAL				(g_disp_modes[g_mode].val)
-#define VFP				(g_disp_modes[g_mode].vfp)
-#define VSW				(g_disp_modes[g_mode].vsw)
-#define VBP				(g_disp_modes[g_mode].vbp)
-#define VSP				(g_disp_modes[g_mode].vsp)
-#define VIC				(g_disp_modes[g_mode].vic)
-
-#if 0
-#define HAP				1920ul
-#define HFP				88ul
-#define HSW				44ul
-#define HBP				148ul
-#define VAL				1080ul
-#define VFP				4ul
-#define VSW				5ul
-#define VBP				36ul
-
-#define NDIV				0x4d
-#define FDIV				0x58000
-#endif
+struct disp_fb {
+	struct disp_buf			buf;
+	enum disp_fb_state		state;
+	uint32_t			flip_frame;
+};
 
-#if 0
-#define HAP				640ul
-#define HFP				16ul
-#define HSW				96ul
-#define HBP				48ul
-#define VAL				480ul
-#define VFP				10ul
-#define VSW				2ul
-#define VBP				33ul
-
-#define NDIV				0xd
-#define FDIV				0x20000
-#endif
+// Channel 1 runs a display list of a scanout buffer and the overlay planes
+// above it. A flip or a commit writes a new list into a back region of the
+// channel, and queues it; g_disp_list_fbs has the buffer each region shows.
+#define DISP_LIST_NUM_WORDS		64	// 7 + 4 * 14 + End.
+
+static struct disp_fb g_disp_fbs[DISP_MAX_BUFS];
+static int g_disp_num_fbs = DISP_NUM_BUFS;
+static struct hvs_chan g_disp_chan;
+static int g_disp_list_fbs[HVS_CHAN_MAX_REGIONS];
+static uint32_t g_disp_ppfk;
+static struct disp_plane g_disp_planes[DISP_NUM_PLANES];
+static char g_disp_plane_is_on[DISP_NUM_PLANES];
+static char g_disp_is_on;
+
+// Counts the FREE buffers. The lock, at IPL_SCHED, guards the states, the
+// lists, the planes, the vblank waiters and the flip counts.
+static struct semaphore g_disp_free;
+static struct spin_lock g_disp_lock;
+static struct list_head g_disp_vblank_wq;
+static fn_disp_vblank *g_disp_vblank_fn;
+static void *g_disp_vblank_p;
+
+// The frame, ts and num_lost fields are updated by the hw irq handler,
+// under the timing lock, at IPL_HARD.
+static struct disp_timing g_disp_timing;
+static struct spin_lock g_disp_timing_lock;
+
+#define DISP_DEFAULT_MODE		2
+#define DISP_MIN_PCLK			25000	// kHz
+#define DISP_MAX_PCLK			162000
+#define DISP_MAX_DIM			2048
+
+// The modes driven when the display has no usable EDID. 1920x1080 is the
+// default.
+static const struct disp_mode g_disp_modes[] = {
+	{640, 16, 96, 48, 480, 10, 2, 33, -1, -1, 1, 25200},
+	{800, 40, 128, 88, 600, 1, 4, 23, 1, 1, 0, 40000},
+	{1920, 88, 44, 148, 1080, 4, 5, 36, 1, 1, 16, 148500},
+};
 
-#if 0
-#define HAP				800ul
-#define HFP				40ul
-#define HSW				128ul
-#define HBP				88ul
-#define VAL				600ul
-#define VFP				1ul
-#define VSW				4ul
-#define VBP				23ul
-#endif
+// The mode being driven.
+static struct disp_mode g_mode;
+
+#define HAP				(g_mode.hap)
+#define HFP				(g_mode.hfp)
+#define HSW				(g_mode.hsw)
+#define HBP				(g_mode.hbp)
+#define HSP				(g_mode.hsp)
+#define VAL				(g_mode.val)
+#define VFP				(g_mode.vfp)
+#define VSW				(g_mode.vsw)
+#define VBP				(g_mode.vbp)
+#define VSP				(g_mode.vsp)
+#define VIC				(g_mode.vic)
+
+#define EDID_ADDR			0x50
+#define EDID_BLOCK_SIZE			0x80
+#define EDID_DTD_SIZE			18
+#define EDID_BASE_DTD_START		54
+#define EDID_EXT_TAG_CEA		0x02
+
+// The encoder, and PLLH, can drive the mode.
+static
+int disp_check_mode(const struct disp_mode *m)
+{
+	if (m == NULL || m->hap == 0 || m->val == 0 || m->hsw == 0 ||
+	    m->vsw == 0)
+		return ERR_PARAM;
+	if (m->hap > DISP_MAX_DIM || m->val > DISP_MAX_DIM)
+		return ERR_UNSUP;
+	if (m->pclk < DISP_MIN_PCLK || m->pclk > DISP_MAX_PCLK)
+		return ERR_UNSUP;
+	return ERR_SUCCESS;
+}
 
-#if 0
-#define HAP				640ul
-#define HFP				16ul
-#define HSW				160ul
-#define HBP				80ul
-#define VAL				360ul
-#define VFP				3ul
-#define VSW				5ul
-#define VBP				8ul
-#endif
+// The CEA VIC of the mode, if it is one of the built-in modes. The pixel
+// clocks may differ by 1/1.001.
+static
+int disp_find_vic(const struct disp_mode *m)
+{
+	int i;
+	uint32_t diff;
+	const struct disp_mode *t;
+
+	for (i = 0; i < (int)(sizeof(g_disp_modes) / sizeof(g_disp_modes[0]));
+	     ++i) {
+		t = &g_disp_modes[i];
+		if (m->hap != t->hap || m->hfp != t->hfp || m->hsw != t->hsw ||
+		    m->hbp != t->hbp || m->val != t->val || m->vfp != t->vfp ||
+		    m->vsw != t->vsw || m->vbp != t->vbp)
+			continue;
+		diff = m->pclk - t->pclk;
+		if (m->pclk < t->pclk)
+			diff = t->pclk - m->pclk;
+		if (diff <= t->pclk / 500)
+			return t->vic;
+	}
+	return 0;
+}
 
-#if 0
-// block is 0 or 1.
+// The bytes of a block sum to 0.
 static
-void read_edid_block(int block, uint8_t *buf)
+int edid_check_block(const uint8_t *b)
 {
-	int len, i;
-	uint32_t val;
+	int i;
+	uint8_t sum;
 
-	val = 0;
-	val |= bits_on(DDC_CTRL_START);
-	val |= bits_on(DDC_CTRL_I2C_EN);
-	g_ddc_regs[DDC_ADDR] = 0x50;
-	g_ddc_regs[DDC_DLEN] = 1;
-	g_ddc_regs[DDC_CTRL] = val;
+	sum = 0;
+	for (i = 0; i < EDID_BLOCK_SIZE; ++i)
+		sum += b[i];
+	return sum ? ERR_FAILED : ERR_SUCCESS;
+}
 
-	// Wait for TXW.
-	while (1) {
-		val = g_ddc_regs[DDC_STS];
-		con_out("txsts: %x", val);
-		if (bits_get(val, DDC_STS_TXW))
-			break;
+// An 18-byte Detailed Timing Descriptor. A descriptor with a 0 pixel clock
+// describes no timing.
+static
+int edid_parse_dtd(const uint8_t *d, struct disp_mode *m)
+{
+	uint32_t hbl, vbl;
+
+	m->pclk = (d[0] | (d[1] << 8)) * 10;
+	if (m->pclk == 0)
+		return ERR_NOT_FOUND;
+
+	// Interlaced.
+	if (d[17] & 0x80)
+		return ERR_UNSUP;
+
+	m->hap = d[2] | ((d[4] & 0xf0) << 4);
+	hbl = d[3] | ((d[4] & 0x0f) << 8);
+	m->val = d[5] | ((d[7] & 0xf0) << 4);
+	vbl = d[6] | ((d[7] & 0x0f) << 8);
+	m->hfp = d[8] | ((d[11] & 0xc0) << 2);
+	m->hsw = d[9] | ((d[11] & 0x30) << 4);
+	m->vfp = (d[10] >> 4) | ((d[11] & 0x0c) << 2);
+	m->vsw = (d[10] & 0x0f) | ((d[11] & 0x03) << 4);
+	if (hbl < m->hfp + m->hsw || vbl < m->vfp + m->vsw)
+		return ERR_UNSUP;
+	m->hbp = hbl - m->hfp - m->hsw;
+	m->vbp = vbl - m->vfp - m->vsw;
+
+	// Only the digital separate sync carries both of the polarities.
+	m->hsp = m->vsp = 1;
+	if ((d[17] & 0x18) == 0x18) {
+		m->vsp = d[17] & 0x04 ? 1 : -1;
+		m->hsp = d[17] & 0x02 ? 1 : -1;
 	}
+	m->vic = disp_find_vic(m);
+	return ERR_SUCCESS;
+}
 
-	// Write into FIFO
-	// TODO: If TXD is 0, start a new transfer.
-	g_ddc_regs[DDC_FIFO] = block * 0x80;
-
-	// Wait for RXR or DONE.
-	while (1) {
-		val = g_ddc_regs[DDC_STS];
-		con_out("rxsts: %x", val);
-		if (bits_get(val, DDC_STS_RXR))
-			break;
-		if (bits_get(val, DDC_STS_DONE))
-			break;
-	}
+// The first supported mode of the num DTDs at d.
+static
+int edid_find_mode(const uint8_t *d, int num, struct disp_mode *out)
+{
+	int i;
+	struct disp_mode m;
 
-	// Read the block
-	len = 0x80;
-	val = 0;
-	val |= bits_on(DDC_CTRL_START);
-	val |= bits_on(DDC_CTRL_I2C_EN);
-	val |= bits_on(DDC_CTRL_READ);
-	g_ddc_regs[DDC_ADDR] = 0x50;
-	g_ddc_regs[DDC_DLEN] = len;
-	g_ddc_regs[DDC_CTRL] = val;
-
-	for (i = 0; i < len;) {
-		val = g_ddc_regs[DDC_STS];
-		if (!bits_get(val, DDC_STS_RXD))
+	for (i = 0; i < num; ++i, d += EDID_DTD_SIZE) {
+		if (edid_parse_dtd(d, &m))
 			continue;
-		buf[i] = g_ddc_regs[DDC_FIFO];
-		++i;
+		if (disp_check_mode(&m))
+			continue;
+		*out = m;
+		return ERR_SUCCESS;
 	}
+	return ERR_NOT_FOUND;
 }
 
-static
-void read_edid()
+// IPL_THREAD
+// The mode the display prefers, as its EDID describes it. The first DTD of
+// the base block is the preferred mode; if it is not supported, the other
+// DTDs, and then those of a CEA-861 extension, are tried in their order.
+int disp_get_edid_mode(struct disp_mode *out)
 {
-	int i;
-	static uint8_t buf[0x100];
-	uint32_t *p;
+	int i, err, start, num;
+	uint8_t edid[2 * EDID_BLOCK_SIZE];
+	uint8_t *ext;
+	static const uint8_t hdr[] = {0, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0};
+
+	if (out == NULL)
+		return ERR_PARAM;
+
+	err = ddc_read(EDID_ADDR, 0, edid, EDID_BLOCK_SIZE);
+	if (err)
+		return err;
+	for (i = 0; i < (int)sizeof(hdr); ++i)
+		if (edid[i] != hdr[i])
+			return ERR_FAILED;
+	err = edid_check_block(edid);
+	if (err)
+		return err;
 
-	read_edid_block(0, &buf[0]);
-	read_edid_block(1, &buf[0x80]);
+	err = edid_find_mode(&edid[EDID_BASE_DTD_START], 4, out);
+	if (err == ERR_SUCCESS || edid[126] == 0)
+		return err;
 
-	p = (uint32_t *)&buf[0];
-	for (i = 0; i < 64; ++i)
-		con_out("0x%x,", p[i]);
+	// The extension blocks follow the base block.
+	ext = &edid[EDID_BLOCK_SIZE];
+	err = ddc_read(EDID_ADDR, EDID_BLOCK_SIZE, ext, EDID_BLOCK_SIZE);
+	if (err)
+		return err;
+	err = edid_check_block(ext);
+	if (err)
+		return err;
+	if (ext[0] != EDID_EXT_TAG_CEA)
+		return ERR_NOT_FOUND;
+
+	// The DTDs start at ext[2], and end before the checksum; 0 or less
+	// than 4 means there are none.
+	start = ext[2];
+	if (start < 4)
+		return ERR_NOT_FOUND;
+	num = (EDID_BLOCK_SIZE - 1 - start) / EDID_DTD_SIZE;
+	return edid_find_mode(&ext[start], num, out);
 }
-#endif
 
 static
 void pv_disable()
 {
+	g_pv2_regs[PV_INT_EN] = 0;
+	g_pv2_regs[PV_INT_STAT] = PV_INT_ALL;
 	g_pv2_regs[PV_CTRL] &= bits_off(PV_CTRL_EN);
 	g_pv2_regs[PV_CTRL] |= bits_on(PV_CTRL_FIFO_CLR);
 }
@@ -248,6 +321,10 @@ void pv_enable()
 	g_pv2_regs[PV_CTRL] = val;
 
 	g_pv2_regs[PV_CTRL] |= bits_on(PV_CTRL_EN);
+
+	// The vblank interrupt, which retires the flips.
+	g_pv2_regs[PV_INT_STAT] = PV_INT_ALL;
+	g_pv2_regs[PV_INT_EN] = bits_on(PV_INT_VFP_START);
 }
 
 static
@@ -290,13 +367,13 @@ void hdmi_enable_video()
 	avi.colour_scan = 0x10;
 	avi.vic = VIC;
 
-	if (g_mode == 0 || g_mode == 1) {
-		//avi.colour_aspect = 0x98;
+	// Any other picture aspect ratio, such as 5:4 or 16:10, has no code.
+	if (HAP * 3 == VAL * 4)
 		avi.colour_aspect = 0x18;	// 4:3
-	} else {
-		//avi.colour_aspect = 0xa8;
+	else if (HAP * 9 == VAL * 16)
 		avi.colour_aspect = 0x28;	// 16:9
-	}
+	else
+		avi.colour_aspect = 0x08;	// No data.
 
 	val = 0;
 	p = (uint8_t *)&avi;
@@ -399,53 +476,30 @@ void hdmi_disable()
 	g_cm_regs[A2W_PLLH_CTRL] |= bits_on(A2W_PLL_CTRL_PWRDN) | CM_PASSWORD;
 }
 
+// PLLH runs at 19.2MHz times (ndiv + fdiv / 2^20), at 600MHz or more; the
+// pixel clock is PLLH / 10 / pix_div.
+static
+void disp_get_pll(uint32_t *ndiv, uint32_t *fdiv, uint32_t *pix_div)
+{
+	uint64_t v;
+
+	*pix_div = 1;
+	while (g_mode.pclk * 10 * *pix_div < 600000)
+		++*pix_div;
+	v = (uint64_t)g_mode.pclk * 10 * *pix_div << 20;
+	v = divmod(v + 9600, 19200, NULL);
+	*ndiv = v >> 20;
+	*fdiv = v & 0xfffff;
+}
+
 static
 void hdmi_enable()
 {
 	int i;
-	uint32_t val, ana[4], ndiv, fdiv;
+	uint32_t val, ana[4], ndiv, fdiv, pix_div;
 
 	// Set and enable PLLH.
-	//ndiv = NDIV;
-	//fdiv = FDIV;
-
-	// Can't set to 252MHZ since, 600MHz is minimum for PLLH.
-	//ndiv = 0x1f;
-	//fdiv = 0x40000;	// 600MHz min.
-
-
-	// 640x480 We want pixel clock = 25.2 MHz. So we need 25.2 * 2 * 10 =
-	// 504MHz clock
-	// printf '%d' $(((19200000 * (0x1a * 2**20 + 0x40000))/(2**20)))
-	//ndiv = 0x1a;
-	//fdiv = 0x40000;
-
-	// 640x480 We want pixel clock = 25.2 MHz. So we need 25.2 * 3 * 10 =
-	// 756MHz clock
-	//ndiv = 0x27;
-	//fdiv = 0x60000;
-
-	// 640x480 We want pixel clock = 25.175 MHz, so we need
-	// 25.175 * 2 * 10 = 503.5 MHz
-	//ndiv = 0x1a;
-	//fdiv = 0x39556;
-
-	// 800x600, pixel clock = 40MHz. So we need to set
-	// 400MHz (if pllh_pix divctl is 1), or 800MHz (if pllh_pix div is 2)
-	//ndiv = 0x14;
-	//fdiv = 0xd5556;
-
-	// 640x360 We want pixel clock = 18.048 MHz. So we need 18.048 * 30 =
-	// 541.44MHz clock
-	// printf '%d' $(((19200000 * (0x1a * 2**20 + 0x40000))/(2**20)))
-	//ndiv = 0x1c;
-	//fdiv = 0x33334;
-
-	//ndiv = 0x10;
-	//fdiv = 0x70000;	// 315.6MHz	locks successfully; 0x60000 doesn't
-
-	ndiv = g_disp_modes[g_mode].pllh_ndiv;
-	fdiv = g_disp_modes[g_mode].pllh_fdiv;
+	disp_get_pll(&ndiv, &fdiv, &pix_div);
 
 	val = bits_on(A2W_XOCS_CTRL_PLLC_EN);
 	g_cm_regs[A2W_XOCS_CTRL] |= val | CM_PASSWORD;
@@ -470,7 +524,7 @@ void hdmi_enable()
 	// Set PLLH_PIX Parameters.
 	val = g_cm_regs[A2W_PLLH_PIX];
 	val &= bits_off(A2W_PLL_DIV);
-	val |= bits_set(A2W_PLL_DIV, g_disp_modes[g_mode].pllh_pix_div);
+	val |= bits_set(A2W_PLL_DIV, pix_div);
 	g_cm_regs[A2W_PLLH_PIX] = val | CM_PASSWORD;
 
 	// Reload PLLH_PIX Parameters.
@@ -549,47 +603,16 @@ void hvs_disable_channel()
 	g_hvs_regs[HVS_DL1_CTRL] &= bits_off(HVS_DL_CTRL_EN);
 }
 
-#define HVS_DL_MEM_INDEX		0x800
-#define HVS_DL_INDEX			0x400
-
 static
-void hvs_enable_channel()
+void hvs_enable_channel(uint32_t index)
 {
 	uint32_t val;
-	volatile uint32_t *dl;
 
 	g_hvs_regs[HVS_DL0] = 0;
 	g_hvs_regs[HVS_DL1] = 0;
 	g_hvs_regs[HVS_DL2] = 0;
 
-	dl = &g_hvs_regs[HVS_DL_MEM_INDEX + HVS_DL_INDEX];
-
-	// The input FB (fb) has the format BGRA8888, or  ARGB32.
-	// The output FB (out_fb) is expected to be in the same format.
-	val = 0;
-	val |= bits_set(HVS_DLW_CTL0_PIXEL_FMT, 7);	// RGBA8888
-	val |= bits_set(HVS_DLW_CTL0_PIXEL_ORDER, 3);
-	val |= bits_set(HVS_DLW_CTL0_RGBA_EXPAND, 3);	// Round??
-	val |= bits_set(HVS_DLW_CTL0_NUM_WORDS, 7);	// 7 + End.
-	val |= bits_on(HVS_DLW_CTL0_UNITY);
-	val |= bits_on(HVS_DLW_CTL0_VALID);
-	dl[0] = val;
-
-	dl[1] = bits_on(HVS_DLW_POS0_FIXED_ALPHA);	// 0xff
-
-	val = 0;
-	val |= bits_set(HVS_DLW_POS2_SRC_WIDTH, HAP);
-	val |= bits_set(HVS_DLW_POS2_SRC_HEIGHT, VAL);
-	val |= bits_set(HVS_DLW_POS2_ALPHA_MODE, 1);	// Fixed Alpha.
-	dl[2] = val;
-	dl[3] = 0;
-
-	dl[4] = pa_to_ba(g_fb_pa);
-	dl[5] = 0;
-	dl[6] = HAP * 4;	// Source Pitch, for Linear Tiling.
-	dl[7] = bits_on(HVS_DLW_CTL0_END);
-
-	g_hvs_regs[HVS_DL1] = HVS_DL_INDEX;
+	g_hvs_regs[HVS_DL1] = index;
 
 	g_hvs_regs[HVS_DL1_CTRL] = 0;
 	g_hvs_regs[HVS_DL1_CTRL] = bits_on(HVS_DL_CTRL_RESET);
@@ -625,78 +648,490 @@ void dump_regs()
 }
 #endif
 
+// Allocate system RAM for a scanout buffer, in units of 1MB. The largest
+// mode needs 1920*1080*4 = 8294400 bytes, < 8MB.
 static
-int disp_alloc_fb()
+int disp_alloc_fb(int ix)
 {
-	volatile uint32_t *fb;
-	int err, i, num_pages;
-	vpn_t pages, page;
-	pfn_t frames, frame;
-
-	// Allocate 8MB of system RAM for a single frame buffer.
-	// 1920*1080*4 = 8294400 < 8MB.
-
-	num_pages = (8 * _1MB) >> PAGE_SIZE_BITS;
-	err = pmm_alloc(ALIGN_1MB, num_pages, &frames);
-	if (err)
-		goto err0;
+	int err, num_mbs;
+	va_t va;
+	pa_t pa;
+	struct disp_fb *fb;
 
-	err = vmm_alloc(ALIGN_1MB, num_pages, &pages);
+	fb = &g_disp_fbs[ix];
+	num_mbs = align_up(HAP * VAL * 4, ALIGN_1MB) >> ALIGN_1MB;
+	err = dev_alloc_mem(num_mbs, &va, &pa);
 	if (err)
-		goto err1;
+		return err;
 
-	page = pages;
-	frame = frames;
-	for (i = 0; i < 8; ++i) {
-		err = mmu_map_page(0, page, frame, ALIGN_1MB, PROT_RW);
-		if (err)
-			goto err2;
+	fb->buf.index = ix;
+	fb->buf.va = (void *)va;
+	fb->buf.pa = pa;
+	fb->buf.width = HAP;
+	fb->buf.height = VAL;
+	fb->buf.pitch = HAP * 4;
+	fb->state = DISP_FB_FREE;
+	return ERR_SUCCESS;
+}
 
-		// Map in units of 1MB.
-		page += _1MB >> PAGE_SIZE_BITS;
-		frame += _1MB >> PAGE_SIZE_BITS;
-	}
-	g_fb_pa = pfn_to_pa(frames);
+// Fill the frame buffer with red, with a white 1-pixel thick border.
+static
+void disp_fill_fb(struct disp_fb *fb)
+{
+	int i;
+	uint32_t *p;
 
-	// Fill the frame buffer with red, with a white 1-pixel thick border.
-	fb = (volatile uint32_t *)vpn_to_va(pages);
+	p = fb->buf.va;
 	for (i = 0; i < (int)(HAP * VAL); ++i)
-		fb[i] = 0xffff0000;
+		p[i] = 0xffff0000;
 
 	// First and Last row.
 	for (i = 0; i < (int)HAP; ++i) {
-		fb[i] = 0xffffffff;
-		fb[(VAL - 1) * HAP + i] = 0xffffffff;
+		p[i] = 0xffffffff;
+		p[(VAL - 1) * HAP + i] = 0xffffffff;
 	}
 
 	// First and Last column.
 	for (i = 0; i < (int)VAL; ++i) {
-		fb[i * HAP] = 0xffffffff;
-		fb[i * HAP + (HAP - 1)] = 0xffffffff;
+		p[i * HAP] = 0xffffffff;
+		p[i * HAP + (HAP - 1)] = 0xffffffff;
 	}
+	dc_cvac(p, HAP * VAL * 4);
+	dsb();
+}
+
+// The frame period in microseconds.
+static
+uint32_t disp_frame_period()
+{
+	uint64_t num;
+
+	num = (uint64_t)(HAP + HFP + HSW + HBP) * (VAL + VFP + VSW + VBP);
+	return divmod(num * 1000, g_mode.pclk, NULL);
+}
+
+// Called with g_disp_lock held.
+// The HVS now runs the list l. If it shows another buffer than the list
+// before it, that buffer is on the screen, and the one it replaced is free.
+// Returns 1 if a buffer was freed.
+static
+int disp_activate(int l)
+{
+	int prev, fb;
+
+	prev = g_disp_list_fbs[g_disp_chan.front];
+	fb = g_disp_list_fbs[l];
+	g_disp_chan.front = l;
+	if (fb == prev)
+		return 0;
+	g_disp_fbs[prev].state = DISP_FB_FREE;
+	g_disp_fbs[fb].state = DISP_FB_SCANOUT;
+	++g_disp_timing.num_flips;
+	return 1;
+}
 
+// Called with g_disp_lock held.
+static
+int disp_retire()
+{
+	int l;
+
+	l = g_disp_chan.queued;
+	if (l < 0 || !hvs_chan_is_active(&g_disp_chan, l))
+		return 0;
+	g_disp_chan.queued = -1;
+	return disp_activate(l);
+}
+
+// Called with g_disp_lock held.
+// The scanout buffer is the bottom plane, opaque and unscaled. The overlays
+// follow, in the order of their z.
+static
+int disp_write_list(int l, int fb)
+{
+	int i, j, n, err;
+	int order[DISP_NUM_PLANES];
+	struct hvs_dlist d;
+	struct disp_plane primary;
+
+	hvs_dlist_init(&d, &g_disp_chan, l, HAP, VAL, g_disp_ppfk);
+
+	memset(&primary, 0, sizeof(primary));
+	primary.pa = g_disp_fbs[fb].buf.pa;
+	primary.pitch = g_disp_fbs[fb].buf.pitch;
+	primary.fmt = DISP_FMT_XRGB8888;
+	primary.src_width = primary.width = HAP;
+	primary.src_height = primary.height = VAL;
+	primary.alpha = 0xff;
+	err = hvs_dlist_add_plane(&d, &primary);
+	if (err)
+		return err;
+
+	n = 0;
+	for (i = 0; i < DISP_NUM_PLANES; ++i) {
+		if (!g_disp_plane_is_on[i])
+			continue;
+		for (j = n; j > 0; --j) {
+			if (g_disp_planes[order[j - 1]].z <= g_disp_planes[i].z)
+				break;
+			order[j] = order[j - 1];
+		}
+		order[j] = i;
+		++n;
+	}
+	for (i = 0; i < n; ++i) {
+		err = hvs_dlist_add_plane(&d, &g_disp_planes[order[i]]);
+		if (err)
+			return err;
+	}
+	err = hvs_dlist_end(&d);
+	if (err)
+		return err;
+	g_disp_list_fbs[l] = fb;
 	return ERR_SUCCESS;
-err2:
-	page -= _1MB >> PAGE_SIZE_BITS;
-	for (--i; i >= 0; --i) {
-		mmu_unmap_page(0, page);
-		page -= _1MB >> PAGE_SIZE_BITS;
+}
+
+// Called with g_disp_lock held.
+// Write a list which shows the buffer fb, and have the HVS latch it at the
+// start of the next frame. A list queued earlier, and not yet latched, is
+// dropped. Adds the count of buffers freed to num_freed.
+static
+int disp_queue(int fb, int *num_freed)
+{
+	int l, prev, err;
+
+	*num_freed += disp_retire();
+	l = hvs_chan_get_back(&g_disp_chan);
+	assert(l >= 0);
+	err = disp_write_list(l, fb);
+	if (err)
+		return err;
+	prev = hvs_chan_queue(&g_disp_chan, l);
+
+	// The HVS may have latched prev before the queue above.
+	if (prev >= 0 && hvs_chan_is_active(&g_disp_chan, prev))
+		*num_freed += disp_activate(prev);
+	return ERR_SUCCESS;
+}
+
+// IPL_HARD
+// A gap of more than 1.5 frames since the last vblank means the irq was
+// held off past whole vblanks; those are counted as lost.
+static
+void disp_hw_irqh()
+{
+	uint32_t stat, ts, delta, num_lost;
+	struct disp_timing *t;
+
+	stat = g_pv2_regs[PV_INT_STAT];
+	g_pv2_regs[PV_INT_STAT] = stat;
+	if (!bits_get(stat, PV_INT_VFP_START))
+		return;
+
+	ts = tmr_get_ctr();
+	t = &g_disp_timing;
+	num_lost = 0;
+	spin_lock(&g_disp_timing_lock);
+	delta = ts - t->ts;
+	if (t->frame && t->period && delta > t->period + (t->period >> 1))
+		num_lost = divmod(delta + (t->period >> 1), t->period, NULL) - 1;
+	t->frame += 1 + num_lost;
+	t->num_lost += num_lost;
+	t->ts = ts;
+	spin_unlock(&g_disp_timing_lock);
+	cpu_raise_sw_irq(IRQ_PV2);
+}
+
+// Called with g_disp_lock held.
+static
+void disp_read_timing(struct disp_timing *out)
+{
+	spin_lock(&g_disp_timing_lock);
+	*out = g_disp_timing;
+	spin_unlock(&g_disp_timing_lock);
+}
+
+// IPL_SCHED
+// At the start of the vertical front porch, the frame just scanned out is
+// complete. The HVS latches a new list only after this point, so a flip
+// is seen at the vblank of the frame which shows it.
+static
+void disp_sw_irqh()
+{
+	int freed;
+	void *p;
+	struct list_head *e;
+	struct thread *t;
+	struct disp_timing timing;
+	struct disp_fb *fb;
+	fn_disp_vblank *fn;
+
+	spin_lock(&g_disp_lock);
+	freed = disp_retire();
+
+	// A flip made during frame n shows in frame n + 1, and retires at the
+	// vblank which ends it, at the latest. Each vblank from that one on,
+	// with the flip still queued, is a frame missed. A queued commit of
+	// the planes alone is not a flip.
+	fb = NULL;
+	if (g_disp_chan.queued >= 0)
+		fb = &g_disp_fbs[g_disp_list_fbs[g_disp_chan.queued]];
+	if (fb && fb->state == DISP_FB_QUEUED &&
+	    fb->flip_frame + 2 <= g_disp_timing.frame)
+		++g_disp_timing.num_missed;
+	disp_read_timing(&timing);
+
+	while (!list_is_empty(&g_disp_vblank_wq)) {
+		e = list_del_head(&g_disp_vblank_wq);
+		t = list_entry(e, struct thread, wait_entry);
+		thread_unwait(t);
 	}
-	vmm_free(pages, num_pages);
-err1:
-	pmm_free(frames, num_pages);
+	fn = g_disp_vblank_fn;
+	p = g_disp_vblank_p;
+	spin_unlock(&g_disp_lock);
+
+	if (freed)
+		semaphore_up(&g_disp_free);
+	if (fn)
+		fn(&timing, p);
+}
+
+// IPL_SCHED or IPL_THREAD.
+void disp_get_timing(struct disp_timing *out)
+{
+	assert(out);
+	spin_lock(&g_disp_lock);
+	disp_read_timing(out);
+	spin_unlock(&g_disp_lock);
+}
+
+// IPL_THREAD
+// Sleep until the next vblank. The timing is as of that vblank, unless
+// another one has passed since.
+int disp_wait_vblank(struct disp_timing *out)
+{
+	enum ipl ipl;
+	reg_t irq_mask;
+
+	if (!g_disp_is_on)
+		return ERR_INVALID;
+
+	ipl = cpu_raise_ipl(IPL_SCHED, &irq_mask);
+	assert(ipl == IPL_THREAD);
+	spin_lock(&g_disp_lock);
+	thread_setup_wait(&g_disp_vblank_wq);
+	spin_unlock(&g_disp_lock);
+	thread_wait();
+	cpu_lower_ipl(ipl, irq_mask);
+
+	if (out)
+		disp_get_timing(out);
+	return ERR_SUCCESS;
+}
+
+// IPL_THREAD
+// Replaces the previous fn; NULL removes it.
+void disp_set_vblank_fn(fn_disp_vblank *fn, void *p)
+{
+	spin_lock(&g_disp_lock);
+	g_disp_vblank_fn = fn;
+	g_disp_vblank_p = p;
+	spin_unlock(&g_disp_lock);
+}
+
+// IPL_THREAD
+// Called before disp_config. num is 2 for double-, 3 for triple-buffering.
+int disp_set_num_bufs(int num)
+{
+	if (num < 2 || num > DISP_MAX_BUFS)
+		return ERR_PARAM;
+	if (g_disp_is_on)
+		return ERR_INVALID;
+	g_disp_num_fbs = num;
+	return ERR_SUCCESS;
+}
+
+// IPL_THREAD
+// Wait until a buffer is free, and hand it to the producer.
+int disp_acquire_buf(struct disp_buf *out)
+{
+	int i;
+
+	if (out == NULL)
+		return ERR_PARAM;
+	if (!g_disp_is_on)
+		return ERR_INVALID;
+
+	semaphore_down(&g_disp_free);
+	spin_lock(&g_disp_lock);
+	for (i = 0; i < g_disp_num_fbs; ++i)
+		if (g_disp_fbs[i].state == DISP_FB_FREE)
+			break;
+	assert(i < g_disp_num_fbs);
+	g_disp_fbs[i].state = DISP_FB_DRAWING;
+	spin_unlock(&g_disp_lock);
+	*out = g_disp_fbs[i].buf;
+	return ERR_SUCCESS;
+}
+
+// IPL_THREAD
+// Show the buffer from the next frame on, without waiting for it. A buffer
+// flipped earlier, which the HVS has not yet latched, is dropped and freed.
+int disp_flip(const struct disp_buf *b)
+{
+	int err, dropped, num_freed;
+	struct disp_fb *fb;
+
+	if (b == NULL || b->index < 0 || b->index >= g_disp_num_fbs)
+		return ERR_PARAM;
+	fb = &g_disp_fbs[b->index];
+
+	spin_lock(&g_disp_lock);
+	if (fb->state != DISP_FB_DRAWING) {
+		spin_unlock(&g_disp_lock);
+		return ERR_INVALID;
+	}
+	num_freed = 0;
+	dropped = -1;
+	if (g_disp_chan.queued >= 0)
+		dropped = g_disp_list_fbs[g_disp_chan.queued];
+	err = disp_queue(b->index, &num_freed);
+	if (!err) {
+		fb->state = DISP_FB_QUEUED;
+		fb->flip_frame = g_disp_timing.frame;
+
+		// Unless the HVS latched it after all.
+		if (dropped >= 0 &&
+		    g_disp_fbs[dropped].state == DISP_FB_QUEUED) {
+			g_disp_fbs[dropped].state = DISP_FB_FREE;
+			++num_freed;
+		}
+	}
+	spin_unlock(&g_disp_lock);
+
+	for (; num_freed; --num_freed)
+		semaphore_up(&g_disp_free);
+	return err;
+}
+
+// IPL_THREAD
+// Set the overlay plane id, or turn it off if p is NULL. The change shows
+// with the next flip or commit. The planes are checked against the mode, and
+// so can be set only after disp_config.
+int disp_set_plane(int id, const struct disp_plane *p)
+{
+	int i, err;
+	uint32_t lbm_size;
+
+	if (id < 0 || id >= DISP_NUM_PLANES)
+		return ERR_PARAM;
+	if (!g_disp_is_on)
+		return ERR_INVALID;
+
+	spin_lock(&g_disp_lock);
+	if (p == NULL) {
+		g_disp_plane_is_on[id] = 0;
+		spin_unlock(&g_disp_lock);
+		return ERR_SUCCESS;
+	}
+
+	err = hvs_check_plane(p, HAP, VAL);
+	if (err)
+		goto err0;
+
+	// The scaled planes share the line buffer memory.
+	lbm_size = hvs_plane_lbm_size(p);
+	for (i = 0; i < DISP_NUM_PLANES; ++i)
+		if (i != id && g_disp_plane_is_on[i])
+			lbm_size += hvs_plane_lbm_size(&g_disp_planes[i]);
+	err = ERR_NO_MEM;
+	if (lbm_size > hvs_chan_get_lbm_size(1))
+		goto err0;
+
+	g_disp_planes[id] = *p;
+	g_disp_plane_is_on[id] = 1;
+	err = ERR_SUCCESS;
 err0:
+	spin_unlock(&g_disp_lock);
 	return err;
 }
 
-// PV2 drives the HDMI encoder.
-int disp_config()
+// IPL_THREAD
+// Show the planes, as set, from the next frame on, above the buffer most
+// recently flipped. No buffer needs to be redrawn.
+int disp_commit()
 {
-	int err;
+	int l, err, num_freed;
+
+	if (!g_disp_is_on)
+		return ERR_INVALID;
+
+	spin_lock(&g_disp_lock);
+	num_freed = 0;
+	l = g_disp_chan.queued;
+	if (l < 0)
+		l = g_disp_chan.front;
+	err = disp_queue(g_disp_list_fbs[l], &num_freed);
+	spin_unlock(&g_disp_lock);
+
+	for (; num_freed; --num_freed)
+		semaphore_up(&g_disp_free);
+	return err;
+}
+
+// IPL_THREAD
+// The mode being driven.
+int disp_get_mode(struct disp_mode *out)
+{
+	if (out == NULL)
+		return ERR_PARAM;
+	if (!g_disp_is_on)
+		return ERR_INVALID;
+	*out = g_mode;
+	return ERR_SUCCESS;
+}
+
+// IPL_THREAD
+// PV2 drives the HDMI encoder. Drive the mode, or, if mode is NULL, the mode
+// the display prefers, as per its EDID; 1920x1080 if the EDID cannot be read,
+// or has no supported mode. The mode is set once.
+int disp_config(const struct disp_mode *mode)
+{
+	int i, err;
+	struct disp_mode m;
+
+	if (g_disp_is_on)
+		return ERR_INVALID;
+
+	if (mode == NULL) {
+		err = disp_get_edid_mode(&m);
+		if (err)
+			m = g_disp_modes[DISP_DEFAULT_MODE];
+		mode = &m;
+	}
+	err = disp_check_mode(mode);
+	if (err)
+		return err;
+	g_mode = *mode;
+	con_out("disp: %dx%d, %dkHz, vic %d", HAP, VAL, g_mode.pclk, VIC);
+
+	for (i = 0; i < g_disp_num_fbs; ++i) {
+		err = disp_alloc_fb(i);
+		if (err)
+			return err;
+	}
 
-	err = disp_alloc_fb();
+	err = hvs_chan_init(&g_disp_chan, 1, HVS_CHAN_MAX_REGIONS,
+			    DISP_LIST_NUM_WORDS);
+	if (err)
+		return err;
+	err = hvs_get_kernel(g_hvs_ppf_kernel, &g_disp_ppfk);
 	if (err)
 		return err;
+	disp_fill_fb(&g_disp_fbs[0]);
+	g_disp_fbs[0].state = DISP_FB_SCANOUT;
+	memset(&g_disp_timing, 0, sizeof(g_disp_timing));
+	g_disp_timing.period = disp_frame_period();
 
 	pv_disable_video();
 	hdmi_disable_video();
@@ -704,12 +1139,22 @@ int disp_config()
 	hvs_disable_channel();
 	hdmi_disable();
 
-	hvs_enable_channel();
+	spin_lock(&g_disp_lock);
+	err = disp_write_list(0, 0);
+	spin_unlock(&g_disp_lock);
+	if (err)
+		return err;
+	hvs_enable_channel(g_disp_chan.regions[g_disp_chan.front]);
 	hdmi_enable();
 	pv_enable();
 	hdmi_enable_csc_fifo();
 	pv_enable_video();
 	hdmi_enable_video();
+
+	g_disp_is_on = 1;
+	for (i = 1; i < g_disp_num_fbs; ++i)
+		semaphore_up(&g_disp_free);
+	cpu_enable_irq(IRQ_PV2);
 	return ERR_SUCCESS;
 }
 
@@ -758,5 +1203,19 @@ int disp_init()
 	if (err)
 		return err;
 	g_ddc_regs = (volatile uint32_t *)va;
+
+	err = ddc_init();
+	if (err)
+		return err;
+
+	err = hvs_init();
+	if (err)
+		return err;
+
+	semaphore_init(&g_disp_free, 0);
+	spin_lock_init(&g_disp_lock, IPL_SCHED);
+	spin_lock_init(&g_disp_timing_lock, IPL_HARD);
+	list_init(&g_disp_vblank_wq);
+	cpu_register_irqh(IRQ_PV2, disp_hw_irqh, disp_sw_irqh);
 	return ERR_SUCCESS;
 }
@@ -0,0 +1,468 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright (c) 2021 Amol Surati
+
+#include <lib/assert.h>
+#include <lib/stdlib.h>
+
+#include <sys/bitmap.h>
+#include <sys/cpu.h>
+#include <sys/err.h>
+#include <sys/mmu.h>
+#include <sys/mutex.h>
+
+#include <dev/disp.h>
+#include <dev/hvs.h>
+
+// From the firmware. Mitchell-Netravali.
+const uint32_t g_hvs_ppf_kernel[HVS_PPF_KERNEL_NUM_WORDS] = {
+	0x7ebfc00, 0x7e3edf8, 0x4805fd, 0x1dca432,
+	0x355769b, 0x1c6e3, 0x355769b, 0x1dca432,
+	0x4805fd, 0x7e3edf8, 0x7ebfc00
+};
+
+// The firmware's lists may lie below HVS_DLM_START; they are left alone.
+// The rest of the dlist memory is allocated in units of 16 words.
+#define HVS_DLM_START			0x400
+#define HVS_DLM_UNIT_BITS		4
+#define HVS_DLM_NUM_UNITS		((HVS_DL_MEM_NUM_WORDS - \
+					  HVS_DLM_START) >> HVS_DLM_UNIT_BITS)
+
+#define HVS_NUM_KERNELS			4
+
+// A scaling kernel, loaded once into the dlist memory, and shared by the
+// planes, of any channel, which use it.
+struct hvs_kernel {
+	const uint32_t			*words;
+	uint32_t			index;
+	int				ref;
+};
+
+extern volatile uint32_t *g_hvs_regs;
+
+static struct mutex g_hvs_lock;
+static struct bitmap g_hvs_dlm;
+static uint64_t g_hvs_dlm_buf[align_up(HVS_DLM_NUM_UNITS, 6) >> 6];
+static struct hvs_kernel g_hvs_kernels[HVS_NUM_KERNELS];
+
+struct hvs_fmt {
+	uint8_t				fmt;
+	uint8_t				order;
+	uint8_t				bpp;	// Bytes per pixel.
+	uint8_t				has_alpha;
+};
+
+static const struct hvs_fmt g_hvs_fmts[] = {
+	[DISP_FMT_XRGB8888]	= {7, 3, 4, 0},	// RGBA8888, ABGR.
+	[DISP_FMT_ARGB8888]	= {7, 3, 4, 1},
+	[DISP_FMT_RGB565]	= {4, 2, 2, 0},	// RGB565, XRGB.
+};
+
+// IPL_THREAD
+int hvs_init()
+{
+	mutex_init(&g_hvs_lock);
+	return bitmap_init(&g_hvs_dlm, g_hvs_dlm_buf, HVS_DLM_NUM_UNITS);
+}
+
+// Called with g_hvs_lock held.
+static
+int hvs_dlm_alloc_locked(int num_words, uint32_t *out)
+{
+	int err, unit, num_units;
+
+	num_units = align_up(num_words, HVS_DLM_UNIT_BITS) >> HVS_DLM_UNIT_BITS;
+	unit = bitmap_find_off(&g_hvs_dlm, 0, 0, num_units);
+	if (unit < 0)
+		return unit;
+	err = bitmap_on(&g_hvs_dlm, unit, num_units);
+	if (err)
+		return err;
+	*out = HVS_DLM_START + (unit << HVS_DLM_UNIT_BITS);
+	return ERR_SUCCESS;
+}
+
+// Called with g_hvs_lock held.
+static
+void hvs_dlm_free_locked(uint32_t index, int num_words)
+{
+	int err, unit, num_units;
+
+	assert(index >= HVS_DLM_START && num_words > 0);
+	unit = (index - HVS_DLM_START) >> HVS_DLM_UNIT_BITS;
+	num_units = align_up(num_words, HVS_DLM_UNIT_BITS) >> HVS_DLM_UNIT_BITS;
+	err = bitmap_is_on(&g_hvs_dlm, unit, num_units);
+	if (!err)
+		err = bitmap_off(&g_hvs_dlm, unit, num_units);
+	assert(err == ERR_SUCCESS);
+}
+
+// IPL_THREAD
+// Returns the index, into the dlist memory, of num_words free words.
+int hvs_dlm_alloc(int num_words, uint32_t *out)
+{
+	int err;
+
+	if (out == NULL || num_words <= 0)
+		return ERR_PARAM;
+	mutex_lock(&g_hvs_lock);
+	err = hvs_dlm_alloc_locked(num_words, out);
+	mutex_unlock(&g_hvs_lock);
+	return err;
+}
+
+// IPL_THREAD
+// The HVS must no longer run, or be able to latch, a list in the words.
+void hvs_dlm_free(uint32_t index, int num_words)
+{
+	mutex_lock(&g_hvs_lock);
+	hvs_dlm_free_locked(index, num_words);
+	mutex_unlock(&g_hvs_lock);
+}
+
+// IPL_THREAD
+// A kernel, of HVS_PPF_KERNEL_NUM_WORDS words, is identified by the address
+// of its words. The first user loads it; the others share its slot.
+int hvs_get_kernel(const uint32_t *words, uint32_t *out)
+{
+	int i, err, slot;
+	struct hvs_kernel *k;
+
+	if (words == NULL || out == NULL)
+		return ERR_PARAM;
+
+	slot = -1;
+	err = ERR_SUCCESS;
+	mutex_lock(&g_hvs_lock);
+	for (i = 0; i < HVS_NUM_KERNELS; ++i) {
+		k = &g_hvs_kernels[i];
+		if (k->ref && k->words == words)
+			goto exit;
+		if (k->ref == 0 && slot < 0)
+			slot = i;
+	}
+
+	err = ERR_NO_MEM;
+	if (slot < 0)
+		goto exit;
+	k = &g_hvs_kernels[slot];
+	err = hvs_dlm_alloc_locked(HVS_PPF_KERNEL_NUM_WORDS, &k->index);
+	if (err)
+		goto exit;
+	for (i = 0; i < HVS_PPF_KERNEL_NUM_WORDS; ++i)
+		g_hvs_regs[HVS_DL_MEM_INDEX + k->index + i] = words[i];
+	k->words = words;
+exit:
+	if (!err) {
+		++k->ref;
+		*out = k->index;
+	}
+	mutex_unlock(&g_hvs_lock);
+	return err;
+}
+
+// IPL_THREAD
+// The last user frees the slot. No list which uses the kernel may remain
+// with the HVS.
+void hvs_put_kernel(uint32_t index)
+{
+	int i;
+	struct hvs_kernel *k;
+
+	mutex_lock(&g_hvs_lock);
+	for (i = 0; i < HVS_NUM_KERNELS; ++i) {
+		k = &g_hvs_kernels[i];
+		if (k->ref && k->index == index)
+			break;
+	}
+	assert(i < HVS_NUM_KERNELS);
+	if (--k->ref == 0)
+		hvs_dlm_free_locked(k->index, HVS_PPF_KERNEL_NUM_WORDS);
+	mutex_unlock(&g_hvs_lock);
+}
+
+// IPL_THREAD
+// Allocate the regions of a channel. The HVS starts with the front one.
+int hvs_chan_init(struct hvs_chan *c, int index, int num_regions,
+		  int num_words)
+{
+	int i, err;
+
+	if (c == NULL || index < 0 || index > 2)
+		return ERR_PARAM;
+	if (num_regions < 1 || num_regions > HVS_CHAN_MAX_REGIONS)
+		return ERR_PARAM;
+
+	for (i = 0; i < num_regions; ++i) {
+		err = hvs_dlm_alloc(num_words, &c->regions[i]);
+		if (err)
+			goto err0;
+	}
+	c->index = index;
+	c->num_regions = num_regions;
+	c->num_words = num_words;
+	c->front = 0;
+	c->queued = -1;
+	c->lbm_start = index == 2 ? HVS_LBM_CHAN2_START : 0;
+	c->lbm_size = hvs_chan_get_lbm_size(index);
+	return ERR_SUCCESS;
+err0:
+	for (--i; i >= 0; --i)
+		hvs_dlm_free(c->regions[i], num_words);
+	return err;
+}
+
+// IPL_THREAD
+// The channel must be disabled.
+void hvs_chan_fini(struct hvs_chan *c)
+{
+	int i;
+
+	assert(c);
+	for (i = 0; i < c->num_regions; ++i)
+		hvs_dlm_free(c->regions[i], c->num_words);
+	c->num_regions = 0;
+}
+
+volatile uint32_t *hvs_chan_get_region(const struct hvs_chan *c, int r)
+{
+	assert(c && r >= 0 && r < c->num_regions);
+	return &g_hvs_regs[HVS_DL_MEM_INDEX + c->regions[r]];
+}
+
+// Returns a region which the HVS neither runs nor can latch, or -1.
+int hvs_chan_get_back(const struct hvs_chan *c)
+{
+	int r;
+
+	assert(c);
+	for (r = 0; r < c->num_regions; ++r)
+		if (r != c->front && r != c->queued)
+			return r;
+	return -1;
+}
+
+// Have the HVS latch the list in region r at the start of the next frame.
+// Returns the region queued before, which the HVS may have latched already,
+// or -1.
+int hvs_chan_queue(struct hvs_chan *c, int r)
+{
+	int prev;
+
+	assert(c && r >= 0 && r < c->num_regions);
+	prev = c->queued;
+	c->queued = r;
+
+	// The list, and the buffers, reach memory before the HVS can latch it.
+	dsb();
+	g_hvs_regs[HVS_DL0 + c->index] = c->regions[r];
+	dsb();
+	return prev;
+}
+
+// Channels 1 and 2 split the LBM; channel 0 is not used.
+uint32_t hvs_chan_get_lbm_size(int index)
+{
+	if (index == 1)
+		return HVS_LBM_CHAN2_START;
+	if (index == 2)
+		return HVS_LBM_SIZE - HVS_LBM_CHAN2_START;
+	return 0;
+}
+
+// Returns 1 if the HVS runs the list in region r.
+int hvs_chan_is_active(const struct hvs_chan *c, int r)
+{
+	assert(c && r >= 0 && r < c->num_regions);
+	return g_hvs_regs[HVS_DL0_ACT + c->index] == c->regions[r];
+}
+
+static
+char hvs_is_scaled(const struct disp_plane *p)
+{
+	return p->width != p->src_width || p->height != p->src_height;
+}
+
+// The PPF scales by up to 2/3 down, and any amount up.
+int hvs_check_plane(const struct disp_plane *p, uint32_t scr_width,
+		    uint32_t scr_height)
+{
+	if (p == NULL || (unsigned int)p->fmt >= DISP_FMT_NUM)
+		return ERR_PARAM;
+	if (p->src_width == 0 || p->src_width > HVS_PLANE_MAX_DIM)
+		return ERR_PARAM;
+	if (p->src_height == 0 || p->src_height > HVS_PLANE_MAX_DIM)
+		return ERR_PARAM;
+	if (p->width == 0 || p->width > HVS_PLANE_MAX_DIM)
+		return ERR_PARAM;
+	if (p->height == 0 || p->height > HVS_PLANE_MAX_DIM)
+		return ERR_PARAM;
+	if (p->pitch < p->src_width * g_hvs_fmts[p->fmt].bpp)
+		return ERR_PARAM;
+	if (!hvs_is_scaled(p))
+		return ERR_SUCCESS;
+
+	if (p->x < 0 || p->y < 0)
+		return ERR_UNSUP;
+	if (p->x + p->width > scr_width || p->y + p->height > scr_height)
+		return ERR_UNSUP;
+	if (3 * p->width < 2 * p->src_width)
+		return ERR_UNSUP;
+	if (3 * p->height < 2 * p->src_height)
+		return ERR_UNSUP;
+	return ERR_SUCCESS;
+}
+
+// The vertical PPF keeps 16 lines of the source.
+uint32_t hvs_plane_lbm_size(const struct disp_plane *p)
+{
+	if (!hvs_is_scaled(p))
+		return 0;
+	return align_up(p->src_width * 16, 5);
+}
+
+// The screen is the output of the channel.
+void hvs_dlist_init(struct hvs_dlist *d, const struct hvs_chan *c, int r,
+		    uint32_t scr_width, uint32_t scr_height, uint32_t ppfk)
+{
+	assert(d);
+	d->words = hvs_chan_get_region(c, r);
+	d->num_words = 0;
+	d->max_words = c->num_words;
+	d->scr_width = scr_width;
+	d->scr_height = scr_height;
+	d->lbm = c->lbm_start;
+	d->lbm_end = c->lbm_start + c->lbm_size;
+	d->ppfk = ppfk;
+}
+
+// The scale factor is in 16.16 fixed-point.
+static
+uint32_t hvs_ppf(uint32_t src, uint32_t dst)
+{
+	uint32_t val;
+
+	val = 0;
+	val |= bits_set(HVS_DLW_PPF_IPHASE, 0x60);	// From firmware.
+	val |= bits_set(HVS_DLW_PPF_SCALE,
+			divmod((uint64_t)src << 16, dst, NULL));
+	val |= bits_on(HVS_DLW_PPF_AGC);
+	return val;
+}
+
+// An unscaled plane is clipped to the screen; one entirely off the screen
+// adds no words. The plane must have passed hvs_check_plane.
+int hvs_dlist_add_plane(struct hvs_dlist *d, const struct disp_plane *p)
+{
+	int n;
+	char is_scaled;
+	uint32_t val, x, y, src_w, src_h, lbm_size;
+	pa_t pa;
+	const struct hvs_fmt *f;
+	volatile uint32_t *dl;
+
+	assert(d);
+	assert(p);
+	f = &g_hvs_fmts[p->fmt];
+	is_scaled = hvs_is_scaled(p);
+	pa = p->pa;
+	src_w = p->src_width;
+	src_h = p->src_height;
+	x = p->x;
+	y = p->y;
+
+	if (!is_scaled) {
+		if (p->x >= (int32_t)d->scr_width || p->x + (int32_t)src_w <= 0)
+			return ERR_SUCCESS;
+		if (p->y >= (int32_t)d->scr_height ||
+		    p->y + (int32_t)src_h <= 0)
+			return ERR_SUCCESS;
+		if (p->x < 0) {
+			pa += -p->x * f->bpp;
+			src_w += p->x;
+			x = 0;
+		}
+		if (p->y < 0) {
+			pa += -p->y * p->pitch;
+			src_h += p->y;
+			y = 0;
+		}
+		if (x + src_w > d->scr_width)
+			src_w = d->scr_width - x;
+		if (y + src_h > d->scr_height)
+			src_h = d->scr_height - y;
+	}
+
+	n = is_scaled ? 14 : 7;
+	if (d->num_words + n + 1 > d->max_words)	// + End.
+		return ERR_NO_MEM;
+	lbm_size = hvs_plane_lbm_size(p);
+	if (d->lbm + lbm_size > d->lbm_end)
+		return ERR_NO_MEM;
+
+	dl = &d->words[d->num_words];
+	val = 0;
+	val |= bits_set(HVS_DLW_CTL0_PIXEL_FMT, f->fmt);
+	val |= bits_set(HVS_DLW_CTL0_PIXEL_ORDER, f->order);
+	val |= bits_set(HVS_DLW_CTL0_RGBA_EXPAND, 3);	// Round??
+	val |= bits_set(HVS_DLW_CTL0_NUM_WORDS, n);
+	if (!is_scaled)
+		val |= bits_on(HVS_DLW_CTL0_UNITY);
+	val |= bits_on(HVS_DLW_CTL0_VALID);
+	*dl++ = val;
+
+	val = 0;
+	val |= bits_set(HVS_DLW_POS0_START_X, x);
+	val |= bits_set(HVS_DLW_POS0_START_Y, y);
+	val |= bits_set(HVS_DLW_POS0_FIXED_ALPHA, p->alpha);
+	*dl++ = val;
+
+	if (is_scaled) {
+		val = 0;
+		val |= bits_set(HVS_DLW_POS1_SCL_WIDTH, p->width);
+		val |= bits_set(HVS_DLW_POS1_SCL_HEIGHT, p->height);
+		*dl++ = val;
+	}
+
+	// A plane with per-pixel alpha has it scaled by the fixed alpha,
+	// unless that is opaque.
+	val = 0;
+	val |= bits_set(HVS_DLW_POS2_SRC_WIDTH, src_w);
+	val |= bits_set(HVS_DLW_POS2_SRC_HEIGHT, src_h);
+	if (f->has_alpha) {
+		val |= bits_set(HVS_DLW_POS2_ALPHA_MODE,
+				HVS_DLW_ALPHA_MODE_PIPELINE);
+		val |= bits_on(HVS_DLW_POS2_ALPHA_PREMULT);
+		if (p->alpha != 0xff)
+			val |= bits_on(HVS_DLW_POS2_ALPHA_MIX);
+	} else {
+		val |= bits_set(HVS_DLW_POS2_ALPHA_MODE,
+				HVS_DLW_ALPHA_MODE_FIXED);
+	}
+	*dl++ = val;
+	*dl++ = 0;
+
+	*dl++ = pa_to_ba(pa);
+	*dl++ = 0;
+	*dl++ = p->pitch;	// Source Pitch, for Linear Tiling.
+
+	if (is_scaled) {
+		*dl++ = d->lbm;
+		*dl++ = hvs_ppf(p->src_width, p->width);
+		*dl++ = hvs_ppf(p->src_height, p->height);
+		*dl++ = 0;
+		*dl++ = d->ppfk;	// H Scaling kernel.
+		*dl++ = d->ppfk;	// V Scaling kernel.
+		d->lbm += lbm_size;
+	}
+	d->num_words += n;
+	return ERR_SUCCESS;
+}
+
+int hvs_dlist_end(struct hvs_dlist *d)
+{
+	assert(d);
+	if (d->num_words >= d->max_words)
+		return ERR_NO_MEM;
+	d->words[d->num_words++] = bits_on(HVS_DLW_CTL0_END);
+	return ERR_SUCCESS;
+}
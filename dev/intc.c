@@ -4,6 +4,7 @@
 #include <lib/assert.h>
 #include <lib/stdlib.h>
 
+#include <sys/atomic.h>
 #include <sys/err.h>
 #include <sys/cpu.h>
 #include <sys/vmm.h>
@@ -22,7 +23,40 @@
 #define INTC_IRQ2_DISABLE		(0x20 >> 2)
 #define INTC_IRQ0_DISABLE		(0x24 >> 2)
 
+// BCM2836 per-core local interrupt controller and mailboxes.
+#define LINTC_MBOX_INT_CTRL(c)		((0x50 >> 2) + (c))
+#define LINTC_IRQ_SRC(c)		((0x60 >> 2) + (c))
+#define LINTC_MBOX_SET(c, m)		((0x80 >> 2) + (c) * 4 + (m))
+#define LINTC_MBOX_CLR(c, m)		((0xc0 >> 2) + (c) * 4 + (m))
+
+#define LINTC_IRQ_SRC_GPU_POS		8
+#define LINTC_IRQ_SRC_GPU_BITS		1
+
+// Bits 8 and 9 of the basic pending register summarize the banks 1 and 2.
+// Bits 10 to 20 repeat a few GPU IRQs; those are not summarized.
+#define INTC_IRQ0_PENDING_1_POS		8
+#define INTC_IRQ0_PENDING_2_POS		9
+#define INTC_IRQ0_PENDING_1_BITS	1
+#define INTC_IRQ0_PENDING_2_BITS	1
+#define INTC_IRQ0_SHORTCUT_POS		10
+
+// The FIQ sources 0 to 63 are the GPU IRQs; 64 to 71 the basic ones.
+#define INTC_FIQ_CTRL_SRC_POS		0
+#define INTC_FIQ_CTRL_EN_POS		7
+#define INTC_FIQ_CTRL_SRC_BITS		7
+#define INTC_FIQ_CTRL_EN_BITS		1
+#define INTC_FIQ_SRC_BASIC		64
+
+#define INTC_NUM_BANKS			3
+
+// Mailbox 0 carries the IPIs. The firmware's spin table polls mailbox 3.
+#define LINTC_MBOX_IPI			0
+#define LINTC_MBOX_START		3
+
 static volatile uint32_t *g_intc_regs;
+#if NUM_CPUS > 1
+static volatile uint32_t *g_lintc_regs;
+#endif
 
 struct irq_info {
 	int				reg_enable;
@@ -39,6 +73,13 @@ static struct irq_info g_irqs[NUM_IRQS] = {
 		1ul << 3
 	},
 
+	[IRQ_TIMER1] = {
+		INTC_IRQ1_ENABLE,
+		INTC_IRQ1_DISABLE,
+		INTC_IRQ1_PENDING,
+		1ul << 1
+	},
+
 	[IRQ_VC_3D] = {
 		INTC_IRQ1_ENABLE,
 		INTC_IRQ1_DISABLE,
@@ -46,33 +87,180 @@ static struct irq_info g_irqs[NUM_IRQS] = {
 		1ul << 10
 	},
 
+	[IRQ_TXP] = {
+		INTC_IRQ1_ENABLE,
+		INTC_IRQ1_DISABLE,
+		INTC_IRQ1_PENDING,
+		1ul << 11
+	},
+
+	[IRQ_I2C] = {
+		INTC_IRQ2_ENABLE,
+		INTC_IRQ2_DISABLE,
+		INTC_IRQ2_PENDING,
+		1ul << (53 - 32)
+	},
+
+	[IRQ_UART] = {
+		INTC_IRQ2_ENABLE,
+		INTC_IRQ2_DISABLE,
+		INTC_IRQ2_PENDING,
+		1ul << (57 - 32)
+	},
+
 	[IRQ_ARM_MAILBOX] = {
 		INTC_IRQ0_ENABLE,
 		INTC_IRQ0_DISABLE,
 		INTC_IRQ0_PENDING,
 		1ul << 1
-	}
+	},
+
+	[IRQ_PV2] = {
+		INTC_IRQ2_ENABLE,
+		INTC_IRQ2_DISABLE,
+		INTC_IRQ2_PENDING,
+		1ul << (42 - 32)
+	},
 };
 
+// The GPU IRQs which bits 10 to 20 of the basic pending register repeat.
+static const char g_intc_shortcuts[] = {7, 9, 10, 18, 19, 53, 54, 55, 56, 57,
+	62};
+
+// For each bank, the bits which belong to a known IRQ, and the IRQ of each
+// bit. Built from g_irqs by intc_init.
+static uint32_t g_intc_bank_masks[INTC_NUM_BANKS];
+static signed char g_intc_bank_irqs[INTC_NUM_BANKS][32];
+
+static
+void intc_map_bit(int bank, int bit, enum irq irq)
+{
+	g_intc_bank_masks[bank] |= 1ul << bit;
+	g_intc_bank_irqs[bank][bit] = irq;
+}
+
+// The banks of IRQ0, IRQ1 and IRQ2 are read through their pending registers,
+// which are at register indices 0, 1 and 2.
+static
+void intc_init_maps()
+{
+	int i, j, bank, bit, gpu_irq;
+	struct irq_info *ii;
+
+	for (i = 0; i < NUM_IRQS; ++i) {
+		ii = &g_irqs[i];
+		bank = ii->reg_pending;
+		assert(bank < INTC_NUM_BANKS && ii->mask);
+		bit = 31 - __builtin_clz(ii->mask);
+		intc_map_bit(bank, bit, i);
+
+		if (bank == 0)
+			continue;
+		gpu_irq = (bank - 1) * 32 + bit;
+		for (j = 0; j < (int)sizeof(g_intc_shortcuts); ++j)
+			if (g_intc_shortcuts[j] == gpu_irq)
+				intc_map_bit(0, INTC_IRQ0_SHORTCUT_POS + j, i);
+	}
+}
+
+// The known IRQs pending in a bank, as a mask of enum irq. Visits only the
+// bits which are set.
+static inline
+uint32_t intc_bank_pending(int bank, uint32_t val)
+{
+	int bit;
+	uint32_t mask;
+
+	mask = 0;
+	val &= g_intc_bank_masks[bank];
+	for (; val; val &= val - 1) {
+		bit = 31 - __builtin_clz(val & -val);
+		mask |= 1ul << g_intc_bank_irqs[bank][bit];
+	}
+	return mask;
+}
+
 int intc_init()
 {
 	int err;
 	va_t va;
+	void	cpu_init_fiq();
+#if NUM_CPUS > 1
+	void	intc_init_cpu();
+#endif
 
 	err = dev_map_io(INTC_BASE, 0x200, &va);
 	if (err)
 		return err;
 	g_intc_regs = (volatile uint32_t *)va;
+	intc_init_maps();
 
 	// Disable FIQ generation.
 	g_intc_regs[INTC_FIQ_CTRL] = 0;
+	cpu_init_fiq();
 
 	// Disable all IRQs
 	g_intc_regs[INTC_IRQ0_DISABLE] = -1;
 	g_intc_regs[INTC_IRQ1_DISABLE] = -1;
 	g_intc_regs[INTC_IRQ2_DISABLE] = -1;
+
+#if NUM_CPUS > 1
+	err = dev_map_io(LOCAL_BASE, 0x100, &va);
+	if (err)
+		return err;
+	g_lintc_regs = (volatile uint32_t *)va;
+	intc_init_cpu();
+#endif
+	return ERR_SUCCESS;
+}
+
+#if NUM_CPUS > 1
+// Called on each cpu as it comes online.
+void intc_init_cpu()
+{
+	int ix;
+
+	ix = cpu_get_index();
+	g_lintc_regs[LINTC_MBOX_CLR(ix, LINTC_MBOX_IPI)] = -1;
+	g_lintc_regs[LINTC_MBOX_INT_CTRL(ix)] = 1ul << LINTC_MBOX_IPI;
+}
+
+void intc_send_ipi(int index, enum ipi ipi)
+{
+	dsb();
+	g_lintc_regs[LINTC_MBOX_SET(index, LINTC_MBOX_IPI)] = 1ul << ipi;
+}
+
+// IPL_THREAD
+// entry is the physical address at which the core starts executing.
+int intc_start_cpu(int index, pa_t entry)
+{
+	if (index <= 0 || index >= NUM_CPUS)
+		return ERR_PARAM;
+	g_lintc_regs[LINTC_MBOX_SET(index, LINTC_MBOX_START)] = entry;
+	dsb();
+	cpu_sev();
 	return ERR_SUCCESS;
 }
+#endif
+
+// IPL_HARD
+// Read and acknowledge the IPIs pending on this cpu.
+uint32_t intc_get_ipis()
+{
+#if NUM_CPUS > 1
+	int ix;
+	uint32_t val;
+
+	ix = cpu_get_index();
+	val = g_lintc_regs[LINTC_MBOX_CLR(ix, LINTC_MBOX_IPI)];
+	if (val)
+		g_lintc_regs[LINTC_MBOX_CLR(ix, LINTC_MBOX_IPI)] = val;
+	return val;
+#else
+	return 0;
+#endif
+}
 
 static
 int intc_enable_disable_irq(enum irq irq, char is_enable)
@@ -97,18 +285,52 @@ int intc_disable_irq(enum irq irq)
 	return intc_enable_disable_irq(irq, 0);
 }
 
-uint32_t intc_get_pending()
+// The irq no longer interrupts as an IRQ.
+int intc_set_fiq(enum irq irq)
 {
-	int i;
-	uint32_t mask;
+	int bank, bit, src;
 	struct irq_info *ii;
 
-	mask = 0;
+	ii = &g_irqs[irq];
+	bank = ii->reg_pending;
+	bit = 31 - __builtin_clz(ii->mask);
+	if (bank == 0)
+		src = INTC_FIQ_SRC_BASIC + bit;
+	else
+		src = (bank - 1) * 32 + bit;
 
-	for (i = 0; i < NUM_IRQS; ++i) {
-		ii = &g_irqs[i];
-		if (g_intc_regs[ii->reg_pending] & ii->mask)
-			mask |= 1ul << i;
-	}
+	g_intc_regs[ii->reg_disable] = ii->mask;
+	g_intc_regs[INTC_FIQ_CTRL] = bits_on(INTC_FIQ_CTRL_EN) |
+		bits_set(INTC_FIQ_CTRL_SRC, src);
+	return ERR_SUCCESS;
+}
+
+void intc_clear_fiq()
+{
+	g_intc_regs[INTC_FIQ_CTRL] = 0;
+}
+
+// IPL_HARD
+// The pending IRQs, as a mask of enum irq. The basic pending register is
+// read first; the other two banks only if it says that they have IRQs
+// pending.
+uint32_t intc_get_pending()
+{
+	uint32_t mask, val;
+#if NUM_CPUS > 1
+	int ix;
+
+	// The GPU interrupts are routed to cpu0 only.
+	ix = cpu_get_index();
+	if (!bits_get(g_lintc_regs[LINTC_IRQ_SRC(ix)], LINTC_IRQ_SRC_GPU))
+		return 0;
+#endif
+
+	val = g_intc_regs[INTC_IRQ0_PENDING];
+	mask = intc_bank_pending(0, val);
+	if (bits_get(val, INTC_IRQ0_PENDING_1))
+		mask |= intc_bank_pending(1, g_intc_regs[INTC_IRQ1_PENDING]);
+	if (bits_get(val, INTC_IRQ0_PENDING_2))
+		mask |= intc_bank_pending(2, g_intc_regs[INTC_IRQ2_PENDING]);
 	return mask;
 }
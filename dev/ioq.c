@@ -11,9 +11,21 @@
 void ioq_init(struct ioq *ioq, fn_ioq_handler *req, fn_ioq_handler *res)
 {
 	list_init(&ioq->ior_head);
+	list_init(&ioq->busy_head);
 	spin_lock_init(&ioq->lock, IPL_SCHED);
 	ioq->req = req;
 	ioq->res = res;
+	ioq->num_busy = 0;
+	ioq->max_busy = 1;
+}
+
+// Called before any ior is queued. Allow up to max_busy requests to be with
+// the device at once. Such a device must complete them through
+// ioq_complete_ior_match, unless it completes them in order.
+void ioq_set_depth(struct ioq *ioq, int max_busy)
+{
+	assert(max_busy > 0);
+	ioq->max_busy = max_busy;
 }
 
 void ior_init(struct ior *ior, struct ioq *ioq, int cmd, void *param,
@@ -24,73 +36,169 @@ void ior_init(struct ior *ior, struct ioq *ioq, int cmd, void *param,
 	ior->ret = ERR_PENDING;
 	ior->ioq = ioq;
 	ior->param_pa = param_pa;
+	ior->cb = NULL;
+	ior->cb_param = NULL;
+	completion_init(&ior->done);
+}
+
+// Set before the ior is queued. The callback runs at IPL_SCHED, in place of
+// signalling the completion; ior_wait cannot be used on such an ior. The
+// callback may queue further iors.
+void ior_set_cb(struct ior *ior, fn_ior_cb *cb, void *cb_param)
+{
+	ior->cb = cb;
+	ior->cb_param = cb_param;
 }
 
 // IPL_THREAD
 int ior_wait(struct ior *ior)
 {
-	struct ioq *ioq;
+	assert(ior->cb == NULL);
+	completion_wait(&ior->done);
+	return ior->ret;
+}
 
-	ioq = ior->ioq;
-	for (;;) {
-		spin_lock(&ioq->lock);
-		if (ior->ret != ERR_PENDING)
-			break;
-		spin_unlock(&ioq->lock);
+// Called at IPL_SCHED, with the ioq lock held.
+// Hand the requests at the head of the queue to the device, while it has
+// room. The requests which fail to start are moved to the done list.
+static
+void ioq_start_locked(struct ioq *ioq, struct list_head *done)
+{
+	struct list_head *e, *head;
+	struct ior *ior;
+	int err;
+
+	head = &ioq->ior_head;
+	while (ioq->num_busy < ioq->max_busy && !list_is_empty(head)) {
+		e = list_del_head(head);
+		ior = list_entry(e, struct ior, entry);
+		err = ioq->req(ior);
+		if (!err) {
+			list_add_tail(&ioq->busy_head, e);
+			++ioq->num_busy;
+			continue;
+		}
+		assert(err != ERR_PENDING);
+		ior->ret = err;
+		list_add_tail(done, e);
 	}
-	spin_unlock(&ioq->lock);
-	return ior->ret;
 }
 
-// IPL_THREAD
-int ioq_queue_ior(struct ior *ior)
+// Called at IPL_SCHED, with the ioq lock held.
+static
+void ioq_finish_locked(struct ioq *ioq, struct ior *ior, struct list_head *done)
+{
+	list_del_entry(&ior->entry);
+	--ioq->num_busy;
+	ior->ret = ioq->res(ior);
+	assert(ior->ret != ERR_PENDING);
+	list_add_tail(done, &ior->entry);
+}
+
+// IPL_SCHED
+// An ior may be freed, or queued again, as soon as its completion is
+// signalled or its callback is called. Hence, the ioq lock is not held.
+static
+void ioq_finish(struct list_head *done)
+{
+	struct list_head *e;
+	struct ior *ior;
+
+	while (!list_is_empty(done)) {
+		e = list_del_head(done);
+		ior = list_entry(e, struct ior, entry);
+		if (ior->cb)
+			ior->cb(ior, ior->cb_param);
+		else
+			completion_signal(&ior->done);
+	}
+}
+
+// IPL_THREAD or IPL_SCHED
+// All the iors must belong to the same ioq. The whole batch is queued under a
+// single acquisition of the lock. The iors which fail to start complete with
+// the error.
+void ioq_queue_iors(struct ior **iors, int num)
 {
-	int is_empty, err;
-	struct list_head *head;
+	int i;
+	enum ipl ipl;
+	reg_t irq_mask;
+	struct list_head done;
 	struct ioq *ioq;
 
-	ioq = ior->ioq;
-	head = &ioq->ior_head;
+	assert(num > 0);
+	ioq = iors[0]->ioq;
+	list_init(&done);
+
+	ipl = cpu_raise_ipl(IPL_SCHED, &irq_mask);
 	spin_lock(&ioq->lock);
-	is_empty = list_is_empty(head);
-	err = ERR_SUCCESS;
-	if (is_empty)
-		err = ioq->req(ior);
-	if (!is_empty || !err)
-		list_add_tail(head, &ior->entry);
+	for (i = 0; i < num; ++i) {
+		assert(iors[i]->ioq == ioq);
+		list_add_tail(&ioq->ior_head, &iors[i]->entry);
+	}
+	ioq_start_locked(ioq, &done);
 	spin_unlock(&ioq->lock);
-	return err;
+	ioq_finish(&done);
+	cpu_lower_ipl(ipl, irq_mask);
 }
 
-// IPL_SOFT
+// IPL_THREAD or IPL_SCHED
+// Queueing does not fail. An ior which fails to start is complete, with the
+// error; as any other status of the ior, ior_wait, or the callback, sees it.
+// The ior is not touched once it is queued.
+int ioq_queue_ior(struct ior *ior)
+{
+	ioq_queue_iors(&ior, 1);
+	return ERR_SUCCESS;
+}
+
+// IPL_SCHED
+// Called by the device's interrupt handler, once the oldest request with the
+// device is done.
 int ioq_complete_ior(struct ioq *ioq)
 {
-	struct list_head *e, *head;
+	struct list_head *e, done;
 	struct ior *ior;
-	int err;
+	int ret;
 
-	head = &ioq->ior_head;
+	list_init(&done);
 
 	spin_lock(&ioq->lock);
-	assert(!list_is_empty(head));
-
-	e = list_del_head(head);
+	assert(!list_is_empty(&ioq->busy_head));
+	e = list_peek_head(&ioq->busy_head);
 	ior = list_entry(e, struct ior, entry);
-	ior->ret = ioq->res(ior);
-	assert(ior->ret != ERR_PENDING);
+	ioq_finish_locked(ioq, ior, &done);
+	ret = ior->ret;
+	ioq_start_locked(ioq, &done);
+	spin_unlock(&ioq->lock);
+	ioq_finish(&done);
+	return ret;
+}
 
-	for (;;) {
-		if (list_is_empty(head))
-			break;
-		e = list_peek_head(head);
+// IPL_SCHED
+// Called by the device's interrupt handler, for a device which may complete
+// its requests out of order. The first request with the device for which
+// match returns non-zero is completed.
+int ioq_complete_ior_match(struct ioq *ioq, fn_ioq_match *match, void *p)
+{
+	struct list_head *e, done;
+	struct ior *ior;
+	int ret;
+
+	list_init(&done);
+
+	ret = ERR_NOT_FOUND;
+	spin_lock(&ioq->lock);
+	list_for_each(e, &ioq->busy_head) {
 		ior = list_entry(e, struct ior, entry);
-		err = ioq->req(ior);
-		if (!err)
-			break;
-		assert(err != ERR_PENDING);
-		ior->ret = err;
-		list_del_head(head);
+		if (!match(ior, p))
+			continue;
+		ioq_finish_locked(ioq, ior, &done);
+		ret = ior->ret;
+		break;
 	}
+	ioq_start_locked(ioq, &done);
 	spin_unlock(&ioq->lock);
-	return ior->ret;
+	ioq_finish(&done);
+	return ret;
 }
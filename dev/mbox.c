@@ -8,9 +8,13 @@
 #include <sys/err.h>
 #include <sys/vmm.h>
 #include <sys/cpu.h>
+#include <sys/spinlock.h>
+#include <sys/tasklet.h>
 
 #include <dev/dev.h>
 #include <dev/con.h>
+#include <dev/ioq.h>
+#include <dev/mbox.h>
 
 int	slabs_va_to_pa(void *va, pa_t *pa);
 
@@ -25,51 +29,6 @@ struct mbox_msg {
 	uint32_t			code;
 };
 
-struct mbox_tag_get_fw_rev {
-	struct mbox_tag			tag;
-	struct {
-		uint32_t		rev;
-	} buf;
-};
-
-struct mbox_tag_set_dom_state {
-	struct mbox_tag			tag;
-	struct {
-		uint32_t		dom;
-		int			is_on;
-	} buf;
-};
-
-struct mbox_tag_fb_set_depth {
-	struct mbox_tag			tag;
-	struct {
-		uint32_t		bpp;
-	} buf;
-};
-
-struct mbox_tag_fb_set_dim {
-	struct mbox_tag			tag;
-	struct {
-		uint32_t		width;
-		uint32_t		height;
-	} buf;
-};
-
-struct mbox_tag_fb_alloc {
-	struct mbox_tag			tag;
-	struct {
-		uint32_t		base;
-		uint32_t		size;
-	} buf;
-};
-
-struct mbox_tag_fb_free {
-	struct mbox_tag			tag;
-	struct {
-		uint32_t		base;
-	} buf;
-};
-
 struct mbox {
 	uint32_t			rw;
 	uint32_t			res[3];
@@ -79,20 +38,64 @@ struct mbox {
 	uint32_t			config;
 };
 
+#define MBOX_STATUS_FULL_POS		31
+#define MBOX_STATUS_EMPTY_POS		30
+#define MBOX_CONFIG_DATA_IRQ_POS	0
+
+#define MBOX_STATUS_FULL_BITS		1
+#define MBOX_STATUS_EMPTY_BITS		1
+#define MBOX_CONFIG_DATA_IRQ_BITS	1
+
+#define MBOX_CHAN_PROP			8
+
+// The depth of the mailbox FIFOs. No more than these many requests are
+// outstanding, so neither the write FIFO nor the rx ring can overflow.
+#define MBOX_DEPTH			8
+
+// Cached firmware properties. A property which never changes stays valid
+// once read; the clock rates are invalidated when set. An invalidation bumps
+// the gen of the entry, so that a get which was in flight across it does not
+// publish what it read.
+enum mbox_prop {
+	MBOX_PROP_FW_REV,
+	MBOX_PROP_BOARD_REV,
+	MBOX_PROP_ARM_MEM,
+	MBOX_PROP_VC_MEM,
+	MBOX_PROP_CLK_RATE,
+	NUM_MBOX_PROPS = MBOX_PROP_CLK_RATE + MBOX_NUM_CLKS,
+};
+
+struct mbox_prop_cache {
+	uint32_t			val[2];
+	int				is_valid;
+	uint32_t			gen;
+};
+
 static volatile struct mbox *g_mbox;
+static struct mbox_prop_cache g_mbox_props[NUM_MBOX_PROPS];
+static struct spin_lock g_mbox_props_lock;
+static struct ioq g_mbox_ioq;
+
+// The responses, filled by the hw irq handler. Both it and the tasklet of
+// the queue run on the cpu which takes the GPU interrupts.
+static void *g_mbox_rx_items[MBOX_DEPTH];
+static struct softq g_mbox_rx;
 
+// Called at IPL_SCHED, with the ioq lock held.
 static
-void mbox_send(struct mbox_msg *m, pa_t pa)
+int mbox_req(struct ior *ior)
 {
+	struct mbox_msg *m;
+
+	m = ior_param(ior);
 	dc_civac(m, m->size);
 	dsb();
 
-	for (;;) {
-		if (g_mbox[1].status & 0x80000000ul)
-			continue;
-		break;
-	}
-	g_mbox[1].rw = pa_to_ba(pa);
+	// Does not spin in practice; see MBOX_DEPTH.
+	while (bits_get(g_mbox[1].status, MBOX_STATUS_FULL))
+		;
+	g_mbox[1].rw = pa_to_ba(ior_param_pa(ior)) | MBOX_CHAN_PROP;
+	return ERR_SUCCESS;
 }
 
 static
@@ -101,28 +104,22 @@ int mbox_check_tag(const struct mbox_tag *t)
 	size_t size;
 	if (!(t->code & 0x80000000ul))
 		return ERR_FAILED;
+	// The response may be shorter than the value buffer.
 	size = t->code & 0x7ffffffful;
-	if (size != t->buf_size)
+	if (size > t->buf_size)
 		return ERR_FAILED;
 	return ERR_SUCCESS;
 }
 
+// Called at IPL_SCHED, with the ioq lock held.
 static
-int mbox_recv(struct mbox_msg *m, pa_t pa)
+int mbox_res(struct ior *ior)
 {
 	int err;
-	uint32_t val;
+	struct mbox_msg *m;
 	struct mbox_tag *t;
 
-	for (;;) {
-		if (g_mbox[0].status & 0x40000000ul)
-			continue;
-		break;
-	}
-
-	val = g_mbox[0].rw;
-	if (val != pa_to_ba(pa))
-		return ERR_FAILED;
+	m = ior_param(ior);
 	if (m->code != 0x80000000ul)
 		return ERR_FAILED;
 
@@ -136,95 +133,171 @@ int mbox_recv(struct mbox_msg *m, pa_t pa)
 	return ERR_SUCCESS;
 }
 
-// IPL_THREAD
-int mbox_free_fb(pa_t base)
+// Called at IPL_SCHED, with the ioq lock held.
+// The firmware returns the bus address of the message it is done with.
+static
+int mbox_match(const struct ior *ior, void *p)
+{
+	uint32_t val;
+
+	val = *(uint32_t *)p;
+	return val == (pa_to_ba(ior_param_pa(ior)) | MBOX_CHAN_PROP);
+}
+
+// IPL_HARD
+static
+void mbox_hw_irqh()
 {
 	int err;
-	size_t size;
-	struct mbox_tag_fb_free *t;
-	struct mbox_msg *m;
-	pa_t pa;
+	uint32_t val;
 
-	size = sizeof(*t) + sizeof(*m) + sizeof(uint32_t);
-	size = align_up(size, 4);
-	m = malloc(size);
-	if (m == NULL)
-		return ERR_NO_MEM;
-	err = slabs_va_to_pa(m, &pa);
-	if (err)
-		goto err0;
+	// At most MBOX_DEPTH requests are outstanding.
+	while (!bits_get(g_mbox[0].status, MBOX_STATUS_EMPTY)) {
+		val = g_mbox[0].rw;
+		err = softq_push(&g_mbox_rx, (void *)(uintptr_t)val);
+		assert(err == ERR_SUCCESS);
+	}
+}
 
-	memset(m, 0, size);
-	m->size = size;
+// IPL_SCHED
+static
+void mbox_rx(void *item, void *p)
+{
+	int err;
+	uint32_t val;
 
-	t = (struct mbox_tag_fb_free *)(m + 1);
+	val = (uintptr_t)item;
+	err = ioq_complete_ior_match(&g_mbox_ioq, mbox_match, &val);
+	if (err == ERR_NOT_FOUND)
+		con_out("mbox: unexpected response %x", val);
+	(void)p;
+}
 
-	t->tag.id = 0x48001;
-	t->tag.buf_size = sizeof(t->buf);
-	t->buf.base = base;
+// IPL_THREAD
+// Send the property message, and sleep until the firmware responds.
+static
+int mbox_call(struct mbox_msg *m, pa_t pa)
+{
+	int err;
+	struct ior ior;
 
-	mbox_send(m, pa | 8);
-	err = mbox_recv(m, pa | 8);
-err0:
-	free(m);
-	return err;
+	ior_init(&ior, &g_mbox_ioq, 0, m, pa);
+	err = ioq_queue_ior(&ior);
+	if (err)
+		return err;
+	return ior_wait(&ior);
 }
 
 // IPL_THREAD
-int mbox_alloc_fb(pa_t *out_base, size_t *out_size)
+int mbox_buf_init(struct mbox_buf *b, size_t size)
 {
 	int err;
-	size_t size;
-	struct mbox_tag_fb_set_depth *td;
-	struct mbox_tag_fb_set_dim *tp, *tv;
-	struct mbox_tag_fb_alloc *ta;
 	struct mbox_msg *m;
-	pa_t pa;
 
-	size = sizeof(*td) + sizeof (*tp) + sizeof(*tv) + sizeof(*ta);
-	size += sizeof(*m) + sizeof(uint32_t);
+	// The message is 16-byte aligned; the low 4 bits of its address carry
+	// the channel.
 	size = align_up(size, 4);
+	if (size < 16)
+		size = 16;
 	m = malloc(size);
 	if (m == NULL)
 		return ERR_NO_MEM;
-	err = slabs_va_to_pa(m, &pa);
-	if (err)
-		goto err0;
+	err = slabs_va_to_pa(m, &b->pa);
+	if (err) {
+		free(m);
+		return err;
+	}
 
 	memset(m, 0, size);
-	m->size = size;
+	b->msg = m;
+	b->size = size;
+	b->used = sizeof(*m);
+	b->err = ERR_SUCCESS;
+	return ERR_SUCCESS;
+}
 
-	tp = (struct mbox_tag_fb_set_dim *)(m + 1);
-	tv = (struct mbox_tag_fb_set_dim *)(tp + 1);
-	td = (struct mbox_tag_fb_set_depth *)(tv + 1);
-	ta = (struct mbox_tag_fb_alloc *)(td + 1);
+void mbox_buf_fini(struct mbox_buf *b)
+{
+	free(b->msg);
+	b->msg = NULL;
+}
+
+// Append a tag with a value buffer of size bytes, and return the buffer.
+// The size must be the larger of the request and the response sizes.
+void *mbox_buf_add(struct mbox_buf *b, uint32_t id, size_t size)
+{
+	struct mbox_tag *t;
 
-	tp->tag.buf_size = sizeof(tp->buf);
-	tv->tag.buf_size = sizeof(tv->buf);
-	td->tag.buf_size = sizeof(td->buf);
-	ta->tag.buf_size = sizeof(ta->buf);
+	size = align_up(size, 4);
 
-	tp->tag.id = 0x48003;
-	tp->buf.width = 640;
-	tp->buf.height = 480;
+	// Leave room for the end tag.
+	if (b->err ||
+	    b->used + sizeof(*t) + size + sizeof(uint32_t) > b->size) {
+		b->err = ERR_INSUFF_BUFFER;
+		return NULL;
+	}
+
+	t = (struct mbox_tag *)((char *)b->msg + b->used);
+	t->id = id;
+	t->buf_size = size;
+	t->code = 0;
+	b->used += sizeof(*t) + size;
+	return t + 1;
+}
+
+// IPL_THREAD
+// All the tags are sent in one round trip.
+int mbox_buf_submit(struct mbox_buf *b)
+{
+	struct mbox_msg *m;
 
-	*tv = *tp;
-	tv->tag.id = 0x48004;
+	if (b->err)
+		return b->err;
 
-	td->tag.id = 0x48005;
-	td->buf.bpp = 32;
+	m = b->msg;
+	*(uint32_t *)((char *)m + b->used) = 0;	// The end tag.
+	m->size = b->used + sizeof(uint32_t);
+	m->code = 0;
+	return mbox_call(m, b->pa);
+}
 
-	ta->tag.id = 0x40001;
-	ta->buf.base = PAGE_SIZE;
+// IPL_THREAD
+int mbox_free_fb(pa_t base)
+{
+	int err;
+	struct mbox_buf b;
 
-	mbox_send(m, pa | 8);
-	err = mbox_recv(m, pa | 8);
+	err = mbox_buf_init(&b, 64);
+	if (err)
+		return err;
+	mbox_buf_fb_free(&b, base);
+	err = mbox_buf_submit(&b);
+	mbox_buf_fini(&b);
+	return err;
+}
+
+// IPL_THREAD
+int mbox_alloc_fb(pa_t *out_base, size_t *out_size)
+{
+	int err;
+	struct mbox_buf b;
+	struct mbox_fb_alloc *a;
+
+	err = mbox_buf_init(&b, 128);
+	if (err)
+		return err;
+
+	mbox_buf_fb_set_dim(&b, MBOX_TAG_FB_SET_DIM, 640, 480);
+	mbox_buf_fb_set_dim(&b, MBOX_TAG_FB_SET_VDIM, 640, 480);
+	mbox_buf_fb_set_depth(&b, 32);
+	a = mbox_buf_fb_alloc(&b, PAGE_SIZE);
+	err = mbox_buf_submit(&b);
 	if (err)
 		goto err0;
-	*out_base = ta->buf.base;
-	*out_size = ta->buf.size;
+	*out_base = a->base;
+	*out_size = a->size;
 err0:
-	free(m);
+	mbox_buf_fini(&b);
 	return err;
 }
 
@@ -232,39 +305,77 @@ err0:
 int mbox_set_dom_state(int dom, int is_on)
 {
 	int err;
-	size_t size;
-	struct mbox_tag_set_dom_state *t;
-	struct mbox_msg *m;
-	pa_t pa;
+	struct mbox_buf b;
+	struct mbox_dom_state *d;
 
-	is_on = !!is_on;
+	err = mbox_buf_init(&b, 64);
+	if (err)
+		return err;
 
-	size = sizeof(*t) + sizeof(*m) + sizeof(uint32_t);
-	size = align_up(size, 4);
-	m = malloc(size);
-	if (m == NULL)
-		return ERR_NO_MEM;
-	err = slabs_va_to_pa(m, &pa);
+	d = mbox_buf_set_dom_state(&b, dom, is_on);
+	err = mbox_buf_submit(&b);
 	if (err)
 		goto err0;
+	if (d->is_on != !!is_on)
+		err = ERR_FAILED;
+err0:
+	mbox_buf_fini(&b);
+	return err;
+}
 
-	memset(m, 0, size);
-	m->size = size;
+// IPL_THREAD
+// Fetch the first two words of the response to the tag id, from the cache if
+// possible. If has_arg, arg is the first word of the request.
+static
+int mbox_prop_get(enum mbox_prop ix, uint32_t id, char has_arg, uint32_t arg,
+		  uint32_t *out)
+{
+	int err, is_valid;
+	uint32_t *v, gen;
+	struct mbox_buf b;
+	struct mbox_prop_cache *c;
+
+	c = &g_mbox_props[ix];
+	spin_lock(&g_mbox_props_lock);
+	is_valid = c->is_valid;
+	gen = c->gen;
+	if (is_valid) {
+		out[0] = c->val[0];
+		out[1] = c->val[1];
+	}
+	spin_unlock(&g_mbox_props_lock);
+	if (is_valid)
+		return ERR_SUCCESS;
 
-	t = (struct mbox_tag_set_dom_state *)(m + 1);
-	t->tag.id = 0x38030;
-	t->tag.buf_size = sizeof(t->buf);
-	t->buf.dom = dom;
-	t->buf.is_on = is_on;
+	err = mbox_buf_init(&b, 64);
+	if (err)
+		return err;
 
-	mbox_send(m, pa | 8);
-	err = mbox_recv(m, pa | 8);
+	v = mbox_buf_add(&b, id, sizeof(c->val));
+	if (v == NULL) {
+		err = ERR_NO_MEM;
+		goto err0;
+	}
+	if (has_arg)
+		v[0] = arg;
+	err = mbox_buf_submit(&b);
 	if (err)
 		goto err0;
-	if (t->buf.is_on != is_on)
-		err = ERR_FAILED;
+
+	out[0] = v[0];
+	out[1] = v[1];
+
+	// Racing getters of the same gen read the same values; the first one
+	// publishes them.
+	spin_lock(&g_mbox_props_lock);
+	if (c->gen == gen && !c->is_valid) {
+		c->val[0] = v[0];
+		c->val[1] = v[1];
+		c->is_valid = 1;
+	}
+	spin_unlock(&g_mbox_props_lock);
 err0:
-	free(m);
+	mbox_buf_fini(&b);
 	return err;
 }
 
@@ -272,34 +383,105 @@ err0:
 int mbox_get_fw_rev(int *out)
 {
 	int err;
-	size_t size;
-	struct mbox_tag_get_fw_rev *t;
-	struct mbox_msg *m;
-	pa_t pa;
+	uint32_t v[2];
 
-	size = sizeof(*t) + sizeof(*m) + sizeof(uint32_t);
-	size = align_up(size, 4);
-	m = malloc(size);
-	if (m == NULL)
-		return ERR_NO_MEM;
-	err = slabs_va_to_pa(m, &pa);
+	err = mbox_prop_get(MBOX_PROP_FW_REV, MBOX_TAG_GET_FW_REV, 0, 0, v);
+	if (!err)
+		*out = v[0];
+	return err;
+}
+
+// IPL_THREAD
+int mbox_get_board_rev(uint32_t *out)
+{
+	int err;
+	uint32_t v[2];
+
+	err = mbox_prop_get(MBOX_PROP_BOARD_REV, MBOX_TAG_GET_BOARD_REV, 0, 0,
+			    v);
+	if (!err)
+		*out = v[0];
+	return err;
+}
+
+// IPL_THREAD
+int mbox_get_arm_mem(pa_t *out_base, size_t *out_size)
+{
+	int err;
+	uint32_t v[2];
+
+	err = mbox_prop_get(MBOX_PROP_ARM_MEM, MBOX_TAG_GET_ARM_MEM, 0, 0, v);
 	if (err)
-		goto err0;
+		return err;
+	*out_base = v[0];
+	*out_size = v[1];
+	return err;
+}
 
-	memset(m, 0, size);
-	m->size = size;
+// IPL_THREAD
+int mbox_get_vc_mem(pa_t *out_base, size_t *out_size)
+{
+	int err;
+	uint32_t v[2];
 
-	t = (struct mbox_tag_get_fw_rev *)(m + 1);
-	t->tag.id = 1;
-	t->tag.buf_size = sizeof(t->buf);
+	err = mbox_prop_get(MBOX_PROP_VC_MEM, MBOX_TAG_GET_VC_MEM, 0, 0, v);
+	if (err)
+		return err;
+	*out_base = v[0];
+	*out_size = v[1];
+	return err;
+}
 
-	mbox_send(m, pa | 8);
-	err = mbox_recv(m, pa | 8);
+// IPL_THREAD
+int mbox_get_clk_rate(int clk, uint32_t *out)
+{
+	int err;
+	uint32_t v[2];
+
+	if (clk <= 0 || clk >= MBOX_NUM_CLKS)
+		return ERR_PARAM;
+
+	err = mbox_prop_get(MBOX_PROP_CLK_RATE + clk, MBOX_TAG_GET_CLK_RATE, 1,
+			    clk, v);
+	if (!err)
+		*out = v[1];
+	return err;
+}
+
+// IPL_SCHED or IPL_THREAD.
+void mbox_invalidate_clk_rate(int clk)
+{
+	struct mbox_prop_cache *c;
+
+	assert(clk > 0 && clk < MBOX_NUM_CLKS);
+	c = &g_mbox_props[MBOX_PROP_CLK_RATE + clk];
+	spin_lock(&g_mbox_props_lock);
+	c->is_valid = 0;
+	++c->gen;
+	spin_unlock(&g_mbox_props_lock);
+}
+
+// IPL_THREAD
+// The firmware may round the rate; the next get reads it back. A get which
+// runs concurrently returns either rate, but the invalidation after the set
+// keeps it from caching the old one.
+int mbox_set_clk_rate(int clk, uint32_t rate)
+{
+	int err;
+	struct mbox_buf b;
+
+	if (clk <= 0 || clk >= MBOX_NUM_CLKS)
+		return ERR_PARAM;
+
+	err = mbox_buf_init(&b, 64);
 	if (err)
-		goto err0;
-	*out = t->buf.rev;
-err0:
-	free(m);
+		return err;
+
+	mbox_buf_set_clk_rate(&b, clk, rate);
+	mbox_invalidate_clk_rate(clk);
+	err = mbox_buf_submit(&b);
+	mbox_invalidate_clk_rate(clk);
+	mbox_buf_fini(&b);
 	return err;
 }
 
@@ -313,5 +495,19 @@ int mbox_init()
 	if (err)
 		return err;
 	g_mbox = (volatile struct mbox *)va;
+
+	spin_lock_init(&g_mbox_props_lock, IPL_SCHED);
+	ioq_init(&g_mbox_ioq, mbox_req, mbox_res);
+	ioq_set_depth(&g_mbox_ioq, MBOX_DEPTH);
+	err = softq_init(&g_mbox_rx, g_mbox_rx_items, MBOX_DEPTH, mbox_rx,
+			 NULL);
+	if (err)
+		return err;
+
+	cpu_register_irqh(IRQ_ARM_MAILBOX, mbox_hw_irqh, NULL);
+
+	// Interrupt when the firmware's FIFO has data for us.
+	g_mbox[0].config = bits_on(MBOX_CONFIG_DATA_IRQ);
+	cpu_enable_irq(IRQ_ARM_MAILBOX);
 	return ERR_SUCCESS;
 }
@@ -3,22 +3,110 @@
 
 #include <lib/assert.h>
 
+#include <sys/cpu.h>
 #include <sys/err.h>
 #include <sys/vmm.h>
 
 #include <dev/dev.h>
+#include <dev/tmr.h>
 
 #define TMR_CS				(0 >> 2)
 #define TMR_CLO				(0x4 >> 2)
 #define TMR_CHI				(0x8 >> 2)
+#define TMR_C1				(0x10 >> 2)
+#define TMR_C3				(0x18 >> 2)
+
+#define TMR_CS_M1_POS			1
+#define TMR_CS_M3_POS			3
+#define TMR_CS_M1_BITS			1
+#define TMR_CS_M3_BITS			1
 
 static volatile uint32_t *g_tmr_regs;
 
+static fn_tmr_alarm *g_tmr_alarm_fn;
+static void *g_tmr_alarm_p;
+
+static fn_tmr_alarm *g_tmr_irq_alarm_fn;
+static void *g_tmr_irq_alarm_p;
+
 uint32_t tmr_get_ctr()
 {
 	return g_tmr_regs[TMR_CLO];
 }
 
+// Called from the FIQ handler, on cpu0.
+// Compare 3 is routed to FIQ, so that the IPLs do not hold off an alarm. The
+// sw handlers of IRQ_TIMER3 run after it, at IPL_SCHED.
+static
+void tmr_fiqh()
+{
+	fn_tmr_alarm *fn;
+
+	g_tmr_regs[TMR_CS] = bits_on(TMR_CS_M3);
+	fn = g_tmr_alarm_fn;
+	g_tmr_alarm_fn = NULL;
+	if (fn)
+		fn(g_tmr_alarm_p);
+	cpu_raise_sw_irq_fiq(IRQ_TIMER3);
+}
+
+// Any IPL. Only one alarm can be pending at a time; it is delivered to
+// cpu0.
+void tmr_set_alarm(uint32_t ctr, fn_tmr_alarm *fn, void *p)
+{
+	assert(fn);
+	assert(g_tmr_alarm_fn == NULL);
+	g_tmr_alarm_p = p;
+	g_tmr_alarm_fn = fn;
+
+	// The FIQ handler, which the IPLs do not mask, sees the alarm before
+	// the compare is set.
+	dsb();
+	g_tmr_regs[TMR_C3] = ctr;
+}
+
+// IPL_HARD, on the cpu which takes the GPU interrupts.
+// Compare 1 stays routed to IRQ, for the callers which measure the IRQ path.
+static
+void tmr_hw_irqh()
+{
+	fn_tmr_alarm *fn;
+
+	if (!bits_get(g_tmr_regs[TMR_CS], TMR_CS_M1))
+		return;
+	g_tmr_regs[TMR_CS] = bits_on(TMR_CS_M1);
+	fn = g_tmr_irq_alarm_fn;
+	g_tmr_irq_alarm_fn = NULL;
+	if (fn)
+		fn(g_tmr_irq_alarm_p);
+}
+
+// Any IPL. As tmr_set_alarm, but fn is called from the IRQ handler, at
+// IPL_HARD. A new alarm replaces the pending one, if any; a match of the
+// replaced compare can still reach the new fn, which must check p.
+void tmr_set_irq_alarm(uint32_t ctr, fn_tmr_alarm *fn, void *p)
+{
+	enum ipl ipl;
+	reg_t irq_mask;
+
+	assert(fn);
+	ipl = cpu_raise_ipl(IPL_HARD, &irq_mask);
+	g_tmr_irq_alarm_p = p;
+	g_tmr_irq_alarm_fn = fn;
+	dsb();
+	g_tmr_regs[TMR_C1] = ctr;
+	cpu_lower_ipl(ipl, irq_mask);
+}
+
+// IPL_THREAD
+int tmr_init_irq()
+{
+	g_tmr_regs[TMR_CS] = bits_on(TMR_CS_M1) | bits_on(TMR_CS_M3);
+	cpu_register_irqh(IRQ_TIMER1, tmr_hw_irqh, NULL);
+	cpu_enable_irq(IRQ_TIMER1);
+	return cpu_set_fiqh(IRQ_TIMER3, tmr_fiqh);
+}
+
 // IPL_THREAD
 int tmr_init()
 {
@@ -0,0 +1,275 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright (c) 2021 Amol Surati
+
+#include <lib/assert.h>
+
+#include <sys/cpu.h>
+#include <sys/err.h>
+#include <sys/semaphore.h>
+#include <sys/spinlock.h>
+
+#include <dev/dev.h>
+#include <dev/hvs.h>
+#include <dev/txp.h>
+
+// HVS channel 2 runs the list of a job once, in one-shot mode, and the TXP
+// writes its output back to memory. One job runs at a time; the others wait
+// on the ioq.
+
+#define TXP_LIST_NUM_WORDS		16	// 14 + End.
+
+struct txp_fmt {
+	uint8_t				fmt;
+	uint8_t				bpp;	// Bytes per pixel.
+	uint8_t				has_alpha;
+};
+
+static const struct txp_fmt g_txp_fmts[] = {
+	[DISP_FMT_XRGB8888]	= {13, 4, 0},	// ARGB8888
+	[DISP_FMT_ARGB8888]	= {13, 4, 1},
+	[DISP_FMT_RGB565]	= {7, 2, 0},	// RGB565
+};
+
+extern volatile uint32_t *g_hvs_regs;
+extern volatile uint32_t *g_txp_regs;
+
+static struct ioq g_txp_ioq;
+static struct hvs_chan g_txp_chan;
+
+// The semaphore counts the free buffers. The lock, at IPL_SCHED, guards
+// is_free.
+static struct txp_buf g_txp_bufs[TXP_NUM_BUFS];
+static char g_txp_buf_is_free[TXP_NUM_BUFS];
+static struct semaphore g_txp_free;
+static struct spin_lock g_txp_lock;
+
+// Called at IPL_SCHED, with the ioq lock held.
+static
+int txp_req(struct ior *ior)
+{
+	int err;
+	uint32_t val;
+	struct hvs_dlist d;
+	struct txp_job *j;
+	struct txp_buf *b;
+	const struct txp_fmt *f;
+
+	j = ior_param(ior);
+	b = j->out;
+	f = &g_txp_fmts[b->fmt];
+
+	hvs_dlist_init(&d, &g_txp_chan, 0, b->width, b->height, j->ppfk);
+	err = hvs_dlist_add_plane(&d, &j->src);
+	if (err)
+		return err;
+	err = hvs_dlist_end(&d);
+	if (err)
+		return err;
+
+	// The list reaches the dlist memory before the HVS runs it.
+	dsb();
+	g_hvs_regs[HVS_DL2] = g_txp_chan.regions[0];
+
+	val = 0;
+	val |= bits_on(HVS_DL_CTRL_EN);
+	val |= bits_on(HVS_DL_CTRL_ONESHOT);
+	val |= bits_set(HVS_DL_CTRL_HEIGHT, b->height);
+	val |= bits_set(HVS_DL_CTRL_WIDTH, b->width);
+	g_hvs_regs[HVS_DL2_CTRL] = val;
+
+	g_txp_regs[TXP_DST_POINTER] = pa_to_ba(b->pa);
+	g_txp_regs[TXP_DST_PITCH] = b->pitch;
+
+	val = 0;
+	val |= bits_set(TXP_DIM_WIDTH, b->width);
+	val |= bits_set(TXP_DIM_HEIGHT, b->height);
+	g_txp_regs[TXP_DIM] = val;
+
+	val = 0;
+	val |= bits_on(TXP_DST_CTRL_GO);
+	val |= bits_on(TXP_DST_CTRL_EI);
+	val |= bits_set(TXP_DST_CTRL_FMT, f->fmt);
+	val |= bits_on(TXP_DST_CTRL_BYTE_EN);
+	if (f->has_alpha)
+		val |= bits_on(TXP_DST_CTRL_ALPHA_EN);
+	val |= bits_set(TXP_DST_CTRL_VERSION, 1);
+	val |= bits_set(TXP_DST_CTRL_PILOT, 0x54);
+	g_txp_regs[TXP_DST_CTRL] = val;
+	return ERR_SUCCESS;
+}
+
+// Called at IPL_SCHED, with the ioq lock held.
+static
+int txp_res(struct ior *ior)
+{
+	(void)ior;
+	return ERR_SUCCESS;
+}
+
+// IPL_HARD
+// The TXP interrupts once the frame is written, until EI is cleared.
+static
+void txp_hw_irqh()
+{
+	uint32_t val;
+
+	val = g_txp_regs[TXP_DST_CTRL];
+	if (!bits_get(val, TXP_DST_CTRL_EI))
+		return;
+	g_txp_regs[TXP_DST_CTRL] = val & bits_off(TXP_DST_CTRL_EI);
+	cpu_raise_sw_irq(IRQ_TXP);
+}
+
+// IPL_SCHED
+static
+void txp_sw_irqh()
+{
+	ioq_complete_ior(&g_txp_ioq);
+}
+
+// IPL_SCHED
+static
+void txp_ior_cb(struct ior *ior, void *p)
+{
+	struct txp_job *j;
+
+	j = p;
+	j->cb(j, j->cb_param);
+	(void)ior;
+}
+
+// IPL_THREAD
+// kernel, of HVS_PPF_KERNEL_NUM_WORDS words, filters a scaled source; NULL
+// selects the default one. The kernel is held until txp_job_fini. A job can
+// be submitted again once it completes.
+int txp_job_init(struct txp_job *j, const struct disp_plane *src,
+		 enum disp_fmt fmt, const uint32_t *kernel)
+{
+	int err;
+	uint32_t size;
+
+	if (j == NULL || src == NULL || (unsigned int)fmt >= DISP_FMT_NUM)
+		return ERR_PARAM;
+
+	j->src = *src;
+	j->src.x = 0;
+	j->src.y = 0;
+	err = hvs_check_plane(&j->src, src->width, src->height);
+	if (err)
+		return err;
+
+	size = src->width * src->height * g_txp_fmts[fmt].bpp;
+	if (size > TXP_BUF_NUM_MBS * _1MB)
+		return ERR_INSUFF_BUFFER;
+	if (hvs_plane_lbm_size(&j->src) > hvs_chan_get_lbm_size(2))
+		return ERR_NO_MEM;
+
+	if (kernel == NULL)
+		kernel = g_hvs_ppf_kernel;
+	err = hvs_get_kernel(kernel, &j->ppfk);
+	if (err)
+		return err;
+	j->fmt = fmt;
+	j->out = NULL;
+	j->cb = NULL;
+	j->cb_param = NULL;
+	return ERR_SUCCESS;
+}
+
+// IPL_THREAD
+// The job must not be with the TXP.
+void txp_job_fini(struct txp_job *j)
+{
+	assert(j);
+	hvs_put_kernel(j->ppfk);
+}
+
+// The callback runs at IPL_SCHED, in place of waking txp_wait.
+void txp_job_set_cb(struct txp_job *j, fn_txp_done *cb, void *p)
+{
+	assert(j);
+	j->cb = cb;
+	j->cb_param = p;
+}
+
+// IPL_THREAD
+// Wait for a free output buffer, and queue the job. Once the job completes,
+// successfully or not, the buffer at j->out belongs to the caller, who
+// returns it with txp_put_buf.
+int txp_submit(struct txp_job *j)
+{
+	int i;
+	struct txp_buf *b;
+
+	if (j == NULL)
+		return ERR_PARAM;
+
+	semaphore_down(&g_txp_free);
+	spin_lock(&g_txp_lock);
+	for (i = 0; i < TXP_NUM_BUFS; ++i)
+		if (g_txp_buf_is_free[i])
+			break;
+	assert(i < TXP_NUM_BUFS);
+	g_txp_buf_is_free[i] = 0;
+	spin_unlock(&g_txp_lock);
+
+	b = &g_txp_bufs[i];
+	b->width = j->src.width;
+	b->height = j->src.height;
+	b->pitch = b->width * g_txp_fmts[j->fmt].bpp;
+	b->fmt = j->fmt;
+	j->out = b;
+
+	ior_init(&j->ior, &g_txp_ioq, 0, j, 0);
+	if (j->cb)
+		ior_set_cb(&j->ior, txp_ior_cb, j);
+	return ioq_queue_ior(&j->ior);
+}
+
+// IPL_THREAD
+int txp_wait(struct txp_job *j)
+{
+	assert(j && j->cb == NULL);
+	return ior_wait(&j->ior);
+}
+
+// IPL_SCHED or IPL_THREAD.
+void txp_put_buf(struct txp_buf *b)
+{
+	assert(b && b->index >= 0 && b->index < TXP_NUM_BUFS);
+	spin_lock(&g_txp_lock);
+	assert(!g_txp_buf_is_free[b->index]);
+	g_txp_buf_is_free[b->index] = 1;
+	spin_unlock(&g_txp_lock);
+	semaphore_up(&g_txp_free);
+}
+
+// IPL_THREAD
+// Called after disp_init, which maps the registers.
+int txp_init()
+{
+	int i, err;
+	va_t va;
+	pa_t pa;
+
+	err = hvs_chan_init(&g_txp_chan, 2, 1, TXP_LIST_NUM_WORDS);
+	if (err)
+		return err;
+
+	for (i = 0; i < TXP_NUM_BUFS; ++i) {
+		err = dev_alloc_mem(TXP_BUF_NUM_MBS, &va, &pa);
+		if (err)
+			return err;
+		g_txp_bufs[i].index = i;
+		g_txp_bufs[i].va = (void *)va;
+		g_txp_bufs[i].pa = pa;
+		g_txp_buf_is_free[i] = 1;
+	}
+
+	semaphore_init(&g_txp_free, TXP_NUM_BUFS);
+	spin_lock_init(&g_txp_lock, IPL_SCHED);
+	ioq_init(&g_txp_ioq, txp_req, txp_res);
+	cpu_register_irqh(IRQ_TXP, txp_hw_irqh, txp_sw_irqh);
+	cpu_enable_irq(IRQ_TXP);
+	return ERR_SUCCESS;
+}
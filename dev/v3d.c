@@ -6,15 +6,134 @@
 
 #include <sys/err.h>
 #include <sys/cpu.h>
+#include <sys/tasklet.h>
+#include <sys/trace.h>
 #include <sys/vmm.h>
 
 #include <dev/dev.h>
 #include <dev/con.h>
 #include <dev/mbox.h>
+#include <dev/tmr.h>
 #include <dev/v3d.h>
 
 static volatile uint32_t *g_v3d_regs;
 
+// The counters of the last job of each kind.
+static struct v3d_job_stats g_v3d_stats[V3D_NUM_JOBS];
+static enum v3d_pctr_src g_v3d_srcs[V3D_NUM_PCTRS];
+static int g_v3d_num_srcs;
+static uint32_t g_v3d_job_start;
+
+// The error statuses, reported outside of the hw irq handler.
+static void *g_v3d_err_items[8];
+static struct softq g_v3d_errs;
+
+static const char *g_v3d_pctr_names[] = {
+	[V3D_PCTR_FEP_PRIMS_NO_PIXELS]		= "fep_prims_no_pixels",
+	[V3D_PCTR_FEP_PRIMS]			= "fep_prims",
+	[V3D_PCTR_FEP_QUADS_CLIPPED]		= "fep_quads_clipped",
+	[V3D_PCTR_FEP_QUADS]			= "fep_quads",
+	[V3D_PCTR_TLB_QUADS_NO_STENCIL]		= "tlb_quads_no_stencil",
+	[V3D_PCTR_TLB_QUADS_NO_Z_STENCIL]	= "tlb_quads_no_z_stencil",
+	[V3D_PCTR_TLB_QUADS_Z_STENCIL]		= "tlb_quads_z_stencil",
+	[V3D_PCTR_TLB_QUADS_NO_COVERAGE]	= "tlb_quads_no_coverage",
+	[V3D_PCTR_TLB_QUADS_COVERAGE]		= "tlb_quads_coverage",
+	[V3D_PCTR_TLB_QUADS_WRITTEN]		= "tlb_quads_written",
+	[V3D_PCTR_PTB_PRIMS_OUTSIDE]		= "ptb_prims_outside",
+	[V3D_PCTR_PTB_PRIMS_CLIPPED]		= "ptb_prims_clipped",
+	[V3D_PCTR_PSE_PRIMS_REVERSED]		= "pse_prims_reversed",
+	[V3D_PCTR_QPU_CYCLES_IDLE]		= "qpu_cycles_idle",
+	[V3D_PCTR_QPU_CYCLES_VERTEX]		= "qpu_cycles_vertex",
+	[V3D_PCTR_QPU_CYCLES_FRAGMENT]		= "qpu_cycles_fragment",
+	[V3D_PCTR_QPU_CYCLES_VALID]		= "qpu_cycles_valid",
+	[V3D_PCTR_QPU_STALLS_TMU]		= "qpu_stalls_tmu",
+	[V3D_PCTR_QPU_STALLS_SCOREBOARD]	= "qpu_stalls_scoreboard",
+	[V3D_PCTR_QPU_STALLS_VARYINGS]		= "qpu_stalls_varyings",
+	[V3D_PCTR_QPU_ICACHE_HITS]		= "qpu_icache_hits",
+	[V3D_PCTR_QPU_ICACHE_MISSES]		= "qpu_icache_misses",
+	[V3D_PCTR_QPU_UCACHE_HITS]		= "qpu_ucache_hits",
+	[V3D_PCTR_QPU_UCACHE_MISSES]		= "qpu_ucache_misses",
+	[V3D_PCTR_TMU_QUADS]			= "tmu_quads",
+	[V3D_PCTR_TMU_CACHE_MISSES]		= "tmu_cache_misses",
+	[V3D_PCTR_VPM_VDW_STALLS]		= "vpm_vdw_stalls",
+	[V3D_PCTR_VPM_VCD_STALLS]		= "vpm_vcd_stalls",
+	[V3D_PCTR_L2C_HITS]			= "l2c_hits",
+	[V3D_PCTR_L2C_MISSES]			= "l2c_misses",
+};
+
+// Counters 0 to num_srcs - 1 count srcs[0] to srcs[num_srcs - 1]. If any of
+// the srcs is invalid, the counters are left as they were.
+int v3d_pctr_select(const enum v3d_pctr_src *srcs, int num_srcs)
+{
+	int i;
+
+	if (num_srcs < 0 || num_srcs > V3D_NUM_PCTRS)
+		return ERR_PARAM;
+	for (i = 0; i < num_srcs; ++i)
+		if ((unsigned int)srcs[i] >= V3D_NUM_PCTR_SRCS)
+			return ERR_PARAM;
+
+	g_v3d_regs[V3D_PCTRE] = 0;
+	for (i = 0; i < num_srcs; ++i) {
+		g_v3d_srcs[i] = srcs[i];
+		g_v3d_regs[V3D_PCTRS(i)] = srcs[i];
+	}
+	g_v3d_num_srcs = num_srcs;
+	g_v3d_regs[V3D_PCTRC] = (1ul << V3D_NUM_PCTRS) - 1;
+	g_v3d_regs[V3D_PCTRE] = bits_on(V3D_PCTRE_EN) | ((1ul << num_srcs) - 1);
+	return ERR_SUCCESS;
+}
+
+// The jobs run one at a time; the counters are cleared as each starts.
+static
+void v3d_job_begin()
+{
+	g_v3d_regs[V3D_PCTRC] = (1ul << V3D_NUM_PCTRS) - 1;
+	g_v3d_job_start = tmr_get_ctr();
+}
+
+static
+void v3d_job_end(enum v3d_job job)
+{
+	int i;
+	struct v3d_job_stats *s;
+
+	s = &g_v3d_stats[job];
+	s->usecs = tmr_get_ctr() - g_v3d_job_start;
+	s->num_srcs = g_v3d_num_srcs;
+	for (i = 0; i < g_v3d_num_srcs; ++i) {
+		s->srcs[i] = g_v3d_srcs[i];
+		s->counts[i] = g_v3d_regs[V3D_PCTR(i)];
+	}
+}
+
+// The stats of the last job of the kind.
+int v3d_get_job_stats(enum v3d_job job, struct v3d_job_stats *out)
+{
+	if (job >= V3D_NUM_JOBS)
+		return ERR_PARAM;
+	*out = g_v3d_stats[job];
+	return ERR_SUCCESS;
+}
+
+void v3d_print_job_stats(const char *name, const struct v3d_job_stats *s)
+{
+	int i;
+
+	con_out("%s: %d us", name, s->usecs);
+	for (i = 0; i < s->num_srcs; ++i)
+		con_out("%s: %s %d", name, g_v3d_pctr_names[s->srcs[i]],
+			s->counts[i]);
+}
+
+// IPL_SCHED
+static
+void v3d_report_err(void *item, void *p)
+{
+	con_out("v3d: errstat %x", (uint32_t)(uintptr_t)item);
+	(void)p;
+}
+
 // IPL_HARD
 static
 void v3d_hw_irqh()
@@ -24,8 +143,9 @@ void v3d_hw_irqh()
 	intctl = g_v3d_regs[V3D_INTCTL];
 	dbqitc = g_v3d_regs[V3D_DBQITC];
 	errstat = g_v3d_regs[V3D_ERRSTAT];
-	con_out("v3dirqh: errstat %x, intctl %x, dbqitc %x",
-		errstat, intctl, dbqitc);
+	trace(TRACE_V3D_IRQ, intctl, dbqitc);
+	if (errstat)
+		softq_push(&g_v3d_errs, (void *)(uintptr_t)errstat);
 
 	// Deassert the signals
 	if (intctl)
@@ -46,6 +166,8 @@ int v3d_run_prog(ba_t code_ba, ba_t unif_ba, size_t unif_size)
 	}
 	srqcs = g_v3d_regs[V3D_SRQCS];
 	pdone = bits_get(srqcs, V3D_SRQCS_NUM_DONE);
+	trace(TRACE_V3D_RUN_PROG, code_ba, unif_ba);
+	v3d_job_begin();
 	g_v3d_regs[V3D_SRQPC] = code_ba;
 
 	for (;;) {
@@ -54,11 +176,14 @@ int v3d_run_prog(ba_t code_ba, ba_t unif_ba, size_t unif_size)
 		if (cdone != pdone)
 			break;
 	}
+	v3d_job_end(V3D_JOB_PROG);
 	return ERR_SUCCESS;
 }
 
 void v3d_run_renderer(ba_t cr, size_t size)
 {
+	trace(TRACE_V3D_RUN_RENDERER, cr, size);
+	v3d_job_begin();
 	g_v3d_regs[V3D_CT1CS] = 1ul << 15;
 	g_v3d_regs[V3D_CT1CA] = cr;
 	g_v3d_regs[V3D_CT1EA] = cr + size;
@@ -68,6 +193,7 @@ void v3d_run_renderer(ba_t cr, size_t size)
 			continue;
 		break;
 	}
+	v3d_job_end(V3D_JOB_RENDERER);
 #if 0
 	con_out("dbge %x", g_v3d_regs[V3D_DBGE]);
 	con_out("ct1cs %x", g_v3d_regs[V3D_CT1CS]);
@@ -85,6 +211,8 @@ void v3d_run_renderer(ba_t cr, size_t size)
 
 void v3d_run_binner(ba_t cr, size_t size)
 {
+	trace(TRACE_V3D_RUN_BINNER, cr, size);
+	v3d_job_begin();
 	g_v3d_regs[V3D_CT0CS] = 1ul << 15;
 	g_v3d_regs[V3D_CT0CA] = cr;
 	g_v3d_regs[V3D_CT0EA] = cr + size;
@@ -94,6 +222,7 @@ void v3d_run_binner(ba_t cr, size_t size)
 			continue;
 		break;
 	}
+	v3d_job_end(V3D_JOB_BINNER);
 #if 0
 	con_out("dbge %x", g_v3d_regs[V3D_DBGE]);
 	con_out("ct0cs %x", g_v3d_regs[V3D_CT0CS]);
@@ -114,6 +243,24 @@ int v3d_init()
 {
 	int err;
 	va_t va;
+	static const enum v3d_pctr_src srcs[] = {
+		V3D_PCTR_FEP_PRIMS,
+		V3D_PCTR_FEP_QUADS,
+		V3D_PCTR_TLB_QUADS_WRITTEN,
+		V3D_PCTR_PTB_PRIMS_CLIPPED,
+		V3D_PCTR_QPU_CYCLES_IDLE,
+		V3D_PCTR_QPU_CYCLES_VERTEX,
+		V3D_PCTR_QPU_CYCLES_FRAGMENT,
+		V3D_PCTR_QPU_CYCLES_VALID,
+		V3D_PCTR_QPU_STALLS_TMU,
+		V3D_PCTR_QPU_STALLS_SCOREBOARD,
+		V3D_PCTR_QPU_STALLS_VARYINGS,
+		V3D_PCTR_QPU_ICACHE_MISSES,
+		V3D_PCTR_QPU_UCACHE_MISSES,
+		V3D_PCTR_TMU_QUADS,
+		V3D_PCTR_TMU_CACHE_MISSES,
+		V3D_PCTR_L2C_MISSES,
+	};
 
 	err = mbox_set_dom_state(11, 1);
 	if (err)
@@ -129,6 +276,16 @@ int v3d_init()
 	if (g_v3d_regs[V3D_IDENT0] != 0x2443356)
 		goto err1;
 
+	err = v3d_pctr_select(srcs, sizeof(srcs) / sizeof(srcs[0]));
+	if (err)
+		goto err1;
+
+	err = softq_init(&g_v3d_errs, g_v3d_err_items,
+			 sizeof(g_v3d_err_items) / sizeof(g_v3d_err_items[0]),
+			 v3d_report_err, NULL);
+	if (err)
+		goto err1;
+
 	cpu_register_irqh(IRQ_VC_3D, v3d_hw_irqh, NULL);
 
 	// Allow QPU to interrupt the host.
@@ -4,6 +4,16 @@
 #ifndef DEV_CON_H
 #define DEV_CON_H
 
+// What con_out does when the tx ring is full.
+enum con_policy {
+	CON_POLICY_DROP,
+	CON_POLICY_BLOCK,	// At IPL_THREAD only; others drop.
+};
+
 int	con_init();
+int	con_init_irq();
 int	con_out(const char *fmt, ...);
+void	con_flush();
+void	con_set_policy(enum con_policy policy);
+int	con_get_num_dropped();
 #endif
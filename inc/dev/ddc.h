@@ -4,6 +4,8 @@
 #ifndef DEV_DDC_H
 #define DEV_DDC_H
 
+#include <stdint.h>
+
 #include <sys/bits.h>
 
 #define DDC_CTRL			(0x0 >> 2)
@@ -13,10 +15,18 @@
 #define DDC_FIFO			(0x10 >> 2)
 
 #define DDC_CTRL_READ_POS		0
+#define DDC_CTRL_CLEAR_POS		4
 #define DDC_CTRL_START_POS		7
+#define DDC_CTRL_INTD_POS		8
+#define DDC_CTRL_INTT_POS		9
+#define DDC_CTRL_INTR_POS		10
 #define DDC_CTRL_I2C_EN_POS		15
 #define DDC_CTRL_READ_BITS		1
+#define DDC_CTRL_CLEAR_BITS		2
 #define DDC_CTRL_START_BITS		1
+#define DDC_CTRL_INTD_BITS		1
+#define DDC_CTRL_INTT_BITS		1
+#define DDC_CTRL_INTR_BITS		1
 #define DDC_CTRL_I2C_EN_BITS		1
 
 #define DDC_STS_DONE_POS		1
@@ -24,9 +34,16 @@
 #define DDC_STS_RXR_POS			3
 #define DDC_STS_TXD_POS			4
 #define DDC_STS_RXD_POS			5
+#define DDC_STS_ERR_POS			8
+#define DDC_STS_CLKT_POS		9
 #define DDC_STS_DONE_BITS		1
 #define DDC_STS_TXW_BITS		1
 #define DDC_STS_RXR_BITS		1
 #define DDC_STS_TXD_BITS		1
 #define DDC_STS_RXD_BITS		1
+#define DDC_STS_ERR_BITS		1
+#define DDC_STS_CLKT_BITS		1
+
+int	ddc_init();
+int	ddc_read(uint8_t addr, uint8_t offset, uint8_t *buf, int len);
 #endif
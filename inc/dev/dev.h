@@ -9,4 +9,5 @@
 #include <sys/mmu.h>
 
 int	dev_map_io(pa_t pa, size_t size, va_t *out);
+int	dev_alloc_mem(int num_mbs, va_t *va, pa_t *pa);
 #endif
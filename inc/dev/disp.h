@@ -0,0 +1,102 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright (c) 2021 Amol Surati
+
+#ifndef DEV_DISP_H
+#define DEV_DISP_H
+
+#include <stdint.h>
+
+#include <sys/mmu.h>
+
+#define DISP_MAX_BUFS			3
+#define DISP_NUM_PLANES			4	// Overlays.
+
+enum disp_fmt {
+	DISP_FMT_XRGB8888,
+	DISP_FMT_ARGB8888,	// Premultiplied alpha.
+	DISP_FMT_RGB565,
+	DISP_FMT_NUM,
+};
+
+// A scanout buffer, as handed to the producer. The pixels are ARGB32; the
+// pitch is in bytes. The cpu maps the buffer cacheable; the producer must
+// clean its cpu writes from the data cache before it flips the buffer.
+struct disp_buf {
+	int				index;
+	void				*va;
+	pa_t				pa;
+	uint32_t			width;
+	uint32_t			height;
+	uint32_t			pitch;
+};
+
+// An overlay plane, which the HVS composes above the scanout buffer. The
+// source, of src_width x src_height pixels at pa, is shown at (x, y) on the
+// screen, scaled to width x height. An unscaled plane may lie partly off
+// the screen; a scaled one must lie within it, and shrink by at most 2/3.
+// alpha is the opacity of the whole plane; 0xff is opaque. Planes of a
+// higher z are above those of a lower z. The HVS reads the source behind
+// the cpu's caches; the cpu writes to it must be cleaned from the data cache
+// before the plane is set, or committed.
+struct disp_plane {
+	pa_t				pa;
+	uint32_t			pitch;		// In bytes.
+	enum disp_fmt			fmt;
+	uint32_t			src_width;
+	uint32_t			src_height;
+	int32_t				x;
+	int32_t				y;
+	uint32_t			width;
+	uint32_t			height;
+	uint8_t				alpha;
+	int				z;
+};
+
+// A video mode. The horizontal timings are in pixels, the vertical ones in
+// lines. A polarity is 1 if positive, -1 if negative. vic is the CEA-861
+// Video ID Code, or 0. pclk, the pixel clock, is in kHz.
+struct disp_mode {
+	uint32_t			hap;	// Active Pixels
+	uint32_t			hfp;	// Front Porch
+	uint32_t			hsw;	// HSync Width
+	uint32_t			hbp;	// Back Porch
+	uint32_t			val;	// Active Lines
+	uint32_t			vfp;	// Front Porch
+	uint32_t			vsw;	// VSync Width
+	uint32_t			vbp;	// Back Porch
+
+	int				hsp;	// HSync Polarity
+	int				vsp;	// VSync Polarity
+	int				vic;
+	uint32_t			pclk;
+};
+
+// The frame timing, as of the last vblank. The times are in microseconds
+// of the system timer. A vblank is the start of the vertical front porch;
+// the frame just scanned out is complete.
+struct disp_timing {
+	uint32_t			frame;		// Vblanks since disp_config.
+	uint32_t			ts;		// Of the last vblank.
+	uint32_t			period;		// Of a frame, per the mode.
+	uint32_t			num_flips;	// Flips which were shown.
+	uint32_t			num_missed;	// Frames a flip was late by.
+	uint32_t			num_lost;	// Vblanks the irq missed.
+};
+
+// Called at IPL_SCHED, once per vblank, after the flips are retired. The
+// next flip made from here, or soon after, shows in the next frame.
+typedef void fn_disp_vblank(const struct disp_timing *t, void *p);
+
+int	disp_init();
+int	disp_set_num_bufs(int num);
+int	disp_get_edid_mode(struct disp_mode *out);
+int	disp_config(const struct disp_mode *mode);
+int	disp_get_mode(struct disp_mode *out);
+int	disp_acquire_buf(struct disp_buf *out);
+int	disp_flip(const struct disp_buf *b);
+int	disp_set_plane(int id, const struct disp_plane *p);
+int	disp_commit();
+void	disp_get_timing(struct disp_timing *out);
+int	disp_wait_vblank(struct disp_timing *out);
+void	disp_set_vblank_fn(fn_disp_vblank *fn, void *p);
+#endif
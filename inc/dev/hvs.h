@@ -4,11 +4,16 @@
 #ifndef DEV_HVS_H
 #define DEV_HVS_H
 
+#include <stdint.h>
+
 #include <sys/bits.h>
 
 #define HVS_DL0				(0x20 >> 2)
 #define HVS_DL1				(0x24 >> 2)
 #define HVS_DL2				(0x28 >> 2)
+#define HVS_DL0_ACT			(0x30 >> 2)
+#define HVS_DL1_ACT			(0x34 >> 2)
+#define HVS_DL2_ACT			(0x38 >> 2)
 #define HVS_DL1_CTRL			(0x50 >> 2)
 #define HVS_DL2_CTRL			(0x60 >> 2)
 
@@ -38,7 +43,11 @@
 #define HVS_DLW_CTL0_VALID_BITS		1
 #define HVS_DLW_CTL0_END_BITS		1
 
+#define HVS_DLW_POS0_START_X_POS	0
+#define HVS_DLW_POS0_START_Y_POS	12
 #define HVS_DLW_POS0_FIXED_ALPHA_POS	24
+#define HVS_DLW_POS0_START_X_BITS	12
+#define HVS_DLW_POS0_START_Y_BITS	12
 #define HVS_DLW_POS0_FIXED_ALPHA_BITS	8
 
 #define HVS_DLW_POS1_SCL_WIDTH_POS	0
@@ -48,9 +57,13 @@
 
 #define HVS_DLW_POS2_SRC_WIDTH_POS	0
 #define HVS_DLW_POS2_SRC_HEIGHT_POS	16
+#define HVS_DLW_POS2_ALPHA_MIX_POS	28
+#define HVS_DLW_POS2_ALPHA_PREMULT_POS	29
 #define HVS_DLW_POS2_ALPHA_MODE_POS	30
 #define HVS_DLW_POS2_SRC_WIDTH_BITS	12
 #define HVS_DLW_POS2_SRC_HEIGHT_BITS	12
+#define HVS_DLW_POS2_ALPHA_MIX_BITS	1
+#define HVS_DLW_POS2_ALPHA_PREMULT_BITS	1
 #define HVS_DLW_POS2_ALPHA_MODE_BITS	2
 
 #define HVS_DLW_PPF_IPHASE_POS		0
@@ -59,4 +72,74 @@
 #define HVS_DLW_PPF_IPHASE_BITS		7
 #define HVS_DLW_PPF_SCALE_BITS		17
 #define HVS_DLW_PPF_AGC_BITS		1
+
+#define HVS_DLW_ALPHA_MODE_PIPELINE	0
+#define HVS_DLW_ALPHA_MODE_FIXED	1
+
+#define HVS_PLANE_MAX_DIM		4095
+#define HVS_PLANE_MAX_NUM_WORDS		14	// A scaled plane.
+#define HVS_PPF_KERNEL_NUM_WORDS	11
+#define HVS_LBM_SIZE			(48 * 1024)
+#define HVS_LBM_CHAN2_START		(32 * 1024)	// Channel 1 below.
+
+// The dlist memory, of 4096 words, starts at 0x2000 into the HVS registers.
+#define HVS_DL_MEM_INDEX		(0x2000 >> 2)
+#define HVS_DL_MEM_NUM_WORDS		0x1000
+#define HVS_CHAN_MAX_REGIONS		3
+
+struct disp_plane;
+
+// The display lists of a channel, each in a region of the dlist memory. The
+// HVS runs the front list, and latches the queued one, if any, at the start
+// of a frame. A new list is written into a region which is neither, so that
+// neither the list on the screen nor the one about to be, is torn. Two
+// regions suffice if a list is queued only while none is; three let the
+// queued list be replaced at any time.
+struct hvs_chan {
+	int				index;	// 0, 1 or 2.
+	int				num_regions;
+	int				num_words;	// Per region.
+	uint32_t			regions[HVS_CHAN_MAX_REGIONS];
+	int				front;
+	int				queued;
+	uint32_t			lbm_start;
+	uint32_t			lbm_size;
+};
+
+// A display list being written into a region of a channel. Each plane
+// which is scaled takes a part of the line buffer memory (LBM) of the
+// channel, from lbm on.
+struct hvs_dlist {
+	volatile uint32_t		*words;
+	int				num_words;
+	int				max_words;
+	uint32_t			scr_width;
+	uint32_t			scr_height;
+	uint32_t			lbm;
+	uint32_t			lbm_end;
+	uint32_t			ppfk;	// The index of the kernel.
+};
+
+extern const uint32_t g_hvs_ppf_kernel[HVS_PPF_KERNEL_NUM_WORDS];
+
+int	hvs_init();
+int	hvs_dlm_alloc(int num_words, uint32_t *out);
+void	hvs_dlm_free(uint32_t index, int num_words);
+int	hvs_get_kernel(const uint32_t *words, uint32_t *out);
+void	hvs_put_kernel(uint32_t index);
+int	hvs_chan_init(struct hvs_chan *c, int index, int num_regions,
+		      int num_words);
+void	hvs_chan_fini(struct hvs_chan *c);
+volatile uint32_t	*hvs_chan_get_region(const struct hvs_chan *c, int r);
+int	hvs_chan_get_back(const struct hvs_chan *c);
+int	hvs_chan_queue(struct hvs_chan *c, int r);
+int	hvs_chan_is_active(const struct hvs_chan *c, int r);
+uint32_t	hvs_chan_get_lbm_size(int index);
+int	hvs_check_plane(const struct disp_plane *p, uint32_t scr_width,
+			uint32_t scr_height);
+uint32_t	hvs_plane_lbm_size(const struct disp_plane *p);
+void	hvs_dlist_init(struct hvs_dlist *d, const struct hvs_chan *c, int r,
+		       uint32_t scr_width, uint32_t scr_height, uint32_t ppfk);
+int	hvs_dlist_add_plane(struct hvs_dlist *d, const struct disp_plane *p);
+int	hvs_dlist_end(struct hvs_dlist *d);
 #endif
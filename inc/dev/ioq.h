@@ -4,14 +4,24 @@
 #ifndef DEV_IOQ_H
 #define DEV_IOQ_H
 
+#include <sys/completion.h>
 #include <sys/list.h>
 #include <sys/mmu.h>
 #include <sys/spinlock.h>
 
 struct ior;
 typedef int fn_ioq_handler(struct ior *ior);
+typedef void fn_ior_cb(struct ior *ior, void *cb_param);
+typedef int fn_ioq_match(const struct ior *ior, void *p);
 struct ioq {
+	// Queued, and yet to be handed to the device.
 	struct list_head		ior_head;
+
+	// With the device.
+	struct list_head		busy_head;
+	int				num_busy;
+	int				max_busy;
+
 	struct spin_lock		lock;
 	fn_ioq_handler			*req;
 	fn_ioq_handler			*res;
@@ -24,6 +34,9 @@ struct ior {
 	int				ret;
 	void				*param;
 	pa_t				param_pa;
+	struct completion		done;
+	fn_ior_cb			*cb;
+	void				*cb_param;
 };
 
 static inline
@@ -51,9 +64,13 @@ void *ior_param(const struct ior *ior)
 }
 
 void	ioq_init(struct ioq *ioq, fn_ioq_handler *req, fn_ioq_handler *res);
+void	ioq_set_depth(struct ioq *ioq, int max_busy);
 void	ior_init(struct ior *ior, struct ioq *ioq, int cmd, void *param,
 		 pa_t pa);
+void	ior_set_cb(struct ior *ior, fn_ior_cb *cb, void *cb_param);
 int	ior_wait(struct ior *ior);
 int	ioq_queue_ior(struct ior *ior);
+void	ioq_queue_iors(struct ior **iors, int num);
 int	ioq_complete_ior(struct ioq *ioq);
+int	ioq_complete_ior_match(struct ioq *ioq, fn_ioq_match *match, void *p);
 #endif
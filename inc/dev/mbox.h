@@ -4,9 +4,179 @@
 #ifndef DEV_MBOX_H
 #define DEV_MBOX_H
 
+#include <stddef.h>
+#include <stdint.h>
+
 #include <sys/mmu.h>
 
+#define MBOX_TAG_GET_FW_REV		0x00001
+#define MBOX_TAG_GET_BOARD_REV		0x10002
+#define MBOX_TAG_GET_ARM_MEM		0x10005
+#define MBOX_TAG_GET_VC_MEM		0x10006
+#define MBOX_TAG_GET_CLK_RATE		0x30002
+#define MBOX_TAG_SET_DOM_STATE		0x38030
+#define MBOX_TAG_SET_CLK_RATE		0x38002
+#define MBOX_TAG_FB_ALLOC		0x40001
+#define MBOX_TAG_FB_FREE		0x48001
+#define MBOX_TAG_FB_SET_DIM		0x48003
+#define MBOX_TAG_FB_SET_VDIM		0x48004
+#define MBOX_TAG_FB_SET_DEPTH		0x48005
+
+#define MBOX_CLK_EMMC			1
+#define MBOX_CLK_UART			2
+#define MBOX_CLK_ARM			3
+#define MBOX_CLK_CORE			4
+#define MBOX_CLK_V3D			5
+#define MBOX_CLK_PIXEL			9
+#define MBOX_NUM_CLKS			16
+
+// The value buffers of the tags. The fields are inputs before
+// mbox_buf_submit, and the firmware's outputs after it.
+struct mbox_fw_rev {
+	uint32_t			rev;
+};
+
+struct mbox_dom_state {
+	uint32_t			dom;
+	int				is_on;
+};
+
+struct mbox_clk_rate {
+	uint32_t			clk;
+	uint32_t			rate;
+	uint32_t			skip_turbo;
+};
+
+struct mbox_fb_dim {
+	uint32_t			width;
+	uint32_t			height;
+};
+
+struct mbox_fb_depth {
+	uint32_t			bpp;
+};
+
+struct mbox_fb_alloc {
+	uint32_t			base;
+	uint32_t			size;
+};
+
+// A property message, built up with tags, and sent in one round trip.
+struct mbox_buf {
+	void				*msg;
+	pa_t				pa;
+	size_t				size;
+	size_t				used;
+	int				err;
+};
+
+int	mbox_buf_init(struct mbox_buf *b, size_t size);
+void	mbox_buf_fini(struct mbox_buf *b);
+void	*mbox_buf_add(struct mbox_buf *b, uint32_t id, size_t size);
+int	mbox_buf_submit(struct mbox_buf *b);
+
+// The typed tags return NULL if the buffer is out of space; the error is
+// then returned by mbox_buf_submit.
+static inline
+struct mbox_fw_rev *mbox_buf_get_fw_rev(struct mbox_buf *b)
+{
+	return mbox_buf_add(b, MBOX_TAG_GET_FW_REV, sizeof(struct mbox_fw_rev));
+}
+
+static inline
+struct mbox_dom_state *mbox_buf_set_dom_state(struct mbox_buf *b, int dom,
+					      int is_on)
+{
+	struct mbox_dom_state *p;
+
+	p = mbox_buf_add(b, MBOX_TAG_SET_DOM_STATE, sizeof(*p));
+	if (p) {
+		p->dom = dom;
+		p->is_on = !!is_on;
+	}
+	return p;
+}
+
+static inline
+struct mbox_clk_rate *mbox_buf_get_clk_rate(struct mbox_buf *b, int clk)
+{
+	struct mbox_clk_rate *p;
+
+	p = mbox_buf_add(b, MBOX_TAG_GET_CLK_RATE, sizeof(*p));
+	if (p)
+		p->clk = clk;
+	return p;
+}
+
+static inline
+struct mbox_clk_rate *mbox_buf_set_clk_rate(struct mbox_buf *b, int clk,
+					    uint32_t rate)
+{
+	struct mbox_clk_rate *p;
+
+	p = mbox_buf_add(b, MBOX_TAG_SET_CLK_RATE, sizeof(*p));
+	if (p) {
+		p->clk = clk;
+		p->rate = rate;
+	}
+	return p;
+}
+
+static inline
+struct mbox_fb_dim *mbox_buf_fb_set_dim(struct mbox_buf *b, uint32_t id,
+					uint32_t width, uint32_t height)
+{
+	struct mbox_fb_dim *p;
+
+	p = mbox_buf_add(b, id, sizeof(*p));
+	if (p) {
+		p->width = width;
+		p->height = height;
+	}
+	return p;
+}
+
+static inline
+struct mbox_fb_depth *mbox_buf_fb_set_depth(struct mbox_buf *b, uint32_t bpp)
+{
+	struct mbox_fb_depth *p;
+
+	p = mbox_buf_add(b, MBOX_TAG_FB_SET_DEPTH, sizeof(*p));
+	if (p)
+		p->bpp = bpp;
+	return p;
+}
+
+static inline
+struct mbox_fb_alloc *mbox_buf_fb_alloc(struct mbox_buf *b, uint32_t align)
+{
+	struct mbox_fb_alloc *p;
+
+	p = mbox_buf_add(b, MBOX_TAG_FB_ALLOC, sizeof(*p));
+	if (p)
+		p->base = align;
+	return p;
+}
+
+static inline
+struct mbox_fb_alloc *mbox_buf_fb_free(struct mbox_buf *b, uint32_t base)
+{
+	struct mbox_fb_alloc *p;
+
+	p = mbox_buf_add(b, MBOX_TAG_FB_FREE, sizeof(p->base));
+	if (p)
+		p->base = base;
+	return p;
+}
+
+// The getters below are answered from a cache after their first call.
 int	mbox_get_fw_rev(int *out);
+int	mbox_get_board_rev(uint32_t *out);
+int	mbox_get_arm_mem(pa_t *out_base, size_t *out_size);
+int	mbox_get_vc_mem(pa_t *out_base, size_t *out_size);
+int	mbox_get_clk_rate(int clk, uint32_t *out);
+int	mbox_set_clk_rate(int clk, uint32_t rate);
+void	mbox_invalidate_clk_rate(int clk);
 int	mbox_set_dom_state(int dom, int is_on);
 int	mbox_alloc_fb(pa_t *out_base, size_t *out_size);
 int	mbox_free_fb(pa_t base);
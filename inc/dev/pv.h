@@ -56,4 +56,9 @@
 #define PV_VERTB_VAL_BITS		16
 #define PV_VERTB_VFP_BITS		16
 
+// PV_INT_EN and PV_INT_STAT. Writing 1s to PV_INT_STAT clears the bits.
+#define PV_INT_VFP_START_POS		7
+#define PV_INT_VFP_START_BITS		1
+#define PV_INT_ALL			0x3ff
+
 #endif
@@ -6,5 +6,13 @@
 
 #include <stdint.h>
 
+// Called from the FIQ handler, on cpu0, once the counter matches. It runs
+// outside of the IPLs, and must not take locks; it can hand work off with
+// cpu_raise_sw_irq_fiq. The alarms of tmr_set_irq_alarm are called instead
+// from the IRQ handler, at IPL_HARD.
+typedef void fn_tmr_alarm(void *p);
+
 uint32_t	tmr_get_ctr();
+void		tmr_set_alarm(uint32_t ctr, fn_tmr_alarm *fn, void *p);
+void		tmr_set_irq_alarm(uint32_t ctr, fn_tmr_alarm *fn, void *p);
 #endif
@@ -4,7 +4,13 @@
 #ifndef DEV_TXP_H
 #define DEV_TXP_H
 
+#include <stdint.h>
+
 #include <sys/bits.h>
+#include <sys/mmu.h>
+
+#include <dev/disp.h>
+#include <dev/ioq.h>
 
 #define TXP_DST_POINTER			(0x0 >> 2)
 #define TXP_DST_PITCH			(0x4 >> 2)
@@ -19,6 +25,7 @@
 
 #define TXP_DST_CTRL_GO_POS		0
 #define TXP_DST_CTRL_BUSY_POS		1
+#define TXP_DST_CTRL_EI_POS		2
 #define TXP_DST_CTRL_FMT_POS		8
 #define TXP_DST_CTRL_BYTE_EN_POS	16
 #define TXP_DST_CTRL_ALPHA_EN_POS	20
@@ -26,9 +33,51 @@
 #define TXP_DST_CTRL_PILOT_POS		24
 #define TXP_DST_CTRL_GO_BITS		1
 #define TXP_DST_CTRL_BUSY_BITS		1
+#define TXP_DST_CTRL_EI_BITS		1
 #define TXP_DST_CTRL_FMT_BITS		4
 #define TXP_DST_CTRL_BYTE_EN_BITS	4
 #define TXP_DST_CTRL_ALPHA_EN_BITS	1
 #define TXP_DST_CTRL_VERSION_BITS	2
 #define TXP_DST_CTRL_PILOT_BITS		8
+
+#define TXP_NUM_BUFS			2
+#define TXP_BUF_NUM_MBS			8	// 1920x1080, 32bpp.
+
+// An output buffer, of the pool. The TXP writes it behind the data cache;
+// the cpu invalidates the lines it reads.
+struct txp_buf {
+	int				index;
+	void				*va;
+	pa_t				pa;
+	uint32_t			width;
+	uint32_t			height;
+	uint32_t			pitch;		// In bytes.
+	enum disp_fmt			fmt;
+};
+
+struct txp_job;
+typedef void fn_txp_done(struct txp_job *j, void *p);
+
+// Scale, or convert the format of, the source, through HVS channel 2, into
+// an output buffer of fmt, of src.width x src.height pixels. src.x and
+// src.y are ignored. The memory of a job belongs to the caller until the job
+// completes.
+struct txp_job {
+	struct ior			ior;
+	struct disp_plane		src;
+	enum disp_fmt			fmt;
+	uint32_t			ppfk;
+	struct txp_buf			*out;
+	fn_txp_done			*cb;
+	void				*cb_param;
+};
+
+int	txp_init();
+int	txp_job_init(struct txp_job *j, const struct disp_plane *src,
+		     enum disp_fmt fmt, const uint32_t *kernel);
+void	txp_job_fini(struct txp_job *j);
+void	txp_job_set_cb(struct txp_job *j, fn_txp_done *cb, void *p);
+int	txp_submit(struct txp_job *j);
+int	txp_wait(struct txp_job *j);
+void	txp_put_buf(struct txp_buf *b);
 #endif
@@ -51,6 +51,11 @@
 #define V3D_VPACNTL			(0x500 >> 2)
 #define V3D_VPMBASE			(0x504 >> 2)
 
+#define V3D_PCTRC			(0x670 >> 2)
+#define V3D_PCTRE			(0x674 >> 2)
+#define V3D_PCTR(i)			((0x680 >> 2) + (i) * 2)
+#define V3D_PCTRS(i)			((0x684 >> 2) + (i) * 2)
+
 #define V3D_DBCFG			(0xe00 >> 2)
 #define V3D_DBQITE			(0xe2c >> 2)
 #define V3D_DBQITC			(0xe30 >> 2)
@@ -70,6 +75,11 @@
 #define V3D_SRQCS_NUM_DONE_POS		16
 #define V3D_SRQCS_NUM_DONE_BITS		8
 
+#define V3D_PCTRE_EN_POS		31
+#define V3D_PCTRE_EN_BITS		1
+
+#define V3D_NUM_PCTRS			16
+
 // VDR: Read from system RAM into VPM.
 // VPITCH = VPM Pitch
 // MPITCH = Memory Pitch
@@ -304,6 +314,59 @@ struct v3dcr_store_mstcb {
 	uint8_t				id;		// 24; 25 with EOF
 } __attribute__((packed));
 
+// The sources of the performance counters.
+enum v3d_pctr_src {
+	V3D_PCTR_FEP_PRIMS_NO_PIXELS,
+	V3D_PCTR_FEP_PRIMS,
+	V3D_PCTR_FEP_QUADS_CLIPPED,
+	V3D_PCTR_FEP_QUADS,
+	V3D_PCTR_TLB_QUADS_NO_STENCIL,
+	V3D_PCTR_TLB_QUADS_NO_Z_STENCIL,
+	V3D_PCTR_TLB_QUADS_Z_STENCIL,
+	V3D_PCTR_TLB_QUADS_NO_COVERAGE,
+	V3D_PCTR_TLB_QUADS_COVERAGE,
+	V3D_PCTR_TLB_QUADS_WRITTEN,
+	V3D_PCTR_PTB_PRIMS_OUTSIDE,
+	V3D_PCTR_PTB_PRIMS_CLIPPED,
+	V3D_PCTR_PSE_PRIMS_REVERSED,
+	V3D_PCTR_QPU_CYCLES_IDLE,
+	V3D_PCTR_QPU_CYCLES_VERTEX,
+	V3D_PCTR_QPU_CYCLES_FRAGMENT,
+	V3D_PCTR_QPU_CYCLES_VALID,
+	V3D_PCTR_QPU_STALLS_TMU,
+	V3D_PCTR_QPU_STALLS_SCOREBOARD,
+	V3D_PCTR_QPU_STALLS_VARYINGS,
+	V3D_PCTR_QPU_ICACHE_HITS,
+	V3D_PCTR_QPU_ICACHE_MISSES,
+	V3D_PCTR_QPU_UCACHE_HITS,
+	V3D_PCTR_QPU_UCACHE_MISSES,
+	V3D_PCTR_TMU_QUADS,
+	V3D_PCTR_TMU_CACHE_MISSES,
+	V3D_PCTR_VPM_VDW_STALLS,
+	V3D_PCTR_VPM_VCD_STALLS,
+	V3D_PCTR_L2C_HITS,
+	V3D_PCTR_L2C_MISSES,
+	V3D_NUM_PCTR_SRCS,
+};
+
+enum v3d_job {
+	V3D_JOB_PROG,
+	V3D_JOB_BINNER,
+	V3D_JOB_RENDERER,
+	V3D_NUM_JOBS,
+};
+
+// The counts of the selected sources, and the time taken, for one job.
+struct v3d_job_stats {
+	uint32_t			usecs;
+	int				num_srcs;
+	enum v3d_pctr_src		srcs[V3D_NUM_PCTRS];
+	uint32_t			counts[V3D_NUM_PCTRS];
+};
+
+int	v3d_pctr_select(const enum v3d_pctr_src *srcs, int num_srcs);
+int	v3d_get_job_stats(enum v3d_job job, struct v3d_job_stats *out);
+void	v3d_print_job_stats(const char *name, const struct v3d_job_stats *s);
 int	v3d_run_prog(ba_t code_ba, ba_t unif_ba, size_t unif_size);
 void	v3d_run_binner(ba_t cr, size_t size);
 void	v3d_run_renderer(ba_t cr, size_t size);
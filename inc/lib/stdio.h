@@ -6,8 +6,10 @@
 
 #include <stdarg.h>
 #include <stddef.h>
+#include <stdint.h>
 
 int	printf(const char *fmt, ...);
 int	snprintf(char *str, size_t size, const char *fmt, ...);
 int	vsnprintf(char *str, size_t size, const char *fmt, va_list ap);
+int	u64toan(uint64_t val, char *str, size_t size, int radix);
 #endif
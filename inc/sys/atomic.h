@@ -0,0 +1,88 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright (c) 2021 Amol Surati
+
+#ifndef SYS_ATOMIC_H
+#define SYS_ATOMIC_H
+
+// LDREX/STREX based primitives. ARMv6K and later support them on words.
+// These functions do not provide any ordering; the callers issue dmb()
+// where required.
+
+static inline
+int atomic_xchg(int *p, int val)
+{
+	int old, fail;
+
+	do {
+		__asm volatile ("ldrex	%0, [%2]\n\t"
+				"strex	%1, %3, [%2]"
+				: "=&r"(old), "=&r"(fail)
+				: "r"(p), "r"(val)
+				: "memory");
+	} while (fail);
+	return old;
+}
+
+// Returns the value found at p. The store happened only if that value
+// equals old.
+static inline
+int atomic_cmpxchg(int *p, int old, int val)
+{
+	int curr, fail;
+
+	do {
+		__asm volatile ("ldrex	%0, [%1]" : "=&r"(curr) : "r"(p)
+				: "memory");
+		if (curr != old) {
+			__asm volatile ("clrex" ::: "memory");
+			break;
+		}
+		__asm volatile ("strex	%0, %2, [%1]"
+				: "=&r"(fail)
+				: "r"(p), "r"(val)
+				: "memory");
+	} while (fail);
+	return curr;
+}
+
+// Returns the new value.
+static inline
+int atomic_add(int *p, int val)
+{
+	int res, fail;
+
+	do {
+		__asm volatile ("ldrex	%0, [%2]\n\t"
+				"add	%0, %0, %3\n\t"
+				"strex	%1, %0, [%2]"
+				: "=&r"(res), "=&r"(fail)
+				: "r"(p), "r"(val)
+				: "memory");
+	} while (fail);
+	return res;
+}
+
+static inline
+int atomic_read(const int *p)
+{
+	return *(const volatile int *)p;
+}
+
+static inline
+void atomic_write(int *p, int val)
+{
+	*(volatile int *)p = val;
+}
+
+static inline
+void cpu_wfe()
+{
+	__asm volatile ("wfe" ::: "memory");
+}
+
+static inline
+void cpu_sev()
+{
+	__asm volatile ("sev" ::: "memory");
+}
+#endif
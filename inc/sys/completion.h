@@ -0,0 +1,22 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright (c) 2021 Amol Surati
+
+#ifndef SYS_COMPLETION_H
+#define SYS_COMPLETION_H
+
+#include <sys/list.h>
+#include <sys/spinlock.h>
+
+// A one-shot event. Once signalled, it stays done until it is reset.
+struct completion {
+	int				done;
+	struct spin_lock		lock;
+	struct list_head		wait_queue;
+};
+
+void	completion_init(struct completion *c);
+void	completion_reset(struct completion *c);
+int	completion_is_done(struct completion *c);
+void	completion_wait(struct completion *c);
+void	completion_signal(struct completion *c);
+#endif
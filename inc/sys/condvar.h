@@ -11,11 +11,13 @@
 struct cond_var {
 	struct spin_lock		state_lock;
 	struct list_head		wait_queue;
-	int				signalled;
-	int				num_waiters;
+
+	// The mutex the waiters hold around cond_var_wait.
+	struct mutex			*lock;
 };
 
 void	cond_var_init(struct cond_var *v);
 void	cond_var_wait(struct cond_var *v, struct mutex *lock);
 void	cond_var_signal(struct cond_var *v);
+void	cond_var_broadcast(struct cond_var *v);
 #endif
@@ -0,0 +1,32 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright (c) 2021 Amol Surati
+
+#ifndef SYS_CPU_S_H
+#define SYS_CPU_S_H
+
+#define PSR_MODE_FIQ			0x11
+#define PSR_MODE_SVC			0x13
+#define PSR_MODE_HYP			0x1a
+#define PSR_MODE_MASK			0x1f
+#define PSR_AIF				0x1c0
+
+#if defined(__ASSEMBLER__)
+// The Pi 2 firmware enters the kernel, and releases the secondary cores, in
+// HYP mode. Switch to SVC mode with A, I and F masked. Clobbers r0, r1.
+.macro		leave_hyp
+#if __ARM_ARCH >= 7
+	mrs	r0, cpsr
+	and	r1, r0, #PSR_MODE_MASK
+	cmp	r1, #PSR_MODE_HYP
+	bne	1f
+	bic	r0, r0, #PSR_MODE_MASK
+	orr	r0, r0, #(PSR_MODE_SVC | PSR_AIF)
+	msr	spsr_hyp, r0
+	adr	r1, 1f
+	msr	elr_hyp, r1
+	eret
+1:
+#endif
+.endm
+#endif
+#endif
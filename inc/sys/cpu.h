@@ -8,17 +8,40 @@
 
 #include <sys/bits.h>
 #include <sys/list.h>
+#include <sys/mach.h>
 #include <sys/mmu.h>
 
 typedef void fn_irqh();
 
+// Pending IRQs are dispatched in this order, the first one first.
 enum irq {
+	IRQ_PV2,		// Bank 2, IRQ 42
 	IRQ_ARM_MAILBOX,	// Bank 0, IRQ 1
 	IRQ_TIMER3,		// Bank 1, IRQ 3
+	IRQ_TIMER1,		// Bank 1, IRQ 1
 	IRQ_VC_3D,		// Bank 1, IRQ 10
+	IRQ_TXP,		// Bank 1, IRQ 11
+	IRQ_I2C,		// Bank 2, IRQ 53
+	IRQ_UART,		// Bank 2, IRQ 57
 	NUM_IRQS,
 };
 
+// One handler on the chain of an IRQ. An IRQ can be shared; its chain runs
+// in the order of prio, lowest first. A handler of a shared IRQ must
+// tolerate being called when its device has nothing pending. Handlers are
+// never removed; the memory must remain valid.
+struct irqh {
+	fn_irqh				*hw;
+	fn_irqh				*sw;
+	int				prio;
+	struct irqh			*next;
+};
+
+struct irq_stats {
+	uint32_t			num_hw;
+	uint32_t			num_sw;
+};
+
 enum ipl {
 	IPL_HARD,
 	IPL_SCHED,
@@ -28,7 +51,9 @@ enum ipl {
 // 8-word cache line length.
 #define CACHE_LINE_SIZE			32
 
+#define PSR_F_POS			6
 #define PSR_I_POS			7
+#define PSR_F_BITS			1
 #define PSR_I_BITS			1
 
 #define TTBR_C_POS			0
@@ -60,7 +85,23 @@ enum ipl {
 
 typedef uint32_t			reg_t;
 
+// Inter-processor interrupts. Each is a bit in the target's mailbox 0.
+enum ipi {
+	IPI_RESCHED,
+	NUM_IPIS,
+};
+
+// Keep the layout in sync with g_cpu_boot users in sys/smp.S.
+struct cpu_boot {
+	reg_t				ttbr;
+	reg_t				sp;
+	struct cpu			*cpu;
+};
+
 struct thread;
+struct tasklet;
+// The rq_lock is a struct spin_lock; sys/spinlock.h includes this file, so
+// it cannot be embedded here by type. Use the cpu_rq_* functions.
 struct cpu {
 	struct list_head		ready_queue;
 	struct list_head		entry;
@@ -70,6 +111,16 @@ struct cpu {
 	reg_t				hw_id;
 	char				index;
 	char				online;
+	int				rq_lock;
+	int				num_ready;
+	uint32_t			sw_irq_mask;
+
+	// Set from the FIQ handler, which IRQ masking does not hold off.
+	int				fiq_sw_irq_mask;
+
+	// The FIFO of scheduled tasklets. Touched only with IRQs disabled.
+	struct tasklet			*tasklet_head;
+	struct tasklet			**tasklet_tail;
 };
 
 static inline
@@ -98,10 +149,16 @@ void dc_iall()
 	__asm volatile ("mcr	p15, 0, %0, c7, c6, 0" :: "r"(0) : "memory");
 }
 
+// ARMv7 removed the invalidate-both-caches operation. The Cortex-A7 data
+// caches are invalidated by the hardware on reset.
 static inline
 void icdc_iall()
 {
+#if __ARM_ARCH >= 7
+	ic_iall();
+#else
 	__asm volatile ("mcr	p15, 0, %0, c7, c7, 0" :: "r"(0) : "memory");
+#endif
 }
 
 static inline
@@ -186,6 +243,25 @@ void mcr_vbar(reg_t val)
 	__asm volatile ("mcr	p15, 0, %0, c12, c0, 0" :: "r"(val));
 }
 
+#if __ARM_ARCH >= 7
+static inline
+void dmb()
+{
+	__asm volatile ("dmb	ish" ::: "memory");
+}
+
+static inline
+void dsb()
+{
+	__asm volatile ("dsb	sy" ::: "memory");
+}
+
+static inline
+void isb()
+{
+	__asm volatile ("isb	sy" ::: "memory");
+}
+#else
 static inline
 void dmb()
 {
@@ -202,9 +278,30 @@ static inline
 void isb()
 {
 	__asm volatile ("mcr	p15, 0, %0, c7, c5, 4" :: "r"(0) : "memory");
+}
+#endif
+
+// Invalidate the branch predictor. Needed after code, or its mapping,
+// changes; follow with an isb.
+static inline
+void bp_iall()
+{
 	__asm volatile ("mcr	p15, 0, %0, c7, c5, 6" :: "r"(0) : "memory");
 }
 
+// Multiprocessor Affinity Register. Reads as 0 on uniprocessors.
+static inline
+reg_t mrc_mpidr()
+{
+#if NUM_CPUS > 1
+	reg_t val;
+	__asm volatile ("mrc	p15, 0, %0, c0, c0, 5" : "=r"(val));
+	return val & 3;
+#else
+	return 0;
+#endif
+}
+
 static inline
 void cpu_set(const void *cpu)
 {
@@ -274,8 +371,30 @@ int cpu_enable_irq(enum irq irq)
 	return intc_enable_irq(irq);
 }
 
+static inline
+void cpu_send_ipi(int index, enum ipi ipi)
+{
+#if NUM_CPUS > 1
+	void	intc_send_ipi(int index, enum ipi ipi);
+	intc_send_ipi(index, ipi);
+#else
+	(void)index;
+	(void)ipi;
+#endif
+}
+
 enum ipl	cpu_raise_ipl(enum ipl ipl, reg_t *irq_mask);
 enum ipl	cpu_lower_ipl(enum ipl ipl, reg_t irq_mask);
 void		cpu_register_irqh(enum irq irq, fn_irqh *hw, fn_irqh *sw);
+void		cpu_add_irqh(enum irq irq, struct irqh *h);
+void		cpu_get_irq_stats(enum irq irq, struct irq_stats *out);
+int		cpu_set_fiqh(enum irq irq, fn_irqh *fn);
+void		cpu_clear_fiqh();
+void		cpu_raise_sw_irq_fiq(enum irq irq);
 void		cpu_raise_sw_irq(enum irq irq);
+struct cpu	*cpu_get_by_index(int index);
+void		cpu_rq_lock(struct cpu *cpu);
+void		cpu_rq_unlock(struct cpu *cpu);
+void		cpu_idle_wait();
+int		cpu_start_secondaries();
 #endif
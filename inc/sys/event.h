@@ -0,0 +1,28 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright (c) 2021 Amol Surati
+
+#ifndef SYS_EVENT_H
+#define SYS_EVENT_H
+
+#include <stdint.h>
+
+#include <sys/list.h>
+#include <sys/spinlock.h>
+
+// event_wait options.
+#define EVENT_WAIT_ALL			(1 << 0)
+#define EVENT_WAIT_CLEAR		(1 << 1)
+
+// A group of 32 event flags.
+struct event {
+	uint32_t			flags;
+	struct spin_lock		lock;
+	struct list_head		wait_queue;
+};
+
+void		event_init(struct event *e);
+void		event_set(struct event *e, uint32_t mask);
+void		event_clear(struct event *e, uint32_t mask);
+uint32_t	event_get(struct event *e);
+uint32_t	event_wait(struct event *e, uint32_t mask, int opts);
+#endif
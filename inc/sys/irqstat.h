@@ -0,0 +1,32 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright (c) 2021 Amol Surati
+
+#ifndef SYS_IRQSTAT_H
+#define SYS_IRQSTAT_H
+
+#include <stdint.h>
+
+#include <sys/cpu.h>
+
+// The samples are in cpu cycles. Bucket n counts the samples in
+// [2^n, 2^(n + 1)); bucket 0 also counts the samples of 0 cycles.
+#define IRQSTAT_NUM_BUCKETS		32
+
+struct irqstat_hist {
+	uint32_t			counts[IRQSTAT_NUM_BUCKETS];
+	uint32_t			max;
+};
+
+// The latency of an IRQ runs from the cpu taking the IRQ exception to its
+// handlers starting; it includes the handlers of the IRQs dispatched
+// before it. The time an IRQ waited while the cpu had IRQs disabled is
+// bounded by the longest IRQs-off window.
+void	irqstat_irq(enum irq irq, uint32_t entry, uint32_t start, uint32_t end);
+void	irqstat_irqs_off(void *site);
+void	irqstat_irqs_on();
+void	irqstat_get_irq(enum irq irq, struct irqstat_hist *lat,
+			struct irqstat_hist *dur);
+void	irqstat_get_irqs_off(int cpu, struct irqstat_hist *out, void **site);
+void	irqstat_reset();
+void	irqstat_dump();
+#endif
@@ -0,0 +1,22 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright (c) 2021 Amol Surati
+
+#ifndef SYS_MACH_H
+#define SYS_MACH_H
+
+// Only preprocessor definitions here; the file is included from assembly
+// too. The machine is selected by mk/$(MACH).mk.
+
+#if defined(MACH_RPI2B)
+// BCM2836, quad-core Cortex-A7.
+#define NUM_CPUS			4
+#define ASM_IO_BASE			0x3f000000
+#define ASM_LOCAL_BASE			0x40000000
+#define ASM_BUS_RAM_ALIAS		0xc0000000
+#else
+// BCM2835, ARM1176JZF-S.
+#define NUM_CPUS			1
+#define ASM_IO_BASE			0x20000000
+#define ASM_BUS_RAM_ALIAS		0x40000000
+#endif
+#endif
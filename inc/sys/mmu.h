@@ -4,6 +4,7 @@
 #ifndef SYS_MMU_H
 #define SYS_MMU_H
 
+#include <sys/mach.h>
 #include <sys/mmu.S.h>
 
 #include <stdint.h>
@@ -101,7 +102,7 @@ typedef int32_t				pfn_t;
 #define PTE_BASE_BITS			16
 
 // Device base PAs.
-#define IO_BASE				0x20000000ul
+#define IO_BASE				((pa_t)ASM_IO_BASE)
 #define UART_BASE			(IO_BASE + 0x201000)
 #define INTC_BASE			(IO_BASE + 0xb200)
 #define MBOX_BASE			(IO_BASE + 0xb880)
@@ -115,6 +116,9 @@ typedef int32_t				pfn_t;
 #define HD_BASE				(IO_BASE + 0x808000)
 #define CM_BASE				(IO_BASE + 0x101000)
 #define DDC_BASE			(IO_BASE + 0x805000)
+#if NUM_CPUS > 1
+#define LOCAL_BASE			((pa_t)ASM_LOCAL_BASE)
+#endif
 
 #define PAGE_SIZE			(1ul << PAGE_SIZE_BITS)
 
@@ -193,7 +197,7 @@ pa_t ram_map_va_to_pa(va_t va)
 static inline
 ba_t pa_to_ba(pa_t pa)
 {
-	return pa | 0x40000000ul;
+	return pa | (ba_t)ASM_BUS_RAM_ALIAS;
 }
 
 static inline
@@ -20,4 +20,5 @@ struct mutex {
 void	mutex_init(struct mutex *m);
 void	mutex_lock(struct mutex *m);
 void	mutex_unlock(struct mutex *m);
+int	mutex_requeue(struct mutex *m, struct thread *t);
 #endif
@@ -0,0 +1,92 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright (c) 2021 Amol Surati
+
+#ifndef SYS_PERF_H
+#define SYS_PERF_H
+
+#include <stdint.h>
+
+#include <sys/cpu.h>
+
+// The events the two event counters can count. Each maps to the event
+// number of the cpu's PMU.
+enum perf_event {
+	PERF_EV_ICACHE_MISS,
+	PERF_EV_DCACHE_MISS,
+	PERF_EV_ITLB_MISS,		// Instruction micro TLB
+	PERF_EV_DTLB_MISS,		// Data micro TLB
+	PERF_EV_BRANCH_MISPRED,
+	PERF_EV_INSTR,
+	NUM_PERF_EVENTS,
+};
+
+// A snapshot of the cycle counter and of the two event counters. perf_begin
+// also notes the gen of the events the counters count.
+struct perf_sample {
+	uint32_t			cycles;
+	uint32_t			evs[2];
+	int				gen;
+};
+
+// Totals for a named region of code. Define one statically, with
+// PERF_REGION_INIT, for each region to be measured.
+struct perf_region {
+	const char			*name;
+	struct perf_region		*next;
+	char				is_listed;
+	uint32_t			num_calls;
+	uint32_t			min_cycles;
+	uint32_t			max_cycles;
+	uint64_t			cycles;
+	uint64_t			evs[2];
+};
+
+#define PERF_REGION_INIT(n)		{ .name = (n), .min_cycles = -1 }
+
+#if __ARM_ARCH >= 7
+static inline
+uint32_t perf_read_cycles()
+{
+	uint32_t val;
+	__asm volatile ("mrc	p15, 0, %0, c9, c13, 0" : "=r"(val));
+	return val;
+}
+
+static inline
+void perf_read(struct perf_sample *s)
+{
+	__asm volatile ("mrc	p15, 0, %0, c9, c13, 0" : "=r"(s->cycles));
+	__asm volatile ("mcr	p15, 0, %0, c9, c12, 5" :: "r"(0));
+	isb();
+	__asm volatile ("mrc	p15, 0, %0, c9, c13, 2" : "=r"(s->evs[0]));
+	__asm volatile ("mcr	p15, 0, %0, c9, c12, 5" :: "r"(1));
+	isb();
+	__asm volatile ("mrc	p15, 0, %0, c9, c13, 2" : "=r"(s->evs[1]));
+}
+#else
+static inline
+uint32_t perf_read_cycles()
+{
+	uint32_t val;
+	__asm volatile ("mrc	p15, 0, %0, c15, c12, 1" : "=r"(val));
+	return val;
+}
+
+static inline
+void perf_read(struct perf_sample *s)
+{
+	__asm volatile ("mrc	p15, 0, %0, c15, c12, 1" : "=r"(s->cycles));
+	__asm volatile ("mrc	p15, 0, %0, c15, c12, 2" : "=r"(s->evs[0]));
+	__asm volatile ("mrc	p15, 0, %0, c15, c12, 3" : "=r"(s->evs[1]));
+}
+#endif
+
+// The region must begin and end on the same cpu.
+void	perf_begin(struct perf_sample *s);
+void	perf_end(struct perf_region *r, const struct perf_sample *s);
+void	perf_init_cpu();
+int	perf_init();
+int	perf_select(enum perf_event ev0, enum perf_event ev1);
+void	perf_reset();
+void	perf_dump();
+#endif
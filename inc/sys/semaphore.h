@@ -0,0 +1,20 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright (c) 2021 Amol Surati
+
+#ifndef SYS_SEMAPHORE_H
+#define SYS_SEMAPHORE_H
+
+#include <sys/list.h>
+#include <sys/spinlock.h>
+
+struct semaphore {
+	int				count;
+	struct spin_lock		lock;
+	struct list_head		wait_queue;
+};
+
+void	semaphore_init(struct semaphore *s, int count);
+void	semaphore_down(struct semaphore *s);
+int	semaphore_try_down(struct semaphore *s);
+void	semaphore_up(struct semaphore *s);
+#endif
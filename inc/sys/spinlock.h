@@ -6,6 +6,7 @@
 
 #include <lib/assert.h>
 
+#include <sys/atomic.h>
 #include <sys/cpu.h>			// cpu_raise_ipl
 
 struct spin_lock {
@@ -27,20 +28,38 @@ void spin_lock_init(struct spin_lock *lock, enum ipl lock_ipl)
 static inline
 void spin_lock(struct spin_lock *lock)
 {
+	enum ipl prev_ipl;
+	reg_t irq_mask;
+
 	assert(lock);
-	lock->prev_ipl = cpu_raise_ipl(lock->lock_ipl, &lock->irq_mask);
-	*(volatile int *)&lock->lock = 1;
+
+	// prev_ipl and irq_mask belong to the current owner; fill them only
+	// after the lock is acquired.
+	prev_ipl = cpu_raise_ipl(lock->lock_ipl, &irq_mask);
+	while (atomic_xchg(&lock->lock, 1)) {
+		while (atomic_read(&lock->lock))
+			cpu_wfe();
+	}
 	dmb();
+	lock->prev_ipl = prev_ipl;
+	lock->irq_mask = irq_mask;
 }
 
 // Called at ipl == lock_ipl.
 static inline
 void spin_unlock(struct spin_lock *lock)
 {
+	enum ipl prev_ipl;
+	reg_t irq_mask;
+
 	assert(lock);
+	prev_ipl = lock->prev_ipl;
+	irq_mask = lock->irq_mask;
 	dmb();
-	*(volatile int *)&lock->lock = 0;
-	cpu_lower_ipl(lock->prev_ipl, lock->irq_mask);
+	atomic_write(&lock->lock, 0);
+	dsb();
+	cpu_sev();
+	cpu_lower_ipl(prev_ipl, irq_mask);
 }
 
 void	spin_lock_init(struct spin_lock *lock, enum ipl lock_ipl);
@@ -0,0 +1,33 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright (c) 2021 Amol Surati
+
+#ifndef SYS_TASK_H
+#define SYS_TASK_H
+
+#include <sys/list.h>
+#include <sys/spinlock.h>
+
+typedef void fn_task(void *p);
+
+struct task_group;
+
+// The memory for a task belongs to the caller of task_spawn. It must remain
+// valid until task_sync on its group returns.
+struct task {
+	fn_task				*fn;
+	void				*p;
+	struct task_group		*group;
+};
+
+// A task which spawns into a group must task_sync that group before it
+// returns.
+struct task_group {
+	int				num_pending;
+	struct spin_lock		lock;
+	struct list_head		wait_queue;
+};
+
+void	task_group_init(struct task_group *g);
+void	task_spawn(struct task_group *g, struct task *t, fn_task *fn, void *p);
+void	task_sync(struct task_group *g);
+#endif
@@ -0,0 +1,49 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright (c) 2021 Amol Surati
+
+#ifndef SYS_TASKLET_H
+#define SYS_TASKLET_H
+
+#include <sys/cpu.h>
+
+typedef void fn_tasklet(void *p);
+
+// Deferred work, run at IPL_SCHED on the cpu which scheduled it, once that
+// cpu drops to IPL_THREAD. Scheduling a tasklet which is already queued is
+// a no-op; the tasklet runs once. A tasklet must be scheduled from one cpu
+// at a time. The memory must remain valid while the tasklet is queued.
+struct tasklet {
+	struct tasklet			*next;
+	fn_tasklet			*fn;
+	void				*p;
+	char				is_queued;
+};
+
+// Called at IPL_SCHED, once per item, in the order the items were pushed.
+typedef void fn_softq(void *item, void *p);
+
+// A per-source queue of events, each with its own data. The producer is
+// the hw irq handler of the source; the consumer is the queue's tasklet,
+// on the same cpu. A tasklet run drains at most SOFTQ_BATCH items, and
+// requeues itself behind the other tasklets if more remain.
+struct softq {
+	struct tasklet			tasklet;
+	fn_softq			*fn;
+	void				*p;
+	void				**items;
+	unsigned int			size;	// Power of 2.
+	unsigned int			head;
+	unsigned int			tail;
+	uint32_t			num_dropped;
+};
+
+#define SOFTQ_BATCH			16
+
+void	tasklet_init(struct tasklet *t, fn_tasklet *fn, void *p);
+void	tasklet_schedule(struct tasklet *t);
+struct tasklet	*tasklet_dequeue(struct cpu *cpu);
+
+int	softq_init(struct softq *q, void **items, unsigned int size,
+		   fn_softq *fn, void *p);
+int	softq_push(struct softq *q, void *item);
+#endif
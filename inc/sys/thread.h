@@ -12,19 +12,43 @@ enum thread_state {
 	THREAD_STATE_READY,
 	THREAD_STATE_SETUP_WAIT,
 	THREAD_STATE_WAITING,
+	THREAD_STATE_EXITED,
 };
 
 struct thread {
 	// sp, lr, 4-8, 10, 11
 	reg_t				regs[9];
 
+	// thread_switch clears on_cpu once the registers are saved; it
+	// expects on_cpu to immediately follow the regs.
+	int				on_cpu;
+
 	enum thread_state		state;
 	struct list_head		wait_entry;
+
+	// The CPU which last ran, or is about to run, the thread.
+	struct cpu			*cpu;
+
+	// The stack, if thread_create allocated it; 0 otherwise.
+	va_t				stack;
+	pfn_t				stack_frame;
+
+	// An exited thread waits here to be reclaimed.
+	struct thread			*next_dead;
 };
 
 typedef int fn_thread(void *p);
+
+// *out stays valid only until the thread exits. Once it calls thread_exit,
+// or returns from fn, its struct thread and its stack are freed by the next
+// thread_create or thread_exit of another thread. A caller must not keep
+// *out past the exit.
 int	thread_create(fn_thread *fn, void *p, struct thread **out);
+void	thread_init_idle(struct thread *t, struct cpu *cpu, va_t sp);
+int	thread_idle(void *p);
 void	thread_setup_wait(struct list_head *wq);
 void	thread_wait();
 void	thread_unwait(struct thread *t);
+void	thread_yield();
+void	thread_exit();
 #endif
@@ -0,0 +1,47 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright (c) 2021 Amol Surati
+
+#ifndef SYS_TRACE_H
+#define SYS_TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum trace_event {
+	TRACE_IRQ,			// pending mask
+	TRACE_THREAD_SWITCH,		// curr, next
+	TRACE_MUTEX_WAIT,		// mutex, holder's next
+	TRACE_V3D_IRQ,			// intctl, dbqitc
+	TRACE_V3D_RUN_PROG,		// code_ba, unif_ba
+	TRACE_V3D_RUN_BINNER,		// cr, size
+	TRACE_V3D_RUN_RENDERER,		// cr, size
+	NUM_TRACE_EVENTS,
+};
+
+// 16 bytes; 2 records per cache line.
+struct trace_rec {
+	uint32_t			ts;
+	uint16_t			event;
+	uint16_t			cpu;
+	uint32_t			args[2];
+};
+
+// Bit n enables enum trace_event n.
+extern uint32_t g_trace_mask;
+
+void	trace_record(enum trace_event event, uint32_t a0, uint32_t a1);
+
+// Cheap enough to leave in hot paths; a disabled tracepoint costs a load and
+// a branch.
+static inline
+void trace(enum trace_event event, uint32_t a0, uint32_t a1)
+{
+	if (g_trace_mask & (1ul << event))
+		trace_record(event, a0, a1);
+}
+
+void	trace_set_mask(uint32_t mask);
+int	trace_copy(struct trace_rec *out, int num);
+void	trace_dump();
+void	trace_reset();
+#endif
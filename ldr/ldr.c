@@ -27,6 +27,7 @@ void invalidate()
 
 	// Invalidate Caches
 	icdc_iall();
+	bp_iall();
 	dsb();
 	isb();
 }
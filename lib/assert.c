@@ -11,6 +11,7 @@ __attribute__((noreturn))
 void do_assert(const char *msg, const char *func, const char *file, int line)
 {
 	con_out("asrt: \"%s\", %s, %s, %d", msg, func, file, line);
+	con_flush();
 
 	for (;;)
 		cpu_yield();
@@ -11,29 +11,86 @@
 
 static const char *digits = "0123456789abcdef";
 
+// The decimal digits of 0 to 99, in pairs.
+static const char g_digit_pairs[] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+// x / 100, for any 32-bit x, as a multiply by the reciprocal (2^37 / 100,
+// rounded up) and a shift. ARMv6 has no divide instruction.
+static inline
+uint32_t div100(uint32_t x)
+{
+	return ((uint64_t)x * 0x51eb851f) >> 37;
+}
+
+// Write the digits of val, two at a time, backwards from end; pad with
+// leading zeroes to at least num_digits. Returns the new start.
+static
+char *u32toa_10(uint32_t val, char *end, int num_digits)
+{
+	char *p;
+	uint32_t q, r;
+
+	p = end;
+	while (val >= 100) {
+		q = div100(val);
+		r = (val - q * 100) << 1;
+		val = q;
+		*--p = g_digit_pairs[r + 1];
+		*--p = g_digit_pairs[r];
+	}
+
+	if (val >= 10) {
+		r = val << 1;
+		*--p = g_digit_pairs[r + 1];
+		*--p = g_digit_pairs[r];
+	} else {
+		*--p = '0' + val;
+	}
+
+	while (end - p < num_digits)
+		*--p = '0';
+	return p;
+}
+
+// The value is split into 8-digit chunks, so that only the (at most two)
+// 64-bit divisions are slow; the chunks are converted with 32-bit math.
 static
 int u64toan_10(uint64_t val, char *str, size_t size)
 {
-	int i;
-	uint64_t t, r;
-	size_t req_size;
+	int i, num;
+	uint32_t chunk;
+	uint64_t r;
+	char buf[20], *p, *end;
+
+	end = buf + sizeof(buf);
+	p = end;
+	while (val >> 32) {
+		val = divmod(val, 100000000, &r);
+		chunk = r;
+		p = u32toa_10(chunk, p, 8);
+	}
 
-	t = val;
-	req_size = 0;
-	do {
-		++req_size;
-		t = divmod(t, 10, NULL);
-	} while (t);
+	chunk = val;
+	if (chunk || p == end)
+		p = u32toa_10(chunk, p, 0);
 
-	if (size < req_size)
+	num = end - p;
+	if (size < (size_t)num)
 		return 0;
 
-	t = val;
-	for (i = req_size - 1; i >= 0; --i) {
-		t = divmod(t, 10, &r);
-		str[i] = digits[r];
-	}
-	return req_size;
+	for (i = 0; i < num; ++i)
+		str[i] = p[i];
+	return num;
 }
 
 static
@@ -57,7 +114,8 @@ int u64toan_16(uint64_t val, char *str, size_t size)
 	return req_size;
 }
 
-static
+// Write val in the radix, without a terminating nul. Returns the number of
+// characters written, or 0 if they do not fit in size.
 int u64toan(uint64_t val, char *str, size_t size, int radix)
 {
 	if (radix > 16)
@@ -104,10 +162,15 @@ int vsnprintf(char *str, size_t size, const char *fmt, va_list ap)
 	size_t i;
 	int j, fmt_len;
 	char len_mod, conv_spec;
+	va_list aq;
 
 	fmt_len = strlen(fmt);
 	str[0] = 0;
 
+	// A va_list parameter may be an array type, and taking its address
+	// then does not give a va_list *. Work on a copy.
+	va_copy(aq, ap);
+
 	for (i = 0, j = 0; i < size;) {
 		// Copy ordinary characters (not %) unchanged.
 		for (; i < size && j < fmt_len && fmt[j] != '%'; ++j, ++i)
@@ -148,8 +211,9 @@ int vsnprintf(char *str, size_t size, const char *fmt, va_list ap)
 
 		if (conv_spec == 0)
 			continue;
-		i += do_vsnprintf(str + i, size - i, &ap, len_mod, conv_spec);
+		i += do_vsnprintf(str + i, size - i, &aq, len_mod, conv_spec);
 	}
+	va_end(aq);
 
 	if (i == size)
 		--i;
@@ -15,16 +15,63 @@ int rand()
 	return g_seed;
 }
 
+// v must be non-zero.
+static inline
+int clz64(uint64_t v)
+{
+	uint32_t hi;
+
+	hi = v >> 32;
+	if (hi)
+		return __builtin_clz(hi);
+	return 32 + __builtin_clz((uint32_t)v);
+}
+
+// x / den, for any 32-bit x, as a multiply by the reciprocal (2^n / den,
+// rounded up) and a shift, for the divisors of the decimal conversions.
+// Returns 0 if den has no reciprocal here.
+static inline
+int div_recip(uint32_t x, uint64_t den, uint64_t *q)
+{
+	if (den == 10)
+		*q = ((uint64_t)x * 0xcccccccd) >> 35;
+	else if (den == 100)
+		*q = ((uint64_t)x * 0x51eb851f) >> 37;
+	else if (den == 1000)
+		*q = ((uint64_t)x * 0x10624dd3) >> 38;
+	else
+		return 0;
+	return 1;
+}
+
+// Shift-subtract division. The divisor is first aligned with the top bit of
+// the dividend, so the loop runs once per bit of the quotient, and at most
+// 64 times. A 32-bit dividend over 10, 100 or 1000 takes a multiply.
 uint64_t divmod(uint64_t num, uint64_t den, uint64_t *mod)
 {
+	int shift;
 	uint64_t q;
 
 	if (den == 0)
 		return -1;
+
+	if ((num >> 32) == 0 && div_recip(num, den, &q)) {
+		if (mod)
+			*mod = num - q * den;
+		return q;
+	}
+
 	q = 0;
-	while (num >= den) {
-		++q;
-		num -= den;
+	if (num >= den) {
+		shift = clz64(den) - clz64(num);
+		den <<= shift;
+		for (; shift >= 0; --shift, den >>= 1) {
+			q <<= 1;
+			if (num >= den) {
+				num -= den;
+				q |= 1;
+			}
+		}
 	}
 	if (mod)
 		*mod = num;
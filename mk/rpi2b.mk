@@ -0,0 +1,20 @@
+# SPDX-License-Identifier: BSD-2-Clause
+# Copyright (c) 2021 Amol Surati
+
+ARCH := arm
+
+# armv7ve for the HYP-mode exit in ldr/start.S and sys/smp.S.
+F := -march=armv7ve+nofp -mno-unaligned-access -mfloat-abi=soft
+F += -mtune=cortex-a7 -DMACH_RPI2B
+
+CROSS := arm-none-eabi
+
+CFLAGS += $(F)
+CPPFLAGS += $(F)
+
+LDFLAGS += -m armelf
+
+QFLAGS := -M raspi2b -smp 4
+QFLAGS += -serial mon:stdio -nographic -nodefaults -d mmu,int -kernel $(PKG)
+RUN := $(HOME)/tools/qemu/bin/qemu-system-arm $(QFLAGS)
+DRUN := $(RUN) -s -S
@@ -114,7 +114,7 @@ int bitmap_find_on_off(const struct bitmap *map, int align, int start,
 		if (i == num_bits)
 			break;
 	}
-	if (start < 0)
+	if (start >= map->num_bits)
 		return ERR_NOT_FOUND;
 	return start;
 }
@@ -0,0 +1,86 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright (c) 2021 Amol Surati
+
+#include <lib/assert.h>
+
+#include <sys/atomic.h>
+#include <sys/completion.h>
+#include <sys/cpu.h>
+#include <sys/thread.h>
+
+void completion_init(struct completion *c)
+{
+	assert(c);
+	c->done = 0;
+	spin_lock_init(&c->lock, IPL_SCHED);
+	list_init(&c->wait_queue);
+}
+
+// There must not be any waiters.
+void completion_reset(struct completion *c)
+{
+	assert(c);
+	spin_lock(&c->lock);
+	assert(list_is_empty(&c->wait_queue));
+	c->done = 0;
+	spin_unlock(&c->lock);
+}
+
+int completion_is_done(struct completion *c)
+{
+	assert(c);
+	return atomic_read(&c->done);
+}
+
+// Called at ipl == IPL_THREAD.
+void completion_wait(struct completion *c)
+{
+	enum ipl ipl;
+	reg_t irq_mask;
+
+	assert(c);
+
+	ipl = cpu_raise_ipl(IPL_SCHED, &irq_mask);
+	assert(ipl == IPL_THREAD);
+	spin_lock(&c->lock);
+	if (c->done) {
+		spin_unlock(&c->lock);
+		cpu_lower_ipl(ipl, irq_mask);
+		return;
+	}
+	thread_setup_wait(&c->wait_queue);
+	spin_unlock(&c->lock);
+	thread_wait();
+	cpu_lower_ipl(ipl, irq_mask);
+}
+
+// Called at ipl == IPL_SCHED or IPL_THREAD.
+void completion_signal(struct completion *c)
+{
+	enum ipl ipl;
+	struct list_head wq, *e;
+	struct thread *t;
+	reg_t irq_mask;
+
+	assert(c);
+
+	list_init(&wq);
+	ipl = cpu_raise_ipl(IPL_SCHED, &irq_mask);
+	assert(ipl == IPL_SCHED || ipl == IPL_THREAD);
+	spin_lock(&c->lock);
+	c->done = 1;
+	while (!list_is_empty(&c->wait_queue)) {
+		e = list_del_head(&c->wait_queue);
+		list_add_tail(&wq, e);
+	}
+	spin_unlock(&c->lock);
+
+	// The completion may be freed once the lock is dropped; wake the
+	// waiters off a private list.
+	while (!list_is_empty(&wq)) {
+		e = list_del_head(&wq);
+		t = list_entry(e, struct thread, wait_entry);
+		thread_unwait(t);
+	}
+	cpu_lower_ipl(ipl, irq_mask);
+}
@@ -11,71 +11,76 @@ void cond_var_init(struct cond_var *v)
 	assert(v);
 	spin_lock_init(&v->state_lock, IPL_SCHED);
 	list_init(&v->wait_queue);
-	v->signalled = 0;
-	v->num_waiters = 0;
+	v->lock = NULL;
 }
 
 // Called at ipl == IPL_THREAD.
+// Wakeups may be spurious; the caller must recheck its condition.
 void cond_var_wait(struct cond_var *v, struct mutex *lock)
 {
 	enum ipl ipl;
 	reg_t irq_mask;
 
 	assert(v);
+	assert(lock);
 
-	for (;;) {
-		ipl = cpu_raise_ipl(IPL_SCHED, &irq_mask);
-		assert(ipl == IPL_THREAD);
-		spin_lock(&v->state_lock);
+	ipl = cpu_raise_ipl(IPL_SCHED, &irq_mask);
+	assert(ipl == IPL_THREAD);
+	spin_lock(&v->state_lock);
 
-		if (!v->signalled) {
-			++v->num_waiters;
-			thread_setup_wait(&v->wait_queue);
-			spin_unlock(&v->state_lock);
-			mutex_unlock(lock);
-			thread_wait();
-			cpu_lower_ipl(ipl, irq_mask);
-			mutex_lock(lock);
-		} else {
-			if (v->num_waiters == 0)
-				v->signalled = 0;
-			spin_unlock(&v->state_lock);
-			cpu_lower_ipl(ipl, irq_mask);
-			break;
-		}
-	}
+	// All waiters must use the same mutex.
+	assert(v->lock == NULL || v->lock == lock);
+	v->lock = lock;
+
+	// Queue up before releasing the mutex, so that a signal sent after
+	// the release is not missed.
+	thread_setup_wait(&v->wait_queue);
+	spin_unlock(&v->state_lock);
+	mutex_unlock(lock);
+	thread_wait();
+	cpu_lower_ipl(ipl, irq_mask);
+	mutex_lock(lock);
 }
 
 // Called at ipl == IPL_SCHED or IPL_THREAD.
-void cond_var_signal(struct cond_var *v)
+// If the mutex is held, likely by the signaller itself, the waiters are moved
+// to the mutex's wait queue, and are woken one at a time, as the mutex is
+// handed to each of them.
+static
+void cond_var_wake(struct cond_var *v, char is_all)
 {
 	enum ipl ipl;
-	struct list_head wq, *e;
+	struct list_head *e;
 	struct thread *t;
 	reg_t irq_mask;
 
 	assert(v);
 
-	list_init(&wq);
-
 	ipl = cpu_raise_ipl(IPL_SCHED, &irq_mask);
 	assert(ipl == IPL_SCHED || ipl == IPL_THREAD);
 
-	// TODO signal in a loop, and remove dependency on num_waiters.
 	spin_lock(&v->state_lock);
-	if (!list_is_empty(&v->wait_queue)) {
-		list_add_head(&v->wait_queue, &wq);
-		list_del_entry(&v->wait_queue);
-		list_init(&v->wait_queue);
-		v->signalled = 1;
-		assert(v->num_waiters);
-	}
-
-	list_for_each(e, &wq) {
+	while (!list_is_empty(&v->wait_queue)) {
+		e = list_del_head(&v->wait_queue);
 		t = list_entry(e, struct thread, wait_entry);
-		thread_unwait(t);
-		--v->num_waiters;
+		if (!mutex_requeue(v->lock, t))
+			thread_unwait(t);
+		if (!is_all)
+			break;
 	}
 	spin_unlock(&v->state_lock);
 	cpu_lower_ipl(ipl, irq_mask);
 }
+
+// Called at ipl == IPL_SCHED or IPL_THREAD.
+// Wake the longest waiting thread, if any.
+void cond_var_signal(struct cond_var *v)
+{
+	cond_var_wake(v, 0);
+}
+
+// Called at ipl == IPL_SCHED or IPL_THREAD.
+void cond_var_broadcast(struct cond_var *v)
+{
+	cond_var_wake(v, 1);
+}
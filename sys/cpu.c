@@ -4,63 +4,254 @@
 #include <lib/assert.h>
 #include <lib/string.h>
 
+#include <sys/atomic.h>
 #include <sys/cpu.h>			// struct cpu
+#include <sys/cpu.S.h>
 #include <sys/err.h>
+#include <sys/irqstat.h>
+#include <sys/perf.h>
+#include <sys/spinlock.h>
+#include <sys/tasklet.h>
 #include <sys/thread.h>
+#include <sys/trace.h>
 
-static struct thread g_idle_thread;
-static struct cpu g_cpu;
-static uint32_t g_cpu_sw_irq_mask;
+#include <dev/tmr.h>
 
+#define IDLE_STACK_SIZE			0x4000
+#define FIQ_STACK_SIZE			0x400
+
+// The number of tasklets run per drop to IPL_THREAD. The rest run at the
+// next drop, so that a flood of completions cannot starve the threads.
+#define CPU_TASKLET_BUDGET		8
+
+static struct thread g_boot_thread;
+static struct thread g_idle_threads[NUM_CPUS];
+static struct cpu g_cpus[NUM_CPUS];
+static char g_idle_stacks[NUM_CPUS][IDLE_STACK_SIZE]
+	__attribute__((aligned(8)));
+
+static char g_fiq_stack[FIQ_STACK_SIZE] __attribute__((aligned(8)));
+static fn_irqh *g_fiqh;
+
+// Read by sys/smp.S, with the MMU off.
+struct cpu_boot g_cpu_boot __attribute__((aligned(CACHE_LINE_SIZE)));
+
+// The chains are only ever added to. A new handler is linked in after it
+// is filled, so that the dispatch can walk a chain without the lock.
 struct irq_info {
-	fn_irqh *hw;
-	fn_irqh *sw;
+	struct irqh			*head;
+	uint32_t			num_hw;
+	uint32_t			num_sw;
 };
 
 static struct irq_info g_irq_info[NUM_IRQS];
+static struct irqh g_irqhs[NUM_IRQS];	// For cpu_register_irqh.
+static struct spin_lock g_irq_lock;
+
+// The lowest set bit; the mask must be non-zero.
+static inline
+int cpu_first_irq(uint32_t mask)
+{
+	return 31 - __builtin_clz(mask & -mask);
+}
 
 void cpu_hw_irq_handler()
 {
 	int i;
 	enum ipl ipl;
 	reg_t irq_mask;
-	uint32_t mask;
+	uint32_t mask, entry, start;
+	struct irqh *h;
 	uint32_t	intc_get_pending();
+	uint32_t	intc_get_ipis();
 
+	// The exception disabled the IRQs; the return enables them.
+	entry = perf_read_cycles();
+	irqstat_irqs_off(__builtin_return_address(0));
 	ipl = cpu_raise_ipl(IPL_HARD, &irq_mask);
-	mask = intc_get_pending();
 
-	for (i = 0; mask && i < NUM_IRQS; ++i) {
-		if ((mask & (1 << i)) == 0)
-			continue;
-		g_irq_info[i].hw();
-		mask >>= 1;
+	// IPI_RESCHED only needs to wake the CPU from cpu_idle_wait.
+	if (NUM_CPUS > 1)
+		intc_get_ipis();
+
+	mask = intc_get_pending();
+	trace(TRACE_IRQ, mask, 0);
+
+	for (; mask; mask &= mask - 1) {
+		i = cpu_first_irq(mask);
+		++g_irq_info[i].num_hw;
+		start = perf_read_cycles();
+		for (h = g_irq_info[i].head; h; h = h->next)
+			if (h->hw)
+				h->hw();
+		irqstat_irq(i, entry, start, perf_read_cycles());
 	}
 	cpu_lower_ipl(ipl, irq_mask);
+	irqstat_irqs_on();
 }
 
+// Called at IPL_SCHED
 static
 void cpu_sw_irq_handlers(uint32_t mask)
 {
 	int i;
-	for (i = 0; mask && i < NUM_IRQS; ++i) {
-		if ((mask & (1 << i)) == 0)
-			continue;
-		g_irq_info[i].sw();
-		mask >>= 1;
+	struct irqh *h;
+
+	for (; mask; mask &= mask - 1) {
+		i = cpu_first_irq(mask);
+		++g_irq_info[i].num_sw;
+		for (h = g_irq_info[i].head; h; h = h->next)
+			if (h->sw)
+				h->sw();
 	}
 }
 
+// Any IPL.
+void cpu_add_irqh(enum irq irq, struct irqh *h)
+{
+	struct irqh **pos;
+
+	assert(irq < NUM_IRQS);
+	assert(h && (h->hw || h->sw));
+
+	spin_lock(&g_irq_lock);
+	pos = &g_irq_info[irq].head;
+	while (*pos && (*pos)->prio <= h->prio)
+		pos = &(*pos)->next;
+	h->next = *pos;
+
+	// Pairs with the address dependency of the walk in the dispatch.
+	dmb();
+	*pos = h;
+	spin_unlock(&g_irq_lock);
+}
+
+// Any IPL. The handlers are added with prio 0, after any others of prio 0.
 void cpu_register_irqh(enum irq irq, fn_irqh *hw, fn_irqh *sw)
 {
-	g_irq_info[irq].hw = hw;
-	g_irq_info[irq].sw = sw;
+	struct irqh *h;
+
+	assert(irq < NUM_IRQS);
+	h = &g_irqhs[irq];
+	assert(h->hw == NULL && h->sw == NULL);
+	h->hw = hw;
+	h->sw = sw;
+	h->prio = 0;
+	cpu_add_irqh(irq, h);
+}
+
+// Any IPL. The counts of the dispatches; an IRQ raised again while it is
+// still pending is counted once.
+void cpu_get_irq_stats(enum irq irq, struct irq_stats *out)
+{
+	assert(irq < NUM_IRQS);
+	out->num_hw = g_irq_info[irq].num_hw;
+	out->num_sw = g_irq_info[irq].num_sw;
+}
+
+// Entered from sys/excptn.S, in FIQ mode, on cpu0, with IRQs and FIQs
+// masked. The handler must only ack its device, and hand off the rest with
+// cpu_raise_sw_irq_fiq; it runs outside of the IPLs, and cannot take locks.
+void cpu_fiq_handler()
+{
+	fn_irqh *fn;
+
+	fn = g_fiqh;
+	if (fn)
+		fn();
+}
+
+// Called from the FIQ handler.
+// The sw handlers of the irq run at the next drop to IPL_THREAD on cpu0. On
+// SMP, a self-IPI forces one. On UP, nothing does; the idle thread checks
+// fiq_sw_irq_mask with FIQs masked, so that a FIQ can't slip in between the
+// check and its WFI, and a running thread reaches IPL_THREAD on its own.
+void cpu_raise_sw_irq_fiq(enum irq irq)
+{
+	int old, val;
+	struct cpu *cpu;
+
+	cpu = cpu_get();
+	do {
+		old = atomic_read(&cpu->fiq_sw_irq_mask);
+		val = old | (1ul << irq);
+	} while (atomic_cmpxchg(&cpu->fiq_sw_irq_mask, old, val) != old);
+	cpu_send_ipi(cpu->index, IPI_RESCHED);
+}
+
+// Called on cpu0 by intc_init, once the FIQ generation is disabled.
+void cpu_init_fiq()
+{
+	register reg_t sp __asm("r0");
+
+	// r0 is not banked in the FIQ mode.
+	sp = (reg_t)&g_fiq_stack[FIQ_STACK_SIZE];
+	__asm volatile ("cps	%1\n\t"
+			"mov	sp, %0\n\t"
+			"cps	%2"
+			:: "r"(sp), "i"(PSR_MODE_FIQ), "i"(PSR_MODE_SVC)
+			: "memory");
+	__asm volatile ("cpsie	f" ::: "memory");
+}
+
+// Any IPL. Route the irq to FIQ, instead of IRQ; fn is then its hw
+// handler. Its sw handlers stay on the chain of the irq. Only one source
+// can be routed to FIQ at a time.
+int cpu_set_fiqh(enum irq irq, fn_irqh *fn)
+{
+	int	intc_set_fiq(enum irq irq);
+
+	assert(irq < NUM_IRQS);
+	assert(fn);
+	if (g_fiqh)
+		return ERR_PENDING;
+	g_fiqh = fn;
+	dsb();
+	return intc_set_fiq(irq);
+}
+
+// Any IPL. The irq which was routed to FIQ stays disabled.
+void cpu_clear_fiqh()
+{
+	void	intc_clear_fiq();
+
+	intc_clear_fiq();
+	dsb();
+	g_fiqh = NULL;
 }
 
 // Called at IPL_HARD only
 void cpu_raise_sw_irq(enum irq irq)
 {
-	g_cpu_sw_irq_mask |= 1ul << irq;
+	struct cpu *cpu;
+
+	cpu = cpu_get();
+	cpu->sw_irq_mask |= 1ul << irq;
+}
+
+struct cpu *cpu_get_by_index(int index)
+{
+	assert(index >= 0 && index < NUM_CPUS);
+	return &g_cpus[index];
+}
+
+// Called at IPL_SCHED
+void cpu_rq_lock(struct cpu *cpu)
+{
+	while (atomic_xchg(&cpu->rq_lock, 1)) {
+		while (atomic_read(&cpu->rq_lock))
+			cpu_wfe();
+	}
+	dmb();
+}
+
+// Called at IPL_SCHED
+void cpu_rq_unlock(struct cpu *cpu)
+{
+	dmb();
+	atomic_write(&cpu->rq_lock, 0);
+	dsb();
+	cpu_sev();
 }
 
 static inline
@@ -102,12 +293,27 @@ void cpsid_i()
 }
 
 static inline
-reg_t cpu_disable_irqs()
+void cpsie_f()
+{
+	__asm volatile ("cpsie	f" ::: "memory");
+}
+
+static inline
+void cpsid_f()
+{
+	__asm volatile ("cpsid	f" ::: "memory");
+}
+
+// The site is where the IRQs-off window, if one begins, is charged to.
+static inline
+reg_t cpu_disable_irqs(void *site)
 {
 	reg_t prev_mask;
 
 	prev_mask = mrs_cpsr();
 	cpsid_i();
+	if (!bits_get(prev_mask, PSR_I))
+		irqstat_irqs_off(site);
 	return prev_mask;
 }
 
@@ -117,6 +323,8 @@ reg_t cpu_enable_irqs()
 	reg_t prev_mask;
 
 	prev_mask = mrs_cpsr();
+	if (bits_get(prev_mask, PSR_I))
+		irqstat_irqs_on();
 	cpsie_i();
 	return prev_mask;
 }
@@ -128,18 +336,20 @@ reg_t cpu_get_irqs()
 }
 
 static inline
-void cpu_set_irqs(reg_t prev_mask)
+void cpu_set_irqs(reg_t prev_mask, void *site)
 {
 	if (bits_get(prev_mask, PSR_I))
-		cpsid_i();
+		cpu_disable_irqs(site);
 	else
-		cpsie_i();
+		cpu_enable_irqs();
 }
 
 enum ipl cpu_raise_ipl(enum ipl new_ipl, reg_t *irq_mask)
 {
 	enum ipl curr_ipl;
+	void *site;
 
+	site = __builtin_return_address(0);
 	*irq_mask = cpu_get_irqs();
 	curr_ipl = cpu_get_curr_ipl();
 	assert(new_ipl <= curr_ipl);
@@ -149,7 +359,7 @@ enum ipl cpu_raise_ipl(enum ipl new_ipl, reg_t *irq_mask)
 
 	// If moving into the HARD IPLs.
 	if (new_ipl == IPL_HARD)
-		cpu_disable_irqs();
+		cpu_disable_irqs(site);
 
 	cpu_set_curr_ipl(new_ipl);
 	return curr_ipl;
@@ -157,14 +367,20 @@ enum ipl cpu_raise_ipl(enum ipl new_ipl, reg_t *irq_mask)
 
 enum ipl cpu_lower_ipl(enum ipl new_ipl, reg_t irq_mask)
 {
+	int budget;
 	enum ipl curr_ipl;
 	uint32_t mask;
+	struct cpu *cpu;
+	struct tasklet *t;
+	void *site;
 
-	curr_ipl = cpu_get_curr_ipl();
+	site = __builtin_return_address(0);
+	cpu = cpu_get();
+	curr_ipl = cpu->curr_ipl;
 	assert(new_ipl >= curr_ipl);
 
 	if (new_ipl == curr_ipl) {
-		cpu_set_irqs(irq_mask);
+		cpu_set_irqs(irq_mask, site);
 		return curr_ipl;
 	}
 
@@ -177,42 +393,178 @@ enum ipl cpu_lower_ipl(enum ipl new_ipl, reg_t irq_mask)
 	// IPL and set irq_mask
 	if (curr_ipl == IPL_HARD && new_ipl == IPL_SCHED) {
 		cpu_set_curr_ipl(new_ipl);
-		cpu_set_irqs(irq_mask);
+		cpu_set_irqs(irq_mask, site);
 		return curr_ipl;
 	}
 
 	cpu_set_curr_ipl(IPL_SCHED);
 
-	// Run soft handlers.
+	// Run soft handlers, then the tasklets, within the budget. The soft
+	// handlers are rechecked between the tasklets.
+	budget = CPU_TASKLET_BUDGET;
 	while (1) {
-		cpu_disable_irqs();
-		if (g_cpu_sw_irq_mask == 0)
+		cpu_disable_irqs(site);
+		mask = cpu->sw_irq_mask;
+		mask |= atomic_xchg(&cpu->fiq_sw_irq_mask, 0);
+		if (mask) {
+			cpu->sw_irq_mask = 0;
+			cpu_enable_irqs();
+			cpu_sw_irq_handlers(mask);
+			continue;
+		}
+		if (budget == 0)
+			break;
+		t = tasklet_dequeue(cpu);
+		if (t == NULL)
 			break;
-		mask = g_cpu_sw_irq_mask;
-		g_cpu_sw_irq_mask = 0;
+		--budget;
 		cpu_enable_irqs();
-		cpu_sw_irq_handlers(mask);
+		t->fn(t->p);
 	}
 	cpu_set_curr_ipl(new_ipl);
-	cpu_set_irqs(irq_mask);
+	cpu_set_irqs(irq_mask, site);
 	return curr_ipl;
 }
 
+// IPL_THREAD, from the idle thread.
+// Sleep until an interrupt arrives, unless there's work to do.
+void cpu_idle_wait()
+{
+	reg_t mask;
+	struct cpu *cpu;
+	void *site;
+
+	site = __builtin_return_address(0);
+	cpu = cpu_get();
+
+	// WFI wakes up on a pending IRQ or FIQ even if they are disabled.
+	// Disable both to close the window between the check and the WFI; a
+	// FIQ raising fiq_sw_irq_mask in there would otherwise go unnoticed
+	// until some later IRQ, as on UP there's no IPI to force a wakeup.
+	mask = cpu_disable_irqs(site);
+	cpsid_f();
+	if (atomic_read(&cpu->num_ready) == 0 && cpu->sw_irq_mask == 0 &&
+	    atomic_read(&cpu->fiq_sw_irq_mask) == 0 &&
+	    cpu->tasklet_head == NULL) {
+		// The sleep does not delay the IRQs.
+		irqstat_irqs_on();
+		cpu_yield();
+	}
+	// A pending FIQ is taken here.
+	if (!bits_get(mask, PSR_F))
+		cpsie_f();
+	cpu_set_irqs(mask, site);
+}
+
+static
+void cpu_init_one(struct cpu *cpu, int index)
+{
+	struct thread *idle;
+
+	cpu->index = index;
+	cpu->curr_ipl = IPL_HARD;
+	cpu->rq_lock = 0;
+	cpu->num_ready = 0;
+	cpu->sw_irq_mask = 0;
+	cpu->fiq_sw_irq_mask = 0;
+	cpu->tasklet_head = NULL;
+	cpu->tasklet_tail = &cpu->tasklet_head;
+	list_init(&cpu->ready_queue);
+
+	idle = &g_idle_threads[index];
+	thread_init_idle(idle, cpu, (va_t)g_idle_stacks[index + 1]);
+	cpu->idle_thread = idle;
+}
+
 // This call runs under the mmu maps supplied by the loader. Hence, malloc,
 // mmu_map, etc. are not available to this function and its callees.
 void cpu_init()
 {
 	struct cpu *cpu;
+	struct thread *t;
 	void excptn_vector();
 
-	cpu = &g_cpu;
-	cpu->index = 0;
-	cpu->hw_id = 0;
-	cpu->curr_ipl = IPL_HARD;
-	cpu->idle_thread = &g_idle_thread;
-	cpu->curr_thread = cpu->idle_thread;
-	list_init(&cpu->ready_queue);
+	cpu = &g_cpus[0];
+	cpu_init_one(cpu, 0);
+	cpu->hw_id = mrc_mpidr();
+
+	// crt0 runs the boot thread on its own stack.
+	t = &g_boot_thread;
+	t->on_cpu = 1;
+	t->cpu = cpu;
+	cpu->curr_thread = t;
+
 	cpu_set(cpu);
 	mcr_vbar((reg_t)excptn_vector);
+	spin_lock_init(&g_irq_lock, IPL_HARD);
 	cpu->online = 1;
 }
+
+#if NUM_CPUS > 1
+// Entered from sys/smp.S, on the stack of the cpu's idle thread.
+void cpu_secondary_main(struct cpu *cpu)
+{
+	struct thread *idle;
+	void excptn_vector();
+	void	intc_init_cpu();
+	void	perf_init_cpu();
+
+	// The core started through the mailboxes of the index is that core.
+	cpu->hw_id = mrc_mpidr();
+	assert(cpu->hw_id == (reg_t)cpu->index);
+	cpu_set(cpu);
+	mcr_vbar((reg_t)excptn_vector);
+
+	idle = cpu->idle_thread;
+	idle->on_cpu = 1;
+	idle->state = THREAD_STATE_RUNNING;
+	cpu->curr_thread = idle;
+
+	intc_init_cpu();
+	perf_init_cpu();
+	dmb();
+	*(volatile char *)&cpu->online = 1;
+	dsb();
+	cpu_sev();
+
+	cpu_lower_ipl(IPL_THREAD, 0);
+	thread_idle(NULL);
+}
+#endif
+
+// IPL_THREAD
+// Release the secondary cores, one at a time, from the firmware's spin table.
+int cpu_start_secondaries()
+{
+#if NUM_CPUS > 1
+	int i, err;
+	uint32_t start;
+	struct cpu *cpu;
+	void	cpu_secondary_entry();
+	reg_t	mmu_get_ttbr();
+	int	intc_start_cpu(int index, pa_t entry);
+
+	for (i = 1; i < NUM_CPUS; ++i) {
+		cpu = &g_cpus[i];
+		cpu_init_one(cpu, i);
+
+		g_cpu_boot.ttbr = mmu_get_ttbr();
+		g_cpu_boot.sp = (va_t)g_idle_stacks[i + 1];
+		g_cpu_boot.cpu = cpu;
+		dc_cvac(&g_cpu_boot, sizeof(g_cpu_boot));
+		dsb();
+
+		err = intc_start_cpu(i, va_to_pa((va_t)cpu_secondary_entry));
+		if (err)
+			return err;
+
+		start = tmr_get_ctr();
+		while (!*(volatile char *)&cpu->online) {
+			if (tmr_get_ctr() - start > 1000000)
+				return ERR_TIMEOUT;
+		}
+		dmb();
+	}
+#endif
+	return ERR_SUCCESS;
+}
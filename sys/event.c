@@ -0,0 +1,101 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright (c) 2021 Amol Surati
+
+#include <lib/assert.h>
+
+#include <sys/atomic.h>
+#include <sys/cpu.h>
+#include <sys/event.h>
+#include <sys/thread.h>
+
+void event_init(struct event *e)
+{
+	assert(e);
+	e->flags = 0;
+	spin_lock_init(&e->lock, IPL_SCHED);
+	list_init(&e->wait_queue);
+}
+
+// Called at ipl == IPL_SCHED or IPL_THREAD.
+// All waiters are woken; each rechecks its own mask.
+void event_set(struct event *e, uint32_t mask)
+{
+	enum ipl ipl;
+	struct list_head wq, *p;
+	struct thread *t;
+	reg_t irq_mask;
+
+	assert(e);
+
+	list_init(&wq);
+	ipl = cpu_raise_ipl(IPL_SCHED, &irq_mask);
+	assert(ipl == IPL_SCHED || ipl == IPL_THREAD);
+	spin_lock(&e->lock);
+	e->flags |= mask;
+	while (!list_is_empty(&e->wait_queue)) {
+		p = list_del_head(&e->wait_queue);
+		list_add_tail(&wq, p);
+	}
+	spin_unlock(&e->lock);
+
+	while (!list_is_empty(&wq)) {
+		p = list_del_head(&wq);
+		t = list_entry(p, struct thread, wait_entry);
+		thread_unwait(t);
+	}
+	cpu_lower_ipl(ipl, irq_mask);
+}
+
+// Called at ipl == IPL_SCHED or IPL_THREAD.
+void event_clear(struct event *e, uint32_t mask)
+{
+	assert(e);
+	spin_lock(&e->lock);
+	e->flags &= ~mask;
+	spin_unlock(&e->lock);
+}
+
+uint32_t event_get(struct event *e)
+{
+	assert(e);
+	return (uint32_t)atomic_read((int *)&e->flags);
+}
+
+// Called at ipl == IPL_THREAD.
+// Wait until any (or, with EVENT_WAIT_ALL, all) of the flags in mask are
+// set. With EVENT_WAIT_CLEAR, the flags that satisfied the wait are cleared.
+// Returns the flags, as they were when the wait was satisfied.
+uint32_t event_wait(struct event *e, uint32_t mask, int opts)
+{
+	enum ipl ipl;
+	reg_t irq_mask;
+	uint32_t flags;
+	int is_done;
+
+	assert(e);
+	assert(mask);
+
+	for (;;) {
+		ipl = cpu_raise_ipl(IPL_SCHED, &irq_mask);
+		assert(ipl == IPL_THREAD);
+		spin_lock(&e->lock);
+		flags = e->flags;
+		if (opts & EVENT_WAIT_ALL)
+			is_done = (flags & mask) == mask;
+		else
+			is_done = (flags & mask) != 0;
+
+		if (is_done) {
+			if (opts & EVENT_WAIT_CLEAR)
+				e->flags &= ~mask;
+			spin_unlock(&e->lock);
+			cpu_lower_ipl(ipl, irq_mask);
+			return flags;
+		}
+
+		thread_setup_wait(&e->wait_queue);
+		spin_unlock(&e->lock);
+		thread_wait();
+		cpu_lower_ipl(ipl, irq_mask);
+	}
+}
@@ -0,0 +1,172 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright (c) 2021 Amol Surati
+
+#include <lib/assert.h>
+#include <lib/stdio.h>
+#include <lib/string.h>
+
+#include <sys/irqstat.h>
+#include <sys/perf.h>
+
+#include <dev/con.h>
+
+struct irqstat_irq {
+	struct irqstat_hist		lat;
+	struct irqstat_hist		dur;
+};
+
+// The window in progress, and the longest one with the address which
+// disabled the IRQs.
+struct irqstat_cpu {
+	uint32_t			start;
+	void				*site;
+	struct irqstat_hist		off;
+	void				*max_site;
+};
+
+// Updated at IPL_HARD, on the cpu which takes the GPU interrupts.
+static struct irqstat_irq g_irqstat_irqs[NUM_IRQS];
+
+// Each cpu updates its own, with IRQs disabled.
+static struct irqstat_cpu g_irqstat_cpus[NUM_CPUS];
+
+static const char *g_irqstat_names[] = {
+	[IRQ_PV2]			= "pv2",
+	[IRQ_ARM_MAILBOX]		= "mbox",
+	[IRQ_TIMER3]			= "timer3",
+	[IRQ_TIMER1]			= "timer1",
+	[IRQ_VC_3D]			= "v3d",
+	[IRQ_TXP]			= "txp",
+	[IRQ_I2C]			= "i2c",
+	[IRQ_UART]			= "uart",
+};
+
+// Returns 1 if the sample is a new maximum.
+static
+int irqstat_add(struct irqstat_hist *h, uint32_t val)
+{
+	int ix;
+
+	ix = val ? 31 - __builtin_clz(val) : 0;
+	++h->counts[ix];
+	if (val <= h->max)
+		return 0;
+	h->max = val;
+	return 1;
+}
+
+// IPL_HARD
+void irqstat_irq(enum irq irq, uint32_t entry, uint32_t start, uint32_t end)
+{
+	struct irqstat_irq *s;
+
+	assert(irq < NUM_IRQS);
+	s = &g_irqstat_irqs[irq];
+	irqstat_add(&s->lat, start - entry);
+	irqstat_add(&s->dur, end - start);
+}
+
+// Called with IRQs just disabled.
+void irqstat_irqs_off(void *site)
+{
+	struct irqstat_cpu *s;
+
+	s = &g_irqstat_cpus[cpu_get_index()];
+	s->start = perf_read_cycles();
+	s->site = site;
+}
+
+// Called with IRQs disabled, about to be enabled. A window which did not
+// begin through irqstat_irqs_off is not counted.
+void irqstat_irqs_on()
+{
+	struct irqstat_cpu *s;
+
+	s = &g_irqstat_cpus[cpu_get_index()];
+	if (s->site == NULL)
+		return;
+	if (irqstat_add(&s->off, perf_read_cycles() - s->start))
+		s->max_site = s->site;
+	s->site = NULL;
+}
+
+// Any IPL.
+void irqstat_get_irq(enum irq irq, struct irqstat_hist *lat,
+		     struct irqstat_hist *dur)
+{
+	assert(irq < NUM_IRQS);
+	if (lat)
+		*lat = g_irqstat_irqs[irq].lat;
+	if (dur)
+		*dur = g_irqstat_irqs[irq].dur;
+}
+
+// Any IPL.
+void irqstat_get_irqs_off(int cpu, struct irqstat_hist *out, void **site)
+{
+	assert(cpu >= 0 && cpu < NUM_CPUS);
+	if (out)
+		*out = g_irqstat_cpus[cpu].off;
+	if (site)
+		*site = g_irqstat_cpus[cpu].max_site;
+}
+
+// Any IPL. A window in progress stays open.
+void irqstat_reset()
+{
+	int i;
+
+	memset(g_irqstat_irqs, 0, sizeof(g_irqstat_irqs));
+	for (i = 0; i < NUM_CPUS; ++i) {
+		memset(&g_irqstat_cpus[i].off, 0, sizeof(g_irqstat_cpus[i].off));
+		g_irqstat_cpus[i].max_site = NULL;
+	}
+}
+
+// Print the non-empty buckets as log2:count pairs.
+static
+void irqstat_print(const char *name, const char *kind,
+		   const struct irqstat_hist *h)
+{
+	int i, n;
+	char buf[160];
+
+	n = 0;
+	buf[0] = 0;
+	for (i = 0; i < IRQSTAT_NUM_BUCKETS; ++i) {
+		if (h->counts[i] == 0)
+			continue;
+		if (n >= (int)sizeof(buf))
+			break;
+		n += snprintf(buf + n, sizeof(buf) - n, " %d:%d", i,
+			      h->counts[i]);
+	}
+	con_out("irqstat: %s %s max %d cyc,%s", name, kind, h->max, buf);
+}
+
+// IPL_THREAD
+void irqstat_dump()
+{
+	int i;
+	void *site;
+	char name[8];
+	struct irq_stats st;
+	struct irqstat_hist lat, dur, off;
+
+	for (i = 0; i < NUM_IRQS; ++i) {
+		cpu_get_irq_stats(i, &st);
+		if (st.num_hw == 0)
+			continue;
+		irqstat_get_irq(i, &lat, &dur);
+		irqstat_print(g_irqstat_names[i], "lat", &lat);
+		irqstat_print(g_irqstat_names[i], "dur", &dur);
+	}
+	for (i = 0; i < NUM_CPUS; ++i) {
+		irqstat_get_irqs_off(i, &off, &site);
+		if (site == NULL)
+			continue;
+		snprintf(name, sizeof(name), "cpu%d", i);
+		irqstat_print(name, "irqs-off", &off);
+		con_out("irqstat: %s irqs-off max at %x", name, (uint32_t)site);
+	}
+}
@@ -12,12 +12,38 @@
 #include <sys/vmm.h>
 
 #include <dev/con.h>
+#include <dev/disp.h>
 #include <dev/mbox.h>
 #include <dev/v3d.h>
 
+// IPL_THREAD
+// A single round trip for all the firmware properties shown at boot.
+static
+int kmain_show_fw()
+{
+	int err;
+	struct mbox_buf b;
+	struct mbox_fw_rev *rev;
+	struct mbox_clk_rate *arm, *core;
+
+	err = mbox_buf_init(&b, 128);
+	if (err)
+		return err;
+
+	rev = mbox_buf_get_fw_rev(&b);
+	arm = mbox_buf_get_clk_rate(&b, MBOX_CLK_ARM);
+	core = mbox_buf_get_clk_rate(&b, MBOX_CLK_CORE);
+	err = mbox_buf_submit(&b);
+	if (!err)
+		con_out("rev %x, arm %dHz, core %dHz", rev->rev, arm->rate,
+			core->rate);
+	mbox_buf_fini(&b);
+	return err;
+}
+
 int kmain()
 {
-	int err, rev;
+	int err;
 	pa_t fb_base;
 	size_t fb_size;
 	va_t sys_end;
@@ -31,9 +57,11 @@ int kmain()
 	int	mmu_post_init(va_t sys_end);
 	int	intc_init();
 	int	tmr_init();
+	int	tmr_init_irq();
+	int	perf_init();
+	int	task_init();
 	int	mbox_init();
-	int	disp_init();
-	int	disp_config();
+	int	txp_init();
 	int	fb_init();
 	int	v3d_init();
 	int	demo_run(int phase);
@@ -76,18 +104,37 @@ int kmain()
 	if (err)
 		return err;
 
+	err = con_init_irq();
+	if (err)
+		return err;
+
 	err = tmr_init();
 	if (err)
 		return err;
 
+	err = tmr_init_irq();
+	if (err)
+		return err;
+
+	err = perf_init();
+	if (err)
+		return err;
+
+	err = cpu_start_secondaries();
+	if (err)
+		return err;
+
+	err = task_init();
+	if (err)
+		return err;
+
 	err = mbox_init();
 	if (err)
 		return err;
 
-	err = mbox_get_fw_rev(&rev);
+	err = kmain_show_fw();
 	if (err)
 		return err;
-	con_out("rev %x", rev);
 
 	err = fb_init();
 	if (err)
@@ -101,11 +148,15 @@ int kmain()
 	if (err)
 		return err;
 
-	err = demo_run(0);
+	err = txp_init();
 	if (err)
 		return err;
 
-	err = disp_config();
+	err = disp_config(NULL);
+	if (err)
+		return err;
+
+	err = demo_run(0);
 	if (err)
 		return err;
 err:
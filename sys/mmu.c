@@ -14,8 +14,10 @@ static pde_t g_pd0_hw[PD0_SIZE >> 2] __attribute__((aligned(PD0_SIZE)));
 
 static struct mutex g_mmu_lock;
 static struct list_head g_pd1_head;
+static reg_t g_ttbr;
 
 void	mmu_real_switch(reg_t ttbr0);
+void	cpu_secondary_entry();
 
 static
 uint32_t mmu_get_sn_flags(int flags, char is_ssn, pa_t pa)
@@ -33,10 +35,13 @@ uint32_t mmu_get_sn_flags(int flags, char is_ssn, pa_t pa)
 		flags &= ~PROT_X;
 		val |= bits_on(PTE_SN_B);
 	} else {
-		// Normal, cacheable, Non-shared
+		// Normal, cacheable, Non-shared; Shared if there are multiple
+		// CPUs, to keep their caches coherent.
 		val |= bits_on(PTE_SN_B);
 		val |= bits_on(PTE_SN_C);
 		val |= bits_set(PTE_SN_TEX, 5);
+		if (NUM_CPUS > 1)
+			val |= bits_on(PTE_SN_S);
 	}
 
 	if (flags & PROT_W) {
@@ -74,10 +79,13 @@ uint32_t mmu_get_flags(int flags, char is_sn, char is_ssn, pa_t pa)
 		flags &= ~PROT_X;
 		val |= bits_on(PTE_B);
 	} else {
-		// Normal, cacheable, Non-Shared.
+		// Normal, cacheable, Non-Shared; Shared if there are multiple
+		// CPUs.
 		val |= bits_on(PTE_B);
 		val |= bits_on(PTE_C);
 		val |= bits_set(PTE_TEX, 5);
+		if (NUM_CPUS > 1)
+			val |= bits_on(PTE_S);
 	}
 
 	if (flags & PROT_W) {
@@ -204,6 +212,15 @@ int mmu_init(va_t *sys_end)
 	ix = bits_get(pa, PD0);
 	g_pd0_hw[ix] = val;
 
+#if NUM_CPUS > 1
+	// The secondary cores turn their MMUs on while running at the
+	// physical address of cpu_secondary_entry.
+	pa = va_to_pa((va_t)cpu_secondary_entry);
+	val = mmu_get_flags(flags, 1, 0, pa);
+	ix = bits_get(pa, PD0);
+	g_pd0_hw[ix] = val;
+#endif
+
 	// VA_BASE, RAM_MAP_BASE, SLABS_BASE and VMM_BASE are all sized
 	// 512MB, thus totalling 2GB of system address space.
 
@@ -226,8 +243,11 @@ int mmu_post_init(va_t sys_end)
 	val = 0;
 	val |= bits_on(TTBR_C);		// Inner Cacheable
 	val |= bits_set(TTBR_RGN, 1);	// Outer Cacheable, WB
+	if (NUM_CPUS > 1)
+		val |= bits_on(TTBR_S);	// Shared
 	val |= bits_push(TTBR_BASE, va_to_pa((va_t)g_pd0_hw));
 	ttbr = val;
+	g_ttbr = ttbr;
 
 	fn = (amrs_fn *)va_to_pa((va_t)mmu_real_switch);
 
@@ -244,6 +264,12 @@ int mmu_post_init(va_t sys_end)
 	(void)sys_end;
 }
 
+// The TTBR0 value the secondary cores load.
+reg_t mmu_get_ttbr()
+{
+	return g_ttbr;
+}
+
 //////////////////////////////////////////////////////////////////////////////
 static
 int mmu_alloc_pd(va_t *out_va, pa_t *out_pa)
@@ -6,6 +6,7 @@
 #include <sys/cpu.h>
 #include <sys/mutex.h>
 #include <sys/spinlock.h>
+#include <sys/trace.h>
 
 void mutex_init(struct mutex *m)
 {
@@ -44,6 +45,7 @@ void mutex_lock(struct mutex *m)
 			break;
 		}
 
+		trace(TRACE_MUTEX_WAIT, (uint32_t)m, (uint32_t)m->next);
 		thread_setup_wait(&m->wait_queue);
 		spin_unlock(&m->state_lock);
 		thread_wait();
@@ -80,3 +82,24 @@ void mutex_unlock(struct mutex *m)
 		thread_unwait(m->next);
 	cpu_lower_ipl(ipl, irq_mask);
 }
+
+// Called at ipl == IPL_SCHED.
+// Move t, which has been removed from some other wait queue, to the wait
+// queue of m, if m is held. The holder's mutex_unlock then hands m to t,
+// instead of t waking only to find m held. Returns 1 if t was queued.
+int mutex_requeue(struct mutex *m, struct thread *t)
+{
+	int queued;
+
+	assert(m);
+	assert(t);
+
+	queued = 0;
+	spin_lock(&m->state_lock);
+	if (m->lock) {
+		list_add_tail(&m->wait_queue, &t->wait_entry);
+		queued = 1;
+	}
+	spin_unlock(&m->state_lock);
+	return queued;
+}
@@ -0,0 +1,235 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright (c) 2021 Amol Surati
+
+#include <lib/assert.h>
+#include <lib/stdlib.h>
+
+#include <sys/err.h>
+#include <sys/perf.h>
+#include <sys/spinlock.h>
+
+#include <dev/con.h>
+
+#if __ARM_ARCH >= 7
+// Cortex-A7, through CP15 c9.
+#define PMCR_E_POS			0
+#define PMCR_P_POS			1
+#define PMCR_C_POS			2
+
+#define PMCR_E_BITS			1
+#define PMCR_P_BITS			1
+#define PMCR_C_BITS			1
+
+// PMCNTENSET: the cycle counter and counters 0 and 1.
+#define PMCNTEN_ALL			(bits_on(PMCNTEN_C) | 3)
+#define PMCNTEN_C_POS			31
+#define PMCNTEN_C_BITS			1
+
+static const uint8_t g_perf_ev_nums[] = {
+	[PERF_EV_ICACHE_MISS]		= 0x01,
+	[PERF_EV_DCACHE_MISS]		= 0x03,
+	[PERF_EV_ITLB_MISS]		= 0x02,
+	[PERF_EV_DTLB_MISS]		= 0x05,
+	[PERF_EV_BRANCH_MISPRED]	= 0x10,
+	[PERF_EV_INSTR]			= 0x08,
+};
+#else
+// ARM1176, through CP15 c15. The PMNC holds both the control bits and the
+// event numbers.
+#define PMNC_E_POS			0
+#define PMNC_P_POS			1
+#define PMNC_C_POS			2
+#define PMNC_FLAGS_POS			8
+#define PMNC_EV1_POS			12
+#define PMNC_EV0_POS			20
+
+#define PMNC_E_BITS			1
+#define PMNC_P_BITS			1
+#define PMNC_C_BITS			1
+#define PMNC_FLAGS_BITS			3
+#define PMNC_EV1_BITS			8
+#define PMNC_EV0_BITS			8
+
+static const uint8_t g_perf_ev_nums[] = {
+	[PERF_EV_ICACHE_MISS]		= 0x00,
+	[PERF_EV_DCACHE_MISS]		= 0x0b,
+	[PERF_EV_ITLB_MISS]		= 0x03,
+	[PERF_EV_DTLB_MISS]		= 0x04,
+	[PERF_EV_BRANCH_MISPRED]	= 0x06,
+	[PERF_EV_INSTR]			= 0x07,
+};
+#endif
+
+static const char *g_perf_ev_names[] = {
+	[PERF_EV_ICACHE_MISS]		= "icache_miss",
+	[PERF_EV_DCACHE_MISS]		= "dcache_miss",
+	[PERF_EV_ITLB_MISS]		= "itlb_miss",
+	[PERF_EV_DTLB_MISS]		= "dtlb_miss",
+	[PERF_EV_BRANCH_MISPRED]	= "br_mispred",
+	[PERF_EV_INSTR]			= "instr",
+};
+
+// perf_select bumps the gen; a cpu whose PMU was programmed for an older
+// gen counts the previous events, and is reprogrammed at its next
+// perf_begin.
+static enum perf_event g_perf_evs[2];
+static int g_perf_gen;
+static int g_perf_cpu_gens[NUM_CPUS];
+static struct perf_region *g_perf_regions;
+static struct spin_lock g_perf_lock;
+
+// Program the PMU of this cpu with the selected events, and reset its
+// counters.
+void perf_init_cpu()
+{
+	reg_t val;
+	enum perf_event evs[2];
+
+	spin_lock(&g_perf_lock);
+	evs[0] = g_perf_evs[0];
+	evs[1] = g_perf_evs[1];
+	g_perf_cpu_gens[cpu_get_index()] = g_perf_gen;
+	spin_unlock(&g_perf_lock);
+
+#if __ARM_ARCH >= 7
+	__asm volatile ("mcr	p15, 0, %0, c9, c12, 5" :: "r"(0));
+	isb();
+	val = g_perf_ev_nums[evs[0]];
+	__asm volatile ("mcr	p15, 0, %0, c9, c13, 1" :: "r"(val));
+	__asm volatile ("mcr	p15, 0, %0, c9, c12, 5" :: "r"(1));
+	isb();
+	val = g_perf_ev_nums[evs[1]];
+	__asm volatile ("mcr	p15, 0, %0, c9, c13, 1" :: "r"(val));
+
+	val = PMCNTEN_ALL;
+	__asm volatile ("mcr	p15, 0, %0, c9, c12, 1" :: "r"(val));
+	val = bits_on(PMCR_E) | bits_on(PMCR_P) | bits_on(PMCR_C);
+	__asm volatile ("mcr	p15, 0, %0, c9, c12, 0" :: "r"(val));
+#else
+	// Writing 1s to the overflow flags clears them.
+	val = bits_on(PMNC_E) | bits_on(PMNC_P) | bits_on(PMNC_C);
+	val |= bits_on(PMNC_FLAGS);
+	val |= bits_set(PMNC_EV0, g_perf_ev_nums[evs[0]]);
+	val |= bits_set(PMNC_EV1, g_perf_ev_nums[evs[1]]);
+	__asm volatile ("mcr	p15, 0, %0, c15, c12, 0" :: "r"(val));
+#endif
+	isb();
+}
+
+// Called on cpu0, before the secondaries start.
+int perf_init()
+{
+	spin_lock_init(&g_perf_lock, IPL_HARD);
+	g_perf_evs[0] = PERF_EV_DCACHE_MISS;
+	g_perf_evs[1] = PERF_EV_INSTR;
+	perf_init_cpu();
+	return ERR_SUCCESS;
+}
+
+// Called with the lock held.
+static
+void perf_reset_region(struct perf_region *r)
+{
+	r->num_calls = 0;
+	r->min_cycles = -1;
+	r->max_cycles = 0;
+	r->cycles = 0;
+	r->evs[0] = 0;
+	r->evs[1] = 0;
+}
+
+// Takes effect on this cpu at once, and on each of the other cpus at its
+// next perf_begin. The region totals are reset, as the counts they hold are
+// for the previous events; the regions which began before the select are
+// not counted.
+int perf_select(enum perf_event ev0, enum perf_event ev1)
+{
+	struct perf_region *r;
+
+	if (ev0 >= NUM_PERF_EVENTS || ev1 >= NUM_PERF_EVENTS)
+		return ERR_PARAM;
+	spin_lock(&g_perf_lock);
+	g_perf_evs[0] = ev0;
+	g_perf_evs[1] = ev1;
+	++g_perf_gen;
+	for (r = g_perf_regions; r; r = r->next)
+		perf_reset_region(r);
+	spin_unlock(&g_perf_lock);
+	perf_init_cpu();
+	return ERR_SUCCESS;
+}
+
+// Any IPL.
+void perf_begin(struct perf_sample *s)
+{
+	int gen;
+
+	gen = g_perf_cpu_gens[cpu_get_index()];
+	if (gen != atomic_read(&g_perf_gen))
+		perf_init_cpu();
+	s->gen = g_perf_cpu_gens[cpu_get_index()];
+	perf_read(s);
+}
+
+// Any IPL.
+void perf_end(struct perf_region *r, const struct perf_sample *s)
+{
+	struct perf_sample e;
+	uint32_t cycles;
+
+	perf_read(&e);
+
+	// The counters are 32-bit; differences survive a single wrap.
+	cycles = e.cycles - s->cycles;
+
+	spin_lock(&g_perf_lock);
+
+	// The events changed since the region began.
+	if (s->gen != g_perf_gen) {
+		spin_unlock(&g_perf_lock);
+		return;
+	}
+	if (!r->is_listed) {
+		r->next = g_perf_regions;
+		g_perf_regions = r;
+		r->is_listed = 1;
+	}
+	++r->num_calls;
+	r->cycles += cycles;
+	r->evs[0] += e.evs[0] - s->evs[0];
+	r->evs[1] += e.evs[1] - s->evs[1];
+	if (cycles < r->min_cycles)
+		r->min_cycles = cycles;
+	if (cycles > r->max_cycles)
+		r->max_cycles = cycles;
+	spin_unlock(&g_perf_lock);
+}
+
+void perf_reset()
+{
+	struct perf_region *r;
+
+	spin_lock(&g_perf_lock);
+	for (r = g_perf_regions; r; r = r->next)
+		perf_reset_region(r);
+	spin_unlock(&g_perf_lock);
+}
+
+// IPL_THREAD
+void perf_dump()
+{
+	struct perf_region *r;
+	uint64_t avg;
+
+	con_out("perf: events %s %s", g_perf_ev_names[g_perf_evs[0]],
+		g_perf_ev_names[g_perf_evs[1]]);
+	for (r = g_perf_regions; r; r = r->next) {
+		if (r->num_calls == 0)
+			continue;
+		avg = divmod(r->cycles, r->num_calls, NULL);
+		con_out("perf: %s calls %d cycles %ld avg %ld min %d max %d "
+			"ev0 %ld ev1 %ld", r->name, r->num_calls, r->cycles,
+			avg, r->min_cycles, r->max_cycles, r->evs[0],
+			r->evs[1]);
+	}
+}
@@ -0,0 +1,86 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright (c) 2021 Amol Surati
+
+#include <lib/assert.h>
+
+#include <sys/cpu.h>
+#include <sys/err.h>
+#include <sys/semaphore.h>
+#include <sys/thread.h>
+
+void semaphore_init(struct semaphore *s, int count)
+{
+	assert(s);
+	assert(count >= 0);
+	s->count = count;
+	spin_lock_init(&s->lock, IPL_SCHED);
+	list_init(&s->wait_queue);
+}
+
+// Called at ipl == IPL_THREAD.
+void semaphore_down(struct semaphore *s)
+{
+	enum ipl ipl;
+	reg_t irq_mask;
+
+	assert(s);
+
+	ipl = cpu_raise_ipl(IPL_SCHED, &irq_mask);
+	assert(ipl == IPL_THREAD);
+	spin_lock(&s->lock);
+	if (s->count) {
+		--s->count;
+		spin_unlock(&s->lock);
+		cpu_lower_ipl(ipl, irq_mask);
+		return;
+	}
+
+	// semaphore_up hands its unit directly to the woken thread.
+	thread_setup_wait(&s->wait_queue);
+	spin_unlock(&s->lock);
+	thread_wait();
+	cpu_lower_ipl(ipl, irq_mask);
+}
+
+// Called at ipl == IPL_SCHED or IPL_THREAD.
+int semaphore_try_down(struct semaphore *s)
+{
+	int err;
+
+	assert(s);
+
+	err = ERR_PENDING;
+	spin_lock(&s->lock);
+	if (s->count) {
+		--s->count;
+		err = ERR_SUCCESS;
+	}
+	spin_unlock(&s->lock);
+	return err;
+}
+
+// Called at ipl == IPL_SCHED or IPL_THREAD.
+void semaphore_up(struct semaphore *s)
+{
+	enum ipl ipl;
+	struct list_head *e;
+	struct thread *t;
+	reg_t irq_mask;
+
+	assert(s);
+
+	t = NULL;
+	ipl = cpu_raise_ipl(IPL_SCHED, &irq_mask);
+	assert(ipl == IPL_SCHED || ipl == IPL_THREAD);
+	spin_lock(&s->lock);
+	if (list_is_empty(&s->wait_queue)) {
+		++s->count;
+	} else {
+		e = list_del_head(&s->wait_queue);
+		t = list_entry(e, struct thread, wait_entry);
+	}
+	spin_unlock(&s->lock);
+	if (t)
+		thread_unwait(t);
+	cpu_lower_ipl(ipl, irq_mask);
+}
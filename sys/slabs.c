@@ -136,7 +136,7 @@ int slab_se_init(int slab_ix, struct slab_entry *se, vpn_t page,
 	slab->num_free += se->num_free;
 	list_add_tail(&slab->free_head, &se->entry);
 	slab->flags &= ~1;
-	cond_var_signal(&slab->wait);
+	cond_var_broadcast(&slab->wait);
 	mutex_unlock(&slab->lock);
 	return ERR_SUCCESS;
 }
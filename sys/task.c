@@ -0,0 +1,289 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright (c) 2021 Amol Surati
+
+#include <lib/assert.h>
+
+#include <sys/atomic.h>
+#include <sys/cpu.h>
+#include <sys/err.h>
+#include <sys/task.h>
+#include <sys/thread.h>
+
+#define TASK_DEQUE_SIZE_BITS		6
+#define TASK_DEQUE_SIZE			(1ul << TASK_DEQUE_SIZE_BITS)
+#define TASK_DEQUE_MASK			(TASK_DEQUE_SIZE - 1)
+
+// The owning cpu pushes and pops at the tail. Thieves take from the head,
+// where the oldest, and usually the largest, tasks are.
+struct task_deque {
+	struct spin_lock		lock;
+	unsigned int			head;
+	unsigned int			tail;
+	int				num_tasks;
+	struct task			*tasks[TASK_DEQUE_SIZE];
+};
+
+static struct task_deque g_task_deques[NUM_CPUS];
+
+// Workers with nothing to run wait here.
+static struct spin_lock g_task_idle_lock;
+static struct list_head g_task_idle_queue;
+static int g_task_num_idle;
+
+// Called at IPL_SCHED
+static
+int task_push(struct task_deque *d, struct task *t)
+{
+	int err;
+
+	err = ERR_NO_MEM;
+	spin_lock(&d->lock);
+	if (d->tail - d->head < TASK_DEQUE_SIZE) {
+		d->tasks[d->tail & TASK_DEQUE_MASK] = t;
+		++d->tail;
+		atomic_add(&d->num_tasks, 1);
+		err = ERR_SUCCESS;
+	}
+	spin_unlock(&d->lock);
+	return err;
+}
+
+// Called at IPL_SCHED
+static
+struct task *task_pop(struct task_deque *d, char is_tail)
+{
+	struct task *t;
+
+	if (atomic_read(&d->num_tasks) == 0)
+		return NULL;
+
+	t = NULL;
+	spin_lock(&d->lock);
+	if (d->tail != d->head) {
+		if (is_tail)
+			t = d->tasks[--d->tail & TASK_DEQUE_MASK];
+		else
+			t = d->tasks[d->head++ & TASK_DEQUE_MASK];
+		atomic_add(&d->num_tasks, -1);
+	}
+	spin_unlock(&d->lock);
+	return t;
+}
+
+// IPL_THREAD
+// Pop the newest task of this cpu, else steal the oldest task of another.
+static
+struct task *task_find()
+{
+	int i, ix;
+	enum ipl ipl;
+	reg_t irq_mask;
+	struct task *t;
+
+	ipl = cpu_raise_ipl(IPL_SCHED, &irq_mask);
+	ix = cpu_get_index();
+	t = task_pop(&g_task_deques[ix], 1);
+	for (i = 1; t == NULL && i < NUM_CPUS; ++i)
+		t = task_pop(&g_task_deques[(ix + i) % NUM_CPUS], 0);
+	cpu_lower_ipl(ipl, irq_mask);
+	return t;
+}
+
+// Called at IPL_SCHED
+static
+char task_any()
+{
+	int i;
+
+	for (i = 0; i < NUM_CPUS; ++i)
+		if (atomic_read(&g_task_deques[i].num_tasks))
+			return 1;
+	return 0;
+}
+
+// IPL_THREAD
+static
+void task_run(struct task *t)
+{
+	enum ipl ipl;
+	reg_t irq_mask;
+	struct list_head *e;
+	struct task_group *g;
+	struct thread *waiter;
+
+	g = t->group;
+	t->fn(t->p);
+
+	// Once num_pending drops to 0, neither the task nor its group can be
+	// touched; task_sync may have returned.
+	waiter = NULL;
+	ipl = cpu_raise_ipl(IPL_SCHED, &irq_mask);
+	spin_lock(&g->lock);
+	assert(g->num_pending > 0);
+	if (--g->num_pending == 0 && !list_is_empty(&g->wait_queue)) {
+		e = list_del_head(&g->wait_queue);
+		waiter = list_entry(e, struct thread, wait_entry);
+	}
+	spin_unlock(&g->lock);
+	if (waiter)
+		thread_unwait(waiter);
+	cpu_lower_ipl(ipl, irq_mask);
+}
+
+// IPL_THREAD
+static
+int task_worker(void *p)
+{
+	enum ipl ipl;
+	reg_t irq_mask;
+	struct task *t;
+
+	for (;;) {
+		t = task_find();
+		if (t) {
+			task_run(t);
+			continue;
+		}
+
+		ipl = cpu_raise_ipl(IPL_SCHED, &irq_mask);
+		spin_lock(&g_task_idle_lock);
+		atomic_add(&g_task_num_idle, 1);
+
+		// Pairs with the dmb in task_spawn. Either the spawner sees
+		// this worker as idle, or the worker sees the spawned task.
+		dmb();
+		if (task_any()) {
+			atomic_add(&g_task_num_idle, -1);
+			spin_unlock(&g_task_idle_lock);
+			cpu_lower_ipl(ipl, irq_mask);
+			continue;
+		}
+		thread_setup_wait(&g_task_idle_queue);
+		spin_unlock(&g_task_idle_lock);
+		thread_wait();
+		cpu_lower_ipl(ipl, irq_mask);
+	}
+	return ERR_SUCCESS;
+	(void)p;
+}
+
+// Called at IPL_SCHED
+static
+void task_wake_worker()
+{
+	struct list_head *e;
+	struct thread *t;
+
+	dmb();
+	if (atomic_read(&g_task_num_idle) == 0)
+		return;
+
+	t = NULL;
+	spin_lock(&g_task_idle_lock);
+	if (!list_is_empty(&g_task_idle_queue)) {
+		e = list_del_head(&g_task_idle_queue);
+		t = list_entry(e, struct thread, wait_entry);
+		atomic_add(&g_task_num_idle, -1);
+	}
+	spin_unlock(&g_task_idle_lock);
+	if (t)
+		thread_unwait(t);
+}
+
+void task_group_init(struct task_group *g)
+{
+	assert(g);
+	g->num_pending = 0;
+	spin_lock_init(&g->lock, IPL_SCHED);
+	list_init(&g->wait_queue);
+}
+
+// IPL_THREAD
+// If the deque of this cpu is full, the task runs right away.
+void task_spawn(struct task_group *g, struct task *t, fn_task *fn, void *p)
+{
+	int err;
+	enum ipl ipl;
+	reg_t irq_mask;
+
+	assert(g);
+	assert(t);
+	assert(fn);
+
+	t->fn = fn;
+	t->p = p;
+	t->group = g;
+
+	ipl = cpu_raise_ipl(IPL_SCHED, &irq_mask);
+	assert(ipl == IPL_THREAD);
+	spin_lock(&g->lock);
+	++g->num_pending;
+	spin_unlock(&g->lock);
+
+	err = task_push(&g_task_deques[cpu_get_index()], t);
+	if (!err)
+		task_wake_worker();
+	cpu_lower_ipl(ipl, irq_mask);
+
+	if (err)
+		task_run(t);
+}
+
+// IPL_THREAD
+// Run the queued tasks, of any group, until all of the tasks of this group
+// are done. Block only when there is nothing left to run.
+void task_sync(struct task_group *g)
+{
+	enum ipl ipl;
+	reg_t irq_mask;
+	struct task *t;
+
+	assert(g);
+
+	for (;;) {
+		t = task_find();
+		if (t) {
+			task_run(t);
+			continue;
+		}
+
+		ipl = cpu_raise_ipl(IPL_SCHED, &irq_mask);
+		assert(ipl == IPL_THREAD);
+		spin_lock(&g->lock);
+		if (g->num_pending == 0) {
+			spin_unlock(&g->lock);
+			cpu_lower_ipl(ipl, irq_mask);
+			break;
+		}
+		thread_setup_wait(&g->wait_queue);
+		spin_unlock(&g->lock);
+		thread_wait();
+		cpu_lower_ipl(ipl, irq_mask);
+	}
+}
+
+// IPL_THREAD
+// One worker per cpu. The scheduler spreads them over the online cpus.
+int task_init()
+{
+	int i, err;
+	struct thread *t;
+
+	spin_lock_init(&g_task_idle_lock, IPL_SCHED);
+	list_init(&g_task_idle_queue);
+	g_task_num_idle = 0;
+
+	for (i = 0; i < NUM_CPUS; ++i) {
+		spin_lock_init(&g_task_deques[i].lock, IPL_SCHED);
+		g_task_deques[i].head = 0;
+		g_task_deques[i].tail = 0;
+		g_task_deques[i].num_tasks = 0;
+	}
+
+	for (i = 0; i < NUM_CPUS; ++i) {
+		err = thread_create(task_worker, NULL, &t);
+		if (err)
+			return err;
+	}
+	return ERR_SUCCESS;
+}
@@ -0,0 +1,120 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright (c) 2021 Amol Surati
+
+#include <lib/assert.h>
+
+#include <sys/atomic.h>
+#include <sys/err.h>
+#include <sys/tasklet.h>
+
+void tasklet_init(struct tasklet *t, fn_tasklet *fn, void *p)
+{
+	assert(t);
+	assert(fn);
+
+	t->next = NULL;
+	t->fn = fn;
+	t->p = p;
+	t->is_queued = 0;
+}
+
+// Any IPL, but not from the FIQ handler.
+void tasklet_schedule(struct tasklet *t)
+{
+	enum ipl ipl;
+	reg_t irq_mask;
+	struct cpu *cpu;
+
+	ipl = cpu_raise_ipl(IPL_HARD, &irq_mask);
+	if (!t->is_queued) {
+		cpu = cpu_get();
+		t->is_queued = 1;
+		t->next = NULL;
+		*cpu->tasklet_tail = t;
+		cpu->tasklet_tail = &t->next;
+	}
+	cpu_lower_ipl(ipl, irq_mask);
+}
+
+// Called at IPL_SCHED, with IRQs disabled, from cpu_lower_ipl.
+// The tasklet can be scheduled again as soon as it is off the queue, even
+// by its own fn.
+struct tasklet *tasklet_dequeue(struct cpu *cpu)
+{
+	struct tasklet *t;
+
+	t = cpu->tasklet_head;
+	if (t == NULL)
+		return NULL;
+	cpu->tasklet_head = t->next;
+	if (cpu->tasklet_head == NULL)
+		cpu->tasklet_tail = &cpu->tasklet_head;
+	t->is_queued = 0;
+	return t;
+}
+
+// Called at IPL_SCHED
+static
+void softq_run(void *p)
+{
+	int i;
+	void *item;
+	struct softq *q;
+
+	q = p;
+	for (i = 0; i < SOFTQ_BATCH; ++i) {
+		if (q->tail == (unsigned int)atomic_read((int *)&q->head))
+			return;
+		item = q->items[q->tail & (q->size - 1)];
+
+		// Read the item before giving its slot back.
+		dmb();
+		atomic_write((int *)&q->tail, q->tail + 1);
+		q->fn(item, q->p);
+	}
+
+	// Let the other sources have a turn.
+	if (q->tail != (unsigned int)atomic_read((int *)&q->head))
+		tasklet_schedule(&q->tasklet);
+}
+
+int softq_init(struct softq *q, void **items, unsigned int size,
+	       fn_softq *fn, void *p)
+{
+	assert(q);
+	assert(items);
+	assert(fn);
+
+	if (size == 0 || (size & (size - 1)))
+		return ERR_PARAM;
+
+	tasklet_init(&q->tasklet, softq_run, q);
+	q->fn = fn;
+	q->p = p;
+	q->items = items;
+	q->size = size;
+	q->head = 0;
+	q->tail = 0;
+	q->num_dropped = 0;
+	return ERR_SUCCESS;
+}
+
+// IPL_HARD
+// An item which does not fit is dropped, and counted.
+int softq_push(struct softq *q, void *item)
+{
+	unsigned int head;
+
+	head = q->head;
+	if (head - (unsigned int)atomic_read((int *)&q->tail) >= q->size) {
+		++q->num_dropped;
+		return ERR_NO_MEM;
+	}
+	q->items[head & (q->size - 1)] = item;
+
+	// Write the item before publishing it.
+	dmb();
+	atomic_write((int *)&q->head, head + 1);
+	tasklet_schedule(&q->tasklet);
+	return ERR_SUCCESS;
+}
@@ -4,14 +4,23 @@
 #include <lib/assert.h>
 #include <lib/stdlib.h>
 
+#include <sys/atomic.h>
 #include <sys/cpu.h>
 #include <sys/err.h>
 #include <sys/list.h>
 #include <sys/pmm.h>
 #include <sys/vmm.h>
 #include <sys/thread.h>
+#include <sys/trace.h>
 
-int thread_idle_thread()
+void	thread_switch(struct thread *curr, struct thread *next);
+void	thread_enter();
+
+// The exited threads, whose stacks are yet to be freed.
+static struct thread *g_thread_dead;
+
+// The boot thread of cpu0; it runs on the stack set up by crt0.
+int thread_boot_thread()
 {
 	int err;
 	struct thread *t;
@@ -25,8 +34,202 @@ int thread_idle_thread()
 	if (err)
 		return err;
 
-	for (;;)
-		cpu_yield();
+	thread_exit();
+	return ERR_SUCCESS;
+}
+
+// Called at IPL_SCHED, from thread_enter.
+void thread_start(fn_thread *fn, void *p)
+{
+	cpu_lower_ipl(IPL_THREAD, 0);
+	fn(p);
+	thread_exit();
+}
+
+// Called at IPL_SCHED
+static
+int thread_cpu_load(struct cpu *cpu)
+{
+	int load;
+
+	load = atomic_read(&cpu->num_ready);
+	if (cpu->curr_thread != cpu->idle_thread)
+		++load;
+	return load;
+}
+
+// Called at IPL_SCHED
+// Prefer the CPU which last ran the thread, unless another online CPU is
+// less loaded.
+static
+struct cpu *thread_select_cpu(struct thread *t)
+{
+	int i, load, min_load;
+	struct cpu *cpu, *best;
+
+	best = t->cpu ? t->cpu : cpu_get();
+	min_load = thread_cpu_load(best);
+	for (i = 0; min_load && i < NUM_CPUS; ++i) {
+		cpu = cpu_get_by_index(i);
+		if (cpu == best || !cpu->online)
+			continue;
+		load = thread_cpu_load(cpu);
+		if (load >= min_load)
+			continue;
+		best = cpu;
+		min_load = load;
+	}
+	return best;
+}
+
+// Called at IPL_SCHED
+static
+void thread_enqueue(struct cpu *cpu, struct thread *t)
+{
+	assert(t != cpu->idle_thread);
+
+	cpu_rq_lock(cpu);
+	t->state = THREAD_STATE_READY;
+	t->cpu = cpu;
+	list_add_tail(&cpu->ready_queue, &t->wait_entry);
+	atomic_add(&cpu->num_ready, 1);
+	cpu_rq_unlock(cpu);
+
+	if (cpu != cpu_get())
+		cpu_send_ipi(cpu->index, IPI_RESCHED);
+}
+
+// Called at IPL_SCHED
+// Remove from the head of the cpu's ready_queue if is_head, else from its
+// tail.
+static
+struct thread *thread_dequeue(struct cpu *cpu, char is_head)
+{
+	struct list_head *e;
+	struct thread *t;
+
+	if (atomic_read(&cpu->num_ready) == 0)
+		return NULL;
+
+	t = NULL;
+	cpu_rq_lock(cpu);
+	if (!list_is_empty(&cpu->ready_queue)) {
+		if (is_head)
+			e = list_del_head(&cpu->ready_queue);
+		else
+			e = list_del_tail(&cpu->ready_queue);
+		t = list_entry(e, struct thread, wait_entry);
+		atomic_add(&cpu->num_ready, -1);
+	}
+	cpu_rq_unlock(cpu);
+	return t;
+}
+
+// Called at IPL_SCHED
+// Take the most recently queued thread from the busiest other CPU.
+static
+struct thread *thread_steal(struct cpu *self)
+{
+	int i, num, max_num;
+	struct cpu *cpu, *busiest;
+
+	busiest = NULL;
+	max_num = 0;
+	for (i = 0; i < NUM_CPUS; ++i) {
+		cpu = cpu_get_by_index(i);
+		if (cpu == self || !cpu->online)
+			continue;
+		num = atomic_read(&cpu->num_ready);
+		if (num <= max_num)
+			continue;
+		busiest = cpu;
+		max_num = num;
+	}
+
+	if (busiest == NULL)
+		return NULL;
+	return thread_dequeue(busiest, 0);
+}
+
+// Called at IPL_SCHED
+static
+struct thread *thread_pick(struct cpu *cpu)
+{
+	struct thread *t;
+
+	t = thread_dequeue(cpu, 1);
+	if (t == NULL && NUM_CPUS > 1)
+		t = thread_steal(cpu);
+	return t;
+}
+
+// Called at IPL_SCHED
+static
+void thread_switch_to(struct thread *curr, struct thread *next)
+{
+	struct cpu *cpu;
+
+	cpu = cpu_get();
+
+	// A yielding thread is queued before its CPU switches away from it.
+	// Wait until that CPU has saved its registers.
+	while (atomic_read(&next->on_cpu))
+		;
+	dmb();
+
+	next->on_cpu = 1;
+	next->cpu = cpu;
+	next->state = THREAD_STATE_RUNNING;
+
+	// The thread_switch may not return to the caller. It may return to
+	// thread_enter, for instance. Either have all such return points call
+	// cpu_set_curr_thread, or call it before the thread is changed.
+	trace(TRACE_THREAD_SWITCH, (uint32_t)curr, (uint32_t)next);
+	cpu_set_curr_thread(next);
+	thread_switch(curr, next);
+}
+
+// Called at IPL_SCHED
+// The curr thread can no longer run; switch to another, or to the idle
+// thread.
+static
+void thread_sched(struct thread *curr)
+{
+	struct cpu *cpu;
+	struct thread *next;
+
+	cpu = cpu_get();
+	assert(curr != cpu->idle_thread);
+
+	next = thread_pick(cpu);
+	if (next == NULL)
+		next = cpu->idle_thread;
+	thread_switch_to(curr, next);
+}
+
+// IPL_THREAD
+// Free the stacks of the exited threads. The stack of a thread is free to
+// go once its cpu has switched away from it. The frees take mutexes, so
+// they cannot be done at IPL_SCHED, where the switch happens.
+static
+void thread_reap()
+{
+	struct thread *t, *next;
+
+	do {
+		t = g_thread_dead;
+	} while (atomic_cmpxchg((int *)&g_thread_dead, (int)t, 0) != (int)t);
+
+	for (; t; t = next) {
+		next = t->next_dead;
+		while (atomic_read(&t->on_cpu))
+			;
+		dmb();
+		mmu_unmap_page(0, va_to_vpn(t->stack));
+		vmm_free(va_to_vpn(t->stack), 1);
+		pmm_free(t->stack_frame, 1);
+		free(t);
+	}
 }
 
 // IPL_THREAD
@@ -39,8 +242,8 @@ int thread_create(fn_thread *fn, void *p, struct thread **out)
 	va_t va;
 	reg_t mask;
 	enum ipl prev_ipl;
-	struct list_head *rq;
-	void	thread_enter();
+
+	thread_reap();
 
 	err = ERR_NO_MEM;
 	t = malloc(sizeof(*t));
@@ -60,16 +263,18 @@ int thread_create(fn_thread *fn, void *p, struct thread **out)
 		goto err3;
 
 	va = vpn_to_va(page);
+	t->stack = va;
+	t->stack_frame = frame;
 	va += PAGE_SIZE;
 	t->regs[0] = va;			// sp
 	t->regs[1] = (va_t)thread_enter;	// lr
 	t->regs[2] = (va_t)fn;			// r4
 	t->regs[3] = (va_t)p;			// r5
-	t->state = THREAD_STATE_READY;
+	t->on_cpu = 0;
+	t->cpu = NULL;
 
 	prev_ipl = cpu_raise_ipl(IPL_SCHED, &mask);
-	rq = cpu_get_ready_queue();
-	list_add_tail(rq, &t->wait_entry);
+	thread_enqueue(thread_select_cpu(t), t);
 	cpu_lower_ipl(prev_ipl, mask);
 	*out = t;
 	return ERR_SUCCESS;
@@ -83,16 +288,54 @@ err0:
 	return err;
 }
 
+// The idle thread is never queued on a ready_queue. It runs when its CPU
+// has nothing else to run.
+void thread_init_idle(struct thread *t, struct cpu *cpu, va_t sp)
+{
+	t->regs[0] = sp;
+	t->regs[1] = (va_t)thread_enter;
+	t->regs[2] = (va_t)thread_idle;
+	t->regs[3] = 0;
+	t->on_cpu = 0;
+	t->cpu = cpu;
+	t->state = THREAD_STATE_READY;
+	t->stack = 0;
+}
+
+// IPL_THREAD
+int thread_idle(void *p)
+{
+	enum ipl ipl;
+	reg_t irq_mask;
+
+	for (;;) {
+		ipl = cpu_raise_ipl(IPL_SCHED, &irq_mask);
+		thread_yield();
+		cpu_lower_ipl(ipl, irq_mask);
+		cpu_idle_wait();
+	}
+	return ERR_SUCCESS;
+	(void)p;
+}
+
 // Called at IPL_SCHED
 void thread_unwait(struct thread *t)
 {
-	struct list_head *rq;
-	assert(t->state == THREAD_STATE_WAITING ||
-	       t->state == THREAD_STATE_SETUP_WAIT);
+	int state;
 
-	rq = cpu_get_ready_queue();
-	t->state = THREAD_STATE_READY;
-	list_add_tail(rq, &t->wait_entry);
+	// A thread woken before it could call thread_wait continues to run.
+	state = atomic_cmpxchg((int *)&t->state, THREAD_STATE_SETUP_WAIT,
+			       THREAD_STATE_RUNNING);
+	if (state == THREAD_STATE_SETUP_WAIT)
+		return;
+	assert(state == THREAD_STATE_WAITING);
+
+	// The thread has committed to sleep; its CPU may still be switching
+	// away from it.
+	while (atomic_read(&t->on_cpu))
+		;
+	dmb();
+	thread_enqueue(thread_select_cpu(t), t);
 }
 
 // Called at IPL_SCHED
@@ -109,40 +352,63 @@ void thread_setup_wait(struct list_head *wq)
 // Called at IPL_SCHED
 void thread_wait()
 {
-	struct thread *curr, *next, *idle;
-	struct list_head *rq, *e;
-	void	thread_switch(struct thread *curr, struct thread *next);
+	int state;
+	struct thread *curr;
 
 	curr = cpu_get_curr_thread();
-	idle = cpu_get_idle_thread();
 
-	// Valid only on uniprocessor.
-	assert(curr->state == THREAD_STATE_SETUP_WAIT);
-
-	rq = cpu_get_ready_queue();
-	if (list_is_empty(rq)) {
-		curr->state = THREAD_STATE_RUNNING;
+	// If already woken, the state is back to running.
+	state = atomic_cmpxchg((int *)&curr->state, THREAD_STATE_SETUP_WAIT,
+			       THREAD_STATE_WAITING);
+	if (state != THREAD_STATE_SETUP_WAIT) {
+		assert(state == THREAD_STATE_RUNNING);
 		return;
 	}
+	thread_sched(curr);
+}
 
-	e = list_del_head(rq);
-	next = list_entry(e, struct thread, wait_entry);
+// Called at IPL_SCHED
+// Let another ready thread run, if there is one.
+void thread_yield()
+{
+	struct cpu *cpu;
+	struct thread *curr, *next;
 
-	if (next == idle && !list_is_empty(rq)) {
-		list_add_tail(rq, &next->wait_entry);
-		e = list_del_head(rq);
-		next = list_entry(e, struct thread, wait_entry);
-	}
+	cpu = cpu_get();
+	curr = cpu_get_curr_thread();
 
-	// TODO update ticks for next if required.
+	next = thread_pick(cpu);
+	if (next == NULL)
+		return;
 
-	if (curr->state == THREAD_STATE_RUNNING) {
+	if (curr == cpu->idle_thread)
 		curr->state = THREAD_STATE_READY;
-		list_add_tail(rq, &curr->wait_entry);
+	else
+		thread_enqueue(cpu, curr);
+	thread_switch_to(curr, next);
+}
+
+// IPL_THREAD
+// The stack and the struct thread are freed by a later thread_exit or
+// thread_create; the boot thread runs on the stack of crt0, and is never
+// freed.
+void thread_exit()
+{
+	reg_t mask;
+	struct thread *curr, *head;
+
+	thread_reap();
+
+	cpu_raise_ipl(IPL_SCHED, &mask);
+	curr = cpu_get_curr_thread();
+	curr->state = THREAD_STATE_EXITED;
+	if (curr->stack) {
+		do {
+			head = g_thread_dead;
+			curr->next_dead = head;
+		} while (atomic_cmpxchg((int *)&g_thread_dead, (int)head,
+					(int)curr) != (int)head);
 	}
-	// The thread_switch may not return to thread_wait. It may return to
-	// thread_enter, for instance. Either have all such return points call
-	// cpu_set_curr_thread, or call it before the thread is changed.
-	cpu_set_curr_thread(next);
-	thread_switch(curr, next);
+	thread_sched(curr);
+	assert(0);
 }
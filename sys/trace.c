@@ -0,0 +1,136 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright (c) 2021 Amol Surati
+
+#include <lib/assert.h>
+
+#include <sys/atomic.h>
+#include <sys/cpu.h>
+#include <sys/err.h>
+#include <sys/trace.h>
+
+#include <dev/con.h>
+#include <dev/tmr.h>
+
+#define TRACE_NUM_RECS_BITS		10
+#define TRACE_NUM_RECS			(1ul << TRACE_NUM_RECS_BITS)
+#define TRACE_NUM_RECS_MASK		(TRACE_NUM_RECS - 1)
+
+// Per-cpu rings of binary records. The oldest records are overwritten. A
+// slot is reserved with an atomic add, so that an IRQ handler tracing on the
+// same cpu does not overwrite a record half-way through.
+struct trace_buf {
+	int				head;
+	struct trace_rec		recs[TRACE_NUM_RECS];
+};
+
+uint32_t g_trace_mask;
+static struct trace_buf g_trace_bufs[NUM_CPUS]
+	__attribute__((aligned(CACHE_LINE_SIZE)));
+
+static const char *g_trace_names[] = {
+	[TRACE_IRQ]			= "irq",
+	[TRACE_THREAD_SWITCH]		= "switch",
+	[TRACE_MUTEX_WAIT]		= "mutex_wait",
+	[TRACE_V3D_IRQ]			= "v3d_irq",
+	[TRACE_V3D_RUN_PROG]		= "v3d_prog",
+	[TRACE_V3D_RUN_BINNER]		= "v3d_bin",
+	[TRACE_V3D_RUN_RENDERER]	= "v3d_rndr",
+};
+
+// Any IPL. Timestamps are valid once tmr_init is done; trace_set_mask must
+// not enable tracing before that.
+void trace_record(enum trace_event event, uint32_t a0, uint32_t a1)
+{
+	int ix;
+	struct trace_buf *tb;
+	struct trace_rec *r;
+
+	ix = cpu_get_index();
+	tb = &g_trace_bufs[ix];
+	r = &tb->recs[(atomic_add(&tb->head, 1) - 1) & TRACE_NUM_RECS_MASK];
+	r->ts = tmr_get_ctr();
+	r->event = event;
+	r->cpu = ix;
+	r->args[0] = a0;
+	r->args[1] = a1;
+}
+
+void trace_set_mask(uint32_t mask)
+{
+	g_trace_mask = mask;
+}
+
+// Discard the recorded events, on all the cpus. Tracing must be disabled.
+void trace_reset()
+{
+	int i;
+
+	assert(g_trace_mask == 0);
+	for (i = 0; i < NUM_CPUS; ++i)
+		atomic_write(&g_trace_bufs[i].head, 0);
+}
+
+// The position of the oldest retained record.
+static
+int trace_first(int head)
+{
+	return head > (int)TRACE_NUM_RECS ? head - (int)TRACE_NUM_RECS : 0;
+}
+
+// Copy up to num of the retained records, of all the cpus, merged in the
+// order of their timestamps, into out. Returns the number copied. Intended
+// to be called with tracing disabled.
+int trace_copy(struct trace_rec *out, int num)
+{
+	int i, j, best, pos[NUM_CPUS], head[NUM_CPUS];
+	const struct trace_rec *r, *min;
+
+	for (i = 0; i < NUM_CPUS; ++i) {
+		head[i] = atomic_read(&g_trace_bufs[i].head);
+		pos[i] = trace_first(head[i]);
+	}
+
+	for (j = 0; j < num; ++j) {
+		min = NULL;
+		best = 0;
+		for (i = 0; i < NUM_CPUS; ++i) {
+			if (pos[i] == head[i])
+				continue;
+			r = &g_trace_bufs[i].recs[pos[i] & TRACE_NUM_RECS_MASK];
+
+			// The timer wraps; compare the differences.
+			if (min && (int32_t)(r->ts - min->ts) >= 0)
+				continue;
+			min = r;
+			best = i;
+		}
+		if (min == NULL)
+			break;
+		out[j] = *min;
+		++pos[best];
+	}
+	return j;
+}
+
+// IPL_THREAD
+// Format the retained records over the console. Timestamps are in
+// microseconds, relative to the first record. Each line is flushed, so that
+// the console ring does not drop any.
+void trace_dump()
+{
+	int i, num;
+	uint32_t start;
+	const char *name;
+	static struct trace_rec recs[NUM_CPUS * TRACE_NUM_RECS];
+
+	num = trace_copy(recs, NUM_CPUS * TRACE_NUM_RECS);
+	start = num ? recs[0].ts : 0;
+	for (i = 0; i < num; ++i) {
+		name = "?";
+		if (recs[i].event < NUM_TRACE_EVENTS)
+			name = g_trace_names[recs[i].event];
+		con_out("trace: %d cpu%d %s %x %x", recs[i].ts - start,
+			recs[i].cpu, name, recs[i].args[0], recs[i].args[1]);
+		con_flush();
+	}
+}
@@ -0,0 +1,18 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright (c) 2021 Amol Surati
+
+#ifndef TEST_HOST_H
+#define TEST_HOST_H
+
+// Included, with -include, ahead of each kernel source, stub and test that
+// is built for the host. The kernel's libc-like functions are renamed, so
+// that they do not interpose on the ones the host's libc uses internally.
+
+#define malloc				k_malloc
+#define free				k_free
+#define srand				k_srand
+#define rand				k_rand
+#define printf				k_printf
+#define snprintf			k_snprintf
+#define vsnprintf			k_vsnprintf
+#endif
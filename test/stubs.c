@@ -0,0 +1,99 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright (c) 2021 Amol Surati
+
+#include <lib/assert.h>
+
+#include <sys/condvar.h>
+#include <sys/err.h>
+#include <sys/mmu.h>
+#include <sys/mutex.h>
+#include <sys/pmm.h>
+
+#include "th.h"
+
+// Stand-ins for the parts of sys/ which need the hardware. The host build is
+// single-threaded; the locks only check that they are used in pairs.
+
+static pfn_t g_stub_next_frame;
+
+void mutex_init(struct mutex *m)
+{
+	m->lock = 0;
+}
+
+void mutex_lock(struct mutex *m)
+{
+	assert(m->lock == 0);
+	m->lock = 1;
+}
+
+void mutex_unlock(struct mutex *m)
+{
+	assert(m->lock == 1);
+	m->lock = 0;
+}
+
+void cond_var_init(struct cond_var *v)
+{
+	v->lock = NULL;
+}
+
+// No other thread can signal.
+void cond_var_wait(struct cond_var *v, struct mutex *lock)
+{
+	assert(0);
+	(void)v;
+	(void)lock;
+}
+
+void cond_var_signal(struct cond_var *v)
+{
+	(void)v;
+}
+
+void cond_var_broadcast(struct cond_var *v)
+{
+	(void)v;
+}
+
+// Frames are only handed out; the host has no physical memory to track.
+int pmm_alloc(enum align_bits align, int num_frames, pfn_t *out)
+{
+	assert(align == ALIGN_PAGE);
+	*out = g_stub_next_frame;
+	g_stub_next_frame += num_frames;
+	return ERR_SUCCESS;
+}
+
+int pmm_free(pfn_t frame, int num_frames)
+{
+	(void)frame;
+	(void)num_frames;
+	return ERR_SUCCESS;
+}
+
+// The page must lie within a range reserved by th_reserve.
+int mmu_map_page(int pid, vpn_t page, pfn_t frame, enum align_bits align,
+		 int flags)
+{
+	assert(pid == 0);
+	assert(align == ALIGN_PAGE);
+	if (th_map(vpn_to_va(page), PAGE_SIZE))
+		return ERR_NO_MEM;
+	return ERR_SUCCESS;
+	(void)frame;
+	(void)flags;
+}
+
+int mmu_unmap_page(int pid, vpn_t page)
+{
+	(void)pid;
+	(void)page;
+	return ERR_SUCCESS;
+}
+
+void do_assert(const char *msg, const char *func, const char *file, int line)
+{
+	th_out("asrt: \"%s\", %s, %s, %d", msg, func, file, line);
+	th_abort();
+}
@@ -0,0 +1,112 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright (c) 2021 Amol Surati
+
+#include <sys/bitmap.h>
+#include <sys/err.h>
+
+#include "th.h"
+
+#define T_BITMAP_NUM_BITS		1024
+
+static uint64_t g_t_bitmap_buf[T_BITMAP_NUM_BITS >> 6];
+
+static
+int t_bitmap_on_off()
+{
+	int err;
+	struct bitmap map;
+
+	err = bitmap_init(&map, g_t_bitmap_buf, T_BITMAP_NUM_BITS);
+	TH_CHECK(err == ERR_SUCCESS);
+	TH_CHECK(bitmap_is_off(&map, 0, T_BITMAP_NUM_BITS) == ERR_SUCCESS);
+
+	// A run which straddles a word.
+	TH_CHECK(bitmap_on(&map, 60, 10) == ERR_SUCCESS);
+	TH_CHECK(bitmap_is_on(&map, 60, 10) == ERR_SUCCESS);
+	TH_CHECK(bitmap_is_off(&map, 0, 60) == ERR_SUCCESS);
+	TH_CHECK(bitmap_is_off(&map, 70, T_BITMAP_NUM_BITS - 70) ==
+		 ERR_SUCCESS);
+	TH_CHECK(bitmap_is_on(&map, 59, 2) == ERR_UNEXP);
+	TH_CHECK(bitmap_is_off(&map, 69, 2) == ERR_UNEXP);
+
+	TH_CHECK(bitmap_off(&map, 62, 4) == ERR_SUCCESS);
+	TH_CHECK(bitmap_is_on(&map, 60, 2) == ERR_SUCCESS);
+	TH_CHECK(bitmap_is_off(&map, 62, 4) == ERR_SUCCESS);
+	TH_CHECK(bitmap_is_on(&map, 66, 4) == ERR_SUCCESS);
+	return ERR_SUCCESS;
+}
+
+static
+int t_bitmap_params()
+{
+	struct bitmap map;
+
+	TH_CHECK(bitmap_init(&map, NULL, 64) == ERR_PARAM);
+	TH_CHECK(bitmap_init(&map, g_t_bitmap_buf, 0) == ERR_PARAM);
+	bitmap_init(&map, g_t_bitmap_buf, T_BITMAP_NUM_BITS);
+	TH_CHECK(bitmap_on(&map, -1, 1) == ERR_PARAM);
+	TH_CHECK(bitmap_on(&map, 0, 0) == ERR_PARAM);
+	TH_CHECK(bitmap_on(&map, T_BITMAP_NUM_BITS - 1, 2) == ERR_PARAM);
+	TH_CHECK(bitmap_is_on(&map, T_BITMAP_NUM_BITS, 1) == ERR_PARAM);
+	return ERR_SUCCESS;
+}
+
+static
+int t_bitmap_find()
+{
+	int ix;
+	struct bitmap map;
+
+	bitmap_init(&map, g_t_bitmap_buf, T_BITMAP_NUM_BITS);
+	TH_CHECK(bitmap_find_off(&map, 0, 0, 1) == 0);
+
+	bitmap_on(&map, 0, 100);
+	TH_CHECK(bitmap_find_off(&map, 0, 0, 1) == 100);
+	TH_CHECK(bitmap_find_off(&map, 0, 0, 28) == 100);
+
+	// Aligned to 1 << 4.
+	TH_CHECK(bitmap_find_off(&map, 4, 0, 8) == 112);
+
+	// A hole too small is skipped.
+	bitmap_on(&map, 104, 1);
+	TH_CHECK(bitmap_find_off(&map, 0, 0, 4) == 100);
+	TH_CHECK(bitmap_find_off(&map, 0, 0, 5) == 105);
+
+	bitmap_on(&map, 0, T_BITMAP_NUM_BITS);
+	ix = bitmap_find_off(&map, 0, 0, 1);
+	TH_CHECK(ix == ERR_NOT_FOUND);
+
+	bitmap_off(&map, T_BITMAP_NUM_BITS - 1, 1);
+	TH_CHECK(bitmap_find_off(&map, 0, 0, 1) == T_BITMAP_NUM_BITS - 1);
+	TH_CHECK(bitmap_find_off(&map, 0, 0, 2) == ERR_NOT_FOUND);
+	return ERR_SUCCESS;
+}
+
+static
+int t_bitmap_bench()
+{
+	int i, ix;
+	uint64_t start;
+	struct bitmap map;
+
+	bitmap_init(&map, g_t_bitmap_buf, T_BITMAP_NUM_BITS);
+	bitmap_on(&map, 0, T_BITMAP_NUM_BITS - 64);
+
+	start = th_get_ns();
+	for (i = 0; i < 10000; ++i) {
+		ix = bitmap_find_off(&map, 0, 0, 1);
+		bitmap_on(&map, ix, 1);
+		bitmap_off(&map, ix, 1);
+	}
+	th_bench("bitmap_find_off_960", th_get_ns() - start, 10000);
+	TH_CHECK(ix == T_BITMAP_NUM_BITS - 64);
+	return ERR_SUCCESS;
+}
+
+const struct th_test g_t_bitmap[] = {
+	{"on_off", t_bitmap_on_off},
+	{"params", t_bitmap_params},
+	{"find", t_bitmap_find},
+	{"bench", t_bitmap_bench},
+	{NULL, NULL},
+};
@@ -0,0 +1,76 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright (c) 2021 Amol Surati
+
+#include <sys/err.h>
+#include <sys/list.h>
+
+#include "th.h"
+
+struct t_list_node {
+	int				val;
+	struct list_head		entry;
+};
+
+static
+int t_list_order()
+{
+	int i;
+	struct list_head head, *e;
+	struct t_list_node nodes[4], *n;
+
+	list_init(&head);
+	TH_CHECK(list_is_empty(&head));
+
+	for (i = 0; i < 4; ++i) {
+		nodes[i].val = i;
+		list_add_tail(&head, &nodes[i].entry);
+	}
+	TH_CHECK(!list_is_empty(&head));
+
+	i = 0;
+	list_for_each(e, &head) {
+		n = list_entry(e, struct t_list_node, entry);
+		TH_CHECK(n->val == i);
+		++i;
+	}
+	TH_CHECK(i == 4);
+
+	e = list_del_head(&head);
+	n = list_entry(e, struct t_list_node, entry);
+	TH_CHECK(n->val == 0);
+	e = list_del_tail(&head);
+	n = list_entry(e, struct t_list_node, entry);
+	TH_CHECK(n->val == 3);
+
+	list_del_entry(&nodes[1].entry);
+	e = list_del_head(&head);
+	n = list_entry(e, struct t_list_node, entry);
+	TH_CHECK(n->val == 2);
+	TH_CHECK(list_is_empty(&head));
+	return ERR_SUCCESS;
+}
+
+static
+int t_list_bench()
+{
+	int i;
+	uint64_t start;
+	struct list_head head;
+	struct t_list_node node;
+
+	list_init(&head);
+	start = th_get_ns();
+	for (i = 0; i < 1000000; ++i) {
+		list_add_tail(&head, &node.entry);
+		list_del_head(&head);
+	}
+	th_bench("list_add_del", th_get_ns() - start, 1000000);
+	TH_CHECK(list_is_empty(&head));
+	return ERR_SUCCESS;
+}
+
+const struct th_test g_t_list[] = {
+	{"order", t_list_order},
+	{"bench", t_list_bench},
+	{NULL, NULL},
+};
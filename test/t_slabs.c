@@ -0,0 +1,115 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright (c) 2021 Amol Surati
+
+#include <lib/stdlib.h>
+#include <lib/string.h>
+
+#include <sys/err.h>
+#include <sys/mmu.h>
+
+#include "th.h"
+
+#define T_SLABS_NUM_PTRS		10000
+
+static void *g_t_slabs_ptrs[T_SLABS_NUM_PTRS];
+
+// The SLABS area is reserved at its kernel VA; the stub of mmu_map_page
+// makes its pages accessible as the allocator maps them.
+static
+int t_slabs_init()
+{
+	int err;
+	va_t sys_end;
+	int	slabs_init(va_t *sys_end);
+
+	err = th_reserve(SLABS_BASE, SLABS_SIZE);
+	TH_CHECK(err == 0);
+	err = slabs_init(&sys_end);
+	TH_CHECK(err == ERR_SUCCESS);
+	return ERR_SUCCESS;
+}
+
+// Each object is aligned to its size class, and lies within SLABS.
+static
+int t_slabs_sizes()
+{
+	int i;
+	size_t size, align;
+	char *p;
+
+	for (i = 3, size = 1; size <= 32768; ++i, size <<= 1) {
+		p = malloc(size);
+		TH_CHECK(p);
+		align = size < 8 ? 8 : size;
+		TH_CHECK(((va_t)(uintptr_t)p & (align - 1)) == 0);
+		TH_CHECK((va_t)(uintptr_t)p >= SLABS_BASE);
+		TH_CHECK((va_t)(uintptr_t)p < SLABS_BASE + SLABS_SIZE);
+		memset(p, i, size);
+		free(p);
+	}
+	return ERR_SUCCESS;
+}
+
+// More objects than fit in one page; none may overlap, and a freed object
+// is handed out again.
+static
+int t_slabs_many()
+{
+	int i;
+	char *p, *q;
+
+	for (i = 0; i < T_SLABS_NUM_PTRS; ++i) {
+		p = malloc(16);
+		TH_CHECK(p);
+		memset(p, i, 16);
+		g_t_slabs_ptrs[i] = p;
+	}
+	for (i = 0; i < T_SLABS_NUM_PTRS; ++i) {
+		p = g_t_slabs_ptrs[i];
+		TH_CHECK(p[0] == (char)i && p[15] == (char)i);
+	}
+
+	// The page of the last object is still partially used, and is the
+	// first to be allocated from.
+	p = g_t_slabs_ptrs[T_SLABS_NUM_PTRS - 1];
+	free(p);
+	q = malloc(16);
+	TH_CHECK(q == p);
+	g_t_slabs_ptrs[T_SLABS_NUM_PTRS - 1] = q;
+
+	for (i = 0; i < T_SLABS_NUM_PTRS; ++i)
+		free(g_t_slabs_ptrs[i]);
+	return ERR_SUCCESS;
+}
+
+static
+int t_slabs_bench()
+{
+	int i;
+	void *p;
+	uint64_t start;
+
+	start = th_get_ns();
+	for (i = 0; i < 1000000; ++i) {
+		p = malloc(64);
+		free(p);
+	}
+	th_bench("malloc_free_64", th_get_ns() - start, 1000000);
+
+	start = th_get_ns();
+	for (i = 0; i < T_SLABS_NUM_PTRS; ++i)
+		g_t_slabs_ptrs[i] = malloc(64);
+	for (i = 0; i < T_SLABS_NUM_PTRS; ++i)
+		free(g_t_slabs_ptrs[i]);
+	th_bench("malloc_then_free_64", th_get_ns() - start,
+		 T_SLABS_NUM_PTRS);
+	return ERR_SUCCESS;
+}
+
+const struct th_test g_t_slabs[] = {
+	{"init", t_slabs_init},
+	{"sizes", t_slabs_sizes},
+	{"many", t_slabs_many},
+	{"bench", t_slabs_bench},
+	{NULL, NULL},
+};
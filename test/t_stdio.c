@@ -0,0 +1,142 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright (c) 2021 Amol Surati
+
+#include <lib/stdio.h>
+#include <lib/string.h>
+
+#include <sys/err.h>
+
+#include "th.h"
+
+static uint64_t g_t_stdio_state = 0x2545f4914f6cdd1dull;
+
+static
+uint64_t t_stdio_rand64()
+{
+	uint64_t v;
+
+	v = g_t_stdio_state;
+	v ^= v << 13;
+	v ^= v >> 7;
+	v ^= v << 17;
+	g_t_stdio_state = v;
+	return v;
+}
+
+// Parse back what snprintf wrote; -1 if it is not a number of the radix.
+static
+int t_stdio_parse(const char *s, int radix, uint64_t *out)
+{
+	int d;
+	uint64_t v;
+
+	if (*s == 0)
+		return -1;
+	for (v = 0; *s; ++s) {
+		if (*s >= '0' && *s <= '9')
+			d = *s - '0';
+		else if (*s >= 'a' && *s <= 'f')
+			d = *s - 'a' + 10;
+		else
+			return -1;
+		if (d >= radix)
+			return -1;
+		v = v * radix + d;
+	}
+	*out = v;
+	return 0;
+}
+
+static
+int t_stdio_fixed()
+{
+	int len;
+	char buf[64];
+
+	len = snprintf(buf, sizeof(buf), "a%db", 0);
+	TH_CHECK(len == 3 && strcmp(buf, "a0b") == 0);
+	len = snprintf(buf, sizeof(buf), "%d %x", 2147483647, 0xdeadbeef);
+	TH_CHECK(strcmp(buf, "2147483647 deadbeef") == 0);
+	TH_CHECK(len == 19);
+	snprintf(buf, sizeof(buf), "%ld", 18446744073709551615ull);
+	TH_CHECK(strcmp(buf, "18446744073709551615") == 0);
+	snprintf(buf, sizeof(buf), "%ld", 10000000000000000000ull);
+	TH_CHECK(strcmp(buf, "10000000000000000000") == 0);
+	snprintf(buf, sizeof(buf), "%lx", 0x123456789abcdefull);
+	TH_CHECK(strcmp(buf, "123456789abcdef") == 0);
+	snprintf(buf, sizeof(buf), "%s-%s", "ab", "cd");
+	TH_CHECK(strcmp(buf, "ab-cd") == 0);
+	return ERR_SUCCESS;
+}
+
+// The output is cut at size - 1 characters, and is always terminated.
+static
+int t_stdio_truncate()
+{
+	int len;
+	char buf[8];
+
+	memset(buf, 'z', sizeof(buf));
+	len = snprintf(buf, 4, "abcdef");
+	TH_CHECK(len == 3 && strcmp(buf, "abc") == 0);
+	TH_CHECK(buf[4] == 'z');
+
+	len = snprintf(buf, 4, "%d", 123456);
+	TH_CHECK(len <= 3 && buf[len] == 0);
+	return ERR_SUCCESS;
+}
+
+static
+int t_stdio_rand()
+{
+	int i, shift;
+	uint64_t v, p;
+	char buf[32];
+
+	for (i = 0; i < 1000000; ++i) {
+		v = t_stdio_rand64();
+		shift = t_stdio_rand64() & 63;
+		v >>= shift;
+
+		snprintf(buf, sizeof(buf), "%ld", v);
+		TH_CHECK(t_stdio_parse(buf, 10, &p) == 0 && p == v);
+		TH_CHECK(buf[0] != '0' || v == 0);
+
+		snprintf(buf, sizeof(buf), "%lx", v);
+		TH_CHECK(t_stdio_parse(buf, 16, &p) == 0 && p == v);
+	}
+	return ERR_SUCCESS;
+}
+
+static
+int t_stdio_bench()
+{
+	int i, sum;
+	uint64_t start;
+	char buf[32];
+	static uint64_t vals[1024];
+
+	for (i = 0; i < 1024; ++i)
+		vals[i] = t_stdio_rand64() >> (i & 63);
+
+	sum = 0;
+	start = th_get_ns();
+	for (i = 0; i < 1000000; ++i)
+		sum += snprintf(buf, sizeof(buf), "%ld", vals[i & 1023]);
+	th_bench("snprintf_ld", th_get_ns() - start, 1000000);
+
+	start = th_get_ns();
+	for (i = 0; i < 1000000; ++i)
+		sum += snprintf(buf, sizeof(buf), "%x", (uint32_t)vals[i & 1023]);
+	th_bench("snprintf_x", th_get_ns() - start, 1000000);
+	TH_CHECK(sum);
+	return ERR_SUCCESS;
+}
+
+const struct th_test g_t_stdio[] = {
+	{"fixed", t_stdio_fixed},
+	{"truncate", t_stdio_truncate},
+	{"rand", t_stdio_rand},
+	{"bench", t_stdio_bench},
+	{NULL, NULL},
+};
@@ -0,0 +1,127 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright (c) 2021 Amol Surati
+
+#include <lib/stdlib.h>
+
+#include <sys/err.h>
+
+#include "th.h"
+
+// The host's native division is the reference.
+
+static uint64_t g_t_stdlib_state = 0x9e3779b97f4a7c15ull;
+
+static
+uint64_t t_stdlib_rand64()
+{
+	uint64_t v;
+
+	// xorshift64
+	v = g_t_stdlib_state;
+	v ^= v << 13;
+	v ^= v >> 7;
+	v ^= v << 17;
+	g_t_stdlib_state = v;
+	return v;
+}
+
+static
+int t_stdlib_divmod_edges()
+{
+	uint64_t q, r;
+
+	TH_CHECK(divmod(1, 0, NULL) == (uint64_t)-1);
+	q = divmod(0, 7, &r);
+	TH_CHECK(q == 0 && r == 0);
+	q = divmod(6, 7, &r);
+	TH_CHECK(q == 0 && r == 6);
+	q = divmod(7, 7, &r);
+	TH_CHECK(q == 1 && r == 0);
+	q = divmod(-1ull, 1, &r);
+	TH_CHECK(q == -1ull && r == 0);
+	q = divmod(-1ull, -1ull, &r);
+	TH_CHECK(q == 1 && r == 0);
+	q = divmod(-1ull, 1ull << 63, &r);
+	TH_CHECK(q == 1 && r == (1ull << 63) - 1);
+	return ERR_SUCCESS;
+}
+
+static
+int t_stdlib_divmod_rand()
+{
+	int i, shift;
+	uint64_t num, den, q, r;
+
+	for (i = 0; i < 1000000; ++i) {
+		num = t_stdlib_rand64();
+		den = t_stdlib_rand64();
+
+		// Spread the divisors over all the widths.
+		shift = t_stdlib_rand64() & 63;
+		den >>= shift;
+		if (den == 0)
+			den = 1;
+		q = divmod(num, den, &r);
+		TH_CHECK(q == num / den);
+		TH_CHECK(r == num % den);
+	}
+	return ERR_SUCCESS;
+}
+
+// The divisors with a reciprocal, over 32-bit dividends.
+static
+int t_stdlib_divmod_recip()
+{
+	int i, j;
+	uint64_t num, q, r;
+	static const uint64_t dens[] = {10, 100, 1000};
+
+	for (j = 0; j < 3; ++j) {
+		for (i = 0; i < 1000000; ++i) {
+			num = (uint32_t)t_stdlib_rand64();
+			if (i < 2)
+				num = i ? 0xffffffff : 0;
+			q = divmod(num, dens[j], &r);
+			TH_CHECK(q == num / dens[j]);
+			TH_CHECK(r == num % dens[j]);
+		}
+	}
+	return ERR_SUCCESS;
+}
+
+static
+int t_stdlib_bench()
+{
+	int i;
+	uint64_t start, sum, r;
+	static uint64_t vals[1024];
+
+	for (i = 0; i < 1024; ++i)
+		vals[i] = t_stdlib_rand64();
+
+	sum = 0;
+	start = th_get_ns();
+	for (i = 0; i < 1000000; ++i)
+		sum += divmod(vals[i & 1023], 10, &r) + r;
+	th_bench("divmod_10", th_get_ns() - start, 1000000);
+
+	start = th_get_ns();
+	for (i = 0; i < 1000000; ++i)
+		sum += divmod((uint32_t)vals[i & 1023], 10, &r) + r;
+	th_bench("divmod_10_u32", th_get_ns() - start, 1000000);
+
+	start = th_get_ns();
+	for (i = 0; i < 1000000; ++i)
+		sum += divmod(vals[i & 1023], vals[(i + 1) & 1023] >> 32, &r);
+	th_bench("divmod_32", th_get_ns() - start, 1000000);
+	TH_CHECK(sum);
+	return ERR_SUCCESS;
+}
+
+const struct th_test g_t_stdlib[] = {
+	{"divmod_edges", t_stdlib_divmod_edges},
+	{"divmod_rand", t_stdlib_divmod_rand},
+	{"divmod_recip", t_stdlib_divmod_recip},
+	{"bench", t_stdlib_bench},
+	{NULL, NULL},
+};
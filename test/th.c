@@ -0,0 +1,114 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright (c) 2021 Amol Surati
+
+#define _POSIX_C_SOURCE			200809L
+#define _DEFAULT_SOURCE
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#include "th.h"
+
+// The only file built against the host's headers: output, time, memory and
+// the main loop.
+
+extern const struct th_test g_t_bitmap[];
+extern const struct th_test g_t_list[];
+extern const struct th_test g_t_stdlib[];
+extern const struct th_test g_t_stdio[];
+extern const struct th_test g_t_slabs[];
+
+static int g_th_num_failed;
+
+void th_out(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vfprintf(stdout, fmt, ap);
+	va_end(ap);
+	fputc('\n', stdout);
+}
+
+void th_fail(const char *msg, const char *func, const char *file, int line)
+{
+	th_out("fail: \"%s\", %s, %s, %d", msg, func, file, line);
+}
+
+void th_abort()
+{
+	fflush(stdout);
+	abort();
+}
+
+uint64_t th_get_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// The kernel's fixed VAs are below 4GB; reserve them at the same addresses
+// in the host process, without backing.
+int th_reserve(uint32_t va, uint32_t size)
+{
+	void *p;
+
+	p = mmap((void *)(uintptr_t)va, size, PROT_NONE,
+		 MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE |
+		 MAP_NORESERVE, -1, 0);
+	if (p == MAP_FAILED)
+		return -1;
+	if (p != (void *)(uintptr_t)va) {
+		munmap(p, size);
+		return -1;
+	}
+	return 0;
+}
+
+int th_map(uint32_t va, uint32_t size)
+{
+	return mprotect((void *)(uintptr_t)va, size, PROT_READ | PROT_WRITE);
+}
+
+void th_bench(const char *name, uint64_t ns, uint32_t num_ops)
+{
+	th_out("bench: name=%s ops=%u ns=%llu ns_op=%.2f", name, num_ops,
+	       (unsigned long long)ns, (double)ns / num_ops);
+}
+
+static
+void th_run(const char *suite, const struct th_test *tests, const char *only)
+{
+	int err;
+
+	for (; tests->name; ++tests) {
+		if (only && strcmp(only, suite) && strcmp(only, tests->name))
+			continue;
+		err = tests->fn();
+		th_out("test: %s.%s %s", suite, tests->name,
+		       err ? "fail" : "ok");
+		if (err)
+			++g_th_num_failed;
+	}
+}
+
+// Run everything, or only the suite or test named by the argument.
+int main(int argc, char **argv)
+{
+	const char *only;
+
+	only = argc > 1 ? argv[1] : NULL;
+	th_run("bitmap", g_t_bitmap, only);
+	th_run("list", g_t_list, only);
+	th_run("stdlib", g_t_stdlib, only);
+	th_run("stdio", g_t_stdio, only);
+	th_run("slabs", g_t_slabs, only);
+	th_out("done: %d failed", g_th_num_failed);
+	return g_th_num_failed ? 1 : 0;
+}
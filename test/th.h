@@ -0,0 +1,37 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright (c) 2021 Amol Surati
+
+#ifndef TEST_TH_H
+#define TEST_TH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The test harness. The kernel sources, the stubs and the tests see only
+// the kernel's headers; th.c alone sees the host's.
+
+typedef int fn_th_test();
+
+struct th_test {
+	const char			*name;
+	fn_th_test			*fn;
+};
+
+#define TH_CHECK(c)							\
+	do {								\
+		if ((c) == 0) {						\
+			th_fail(#c, __func__, __FILE__, __LINE__);	\
+			return ERR_FAILED;				\
+		}							\
+	} while (0)
+
+void		th_out(const char *fmt, ...);
+void		th_fail(const char *msg, const char *func, const char *file,
+			int line);
+__attribute__((noreturn))
+void		th_abort();
+uint64_t	th_get_ns();
+int		th_reserve(uint32_t va, uint32_t size);
+int		th_map(uint32_t va, uint32_t size);
+void		th_bench(const char *name, uint64_t ns, uint32_t num_ops);
+#endif